@@ -26,7 +26,12 @@ import random
 import sys
 
 import time
+import math
 import argparse
+import threading
+import collections
+import struct
+import binascii
 
 import board
 import busio
@@ -39,7 +44,25 @@ from adafruit_ads1x15.analog_in import AnalogIn
 I2C_ADDR       = 0x48     # 0x48 if ADDR=GND
 GAIN           = 1        # PGA: {2/3,1,2,4,8,16}. 1 => ±4.096V FS (ADS)
 DATA_RATE_SPS  = 128      # 8..860 samples/s
-READ_INTERVAL  = 0.20     # secs between readings (MODE continuous)
+DECIMATION     = 1        # conversions averaged into one sample
+AUTORANGE      = False    # PGA gain follows the signal
+BUFFER_SIZE    = 4096     # samples kept by the sampler thread
+MAX_BURST      = 1000     # samples per MGFLD:BUF? reply
+PUSH_QUEUE     = 256      # pushed samples waiting for a slow client
+VALID_RATES    = (8, 16, 32, 64, 128, 250, 475, 860)
+VALID_GAINS    = (2/3, 1, 2, 4, 8, 16)
+FULL_SCALE_V   = {2/3: 6.144, 1: 4.096, 2: 2.048, 4: 1.024, 8: 0.512, 16: 0.256}
+MAX_DECIMATION = 256
+# Sample codes are in units of RAW_LSB whatever the gain: 1/16 of a count at
+# the highest gain, so averaged conversions keep their extra resolution.
+RAW_LSB        = FULL_SCALE_V[16] / 32768 / 16
+# Autorange: one gain step down as soon as a sample block reaches
+# RANGE_DOWN of full scale, one step up when the block peak would stay
+# below RANGE_UP of the next range for RANGE_HOLD samples in a row.
+RANGE_DOWN     = 0.90
+RANGE_UP       = 0.70
+RANGE_HOLD     = 8
+NOISE_WINDOW   = 64       # samples in the noise estimate time constant
 
 # Note: (top=10k, bottom=20k) => V_adc = V_sens * 2/3  => V_sens = V_adc * 1.5
 DIVIDER_RATIO  = 1      # ratio used to find the real sensor voltage
@@ -47,34 +70,406 @@ DIVIDER_RATIO  = 1      # ratio used to find the real sensor voltage
 # Hall Sensor Calibration ( A1302 ~2.5 mV/G).
 V0             = 1.5     # Volt for Zero Magnet Field  
 SENS_V_PER_G   = 0.0014   # Sensibility in V/G (1.4 mV/G). (Remember: 1 Tesla = 10_000 Gauss :D )
+
+# Per-input calibration (V0 in V, sensitivity in V/G, divider ratio). AIN0 is
+# the single probe above, AIN1..AIN3 the X, Y, Z elements of a 3-axis probe.
+CHANNEL_CAL    = {0: [V0, SENS_V_PER_G, DIVIDER_RATIO],
+                  1: [1.5, 0.0014, 1],
+                  2: [1.5, 0.0014, 1],
+                  3: [1.5, 0.0014, 1]}
+AXES           = ()       # ADS inputs of X, Y, Z, e.g. (1, 2, 3); none = single probe
 # ====================================================================
 
+Sample = collections.namedtuple('Sample', 'seq t raw v_adc delta_v B')
+
+# Binary frames (little endian), enabled per connection by "MODE BIN":
+#   header  u16 magic 0x5AA5, u8 type, u8 version, u32 payload length,
+#           u32 frame sequence number
+#   payload
+#   u16     CRC-16/CCITT-FALSE of header + payload
+FRAME_MAGIC    = 0x5AA5
+FRAME_VERSION  = 3
+FRAME_BURST    = 1
+FRAME_PUSH     = 2
+# Burst payload: u32 first sample seq, u16 n, u16 spare, u32 lost,
+# u32 pending, f32 age_ms, f32 scale (V/count), f32 V0, f32 sens (V/G),
+# f64 capture time of the newest sample (s, Pi monotonic clock),
+# then i32 t_us[n] relative to the newest sample and i32 codes[n].
+# delta_v = codes * scale - V0 and B = -delta_v / sens.
+# Push payload: u32 sample seq, u32 dropped, f32 age_ms, i32 code,
+# f32 scale, f32 V0, f32 sens, f64 capture time (s, Pi monotonic clock).
+# The frame sequence number is the push counter of the subscription.
+#
+# Capture times are time.monotonic() right after the conversion was read,
+# averaged over the conversions of a decimated sample; TIME? returns the
+# same clock so clients can map it onto their own.
+
 status = {}
 verbose = "--verbose" in sys.argv
 
 
+def make_frame(ftype, seq, payload):
+    header = struct.pack('<HBBII', FRAME_MAGIC, ftype, FRAME_VERSION, len(payload), seq)
+    crc = binascii.crc_hqx(header + payload, 0xFFFF)
+    return header + payload + struct.pack('<H', crc)
+
+def burst_payload(samples, lost, pending, age):
+    n = len(samples)
+    t_last = samples[-1].t if samples else 0.0
+    v0, sens, divider = CHANNEL_CAL[0]
+    scale = RAW_LSB * divider
+    head = struct.pack('<IHHIIffffd', samples[0].seq if samples else 0, n, 0,
+                       lost, pending, age * 1e3, scale, v0, sens, t_last)
+    times = struct.pack(f'<{n}i', *(round((x.t - t_last) * 1e6) for x in samples))
+    codes = struct.pack(f'<{n}i', *(x.raw for x in samples))
+    return head + times + codes
+
+def push_payload(sample, dropped, age):
+    v0, sens, divider = CHANNEL_CAL[0]
+    scale = RAW_LSB * divider
+    return struct.pack('<IIfifffd', sample.seq, dropped, age * 1e3, sample.raw,
+                       scale, v0, sens, sample.t)
+
+
 ## Additional Methos for I2C GPIO
-def setup_adc():
-    """I2C and ADS1115 initialization (single mode, channel AIN0)."""
-    i2c = busio.I2C(board.SCL, board.SDA)   # bus I2C-1 sul Raspberry Pi
+def setup_adc(i2c, rate=DATA_RATE_SPS, channels=(0,), gain=GAIN):
+    """ADS1115 initialization on an open bus (continuous mode, one AnalogIn per input)."""
     ads = ADS1115(i2c, address=I2C_ADDR)
-    ads.mode = Mode.SINGLE              
-    ads.data_rate = DATA_RATE_SPS
-    ads.gain = GAIN
-    ch0 = AnalogIn(ads, 0)     
-    return ads, ch0
-
-def read_sample(chn):
-    """Output (v_adc, v_sens, B_gauss)."""
-    v_adc = chn.voltage                     
-    v_sens = v_adc * DIVIDER_RATIO          
-    delta_v = v_sens - V0
-    B_gauss = - delta_v / SENS_V_PER_G        # G = V / (V/G)
+    ads.data_rate = rate
+    ads.gain = gain
+    ads.mode = Mode.CONTINUOUS
+    inputs = [AnalogIn(ads, ch) for ch in channels]
+    return ads, inputs
+
+def gain_name(gain):
+    return '2/3' if gain == 2/3 else str(gain)
+
+def parse_gain(text):
+    """PGA gain from its name, None for AUTO."""
+    if text.upper() == 'AUTO':
+        return None
+    for gain in VALID_GAINS:
+        if text == gain_name(gain):
+            return gain
+    raise ValueError(text)
+
+def convert_sample(raw, ch=0):
+    """Sample code of input ch (RAW_LSB units) to (v_adc, delta_v, B_gauss)."""
+    v0, sens, divider = CHANNEL_CAL[ch]
+    v_adc = raw * RAW_LSB
+    v_sens = v_adc * divider
+    delta_v = v_sens - v0
+    B_gauss = - delta_v / sens        # G = V / (V/G)
     #return v_adc, v_sens, B_gauss
     return v_adc, delta_v, B_gauss
 
 
+class Sampler(threading.Thread):
+    """
+    Only owner of the I2C bus. Reads the ADC once per conversion period in
+    continuous mode and keeps Sample(seq, t_monotonic, raw, v_adc, delta_v,
+    B_gauss) in a ring buffer, so client commands never wait for a conversion.
+
+    With axes configured the inputs are read round-robin, AIN0 first, and
+    one set of axis samples sharing the same seq is kept next to the buffer,
+    which still holds AIN0 only. Every mux change costs the ADS1115 two
+    conversion periods (the driver waits them out), so a set of n inputs
+    takes 2n periods.
+
+    A sample is the mean of 'decim' conversions of each input taken one
+    conversion period apart: n inputs take n * (decim + 1) periods, a single
+    input decim periods. With autorange the PGA gain is stepped from the
+    peak of those conversions and written to the ADC in use. The I2C bus is
+    opened again only after a bus error.
+    """
+    def __init__(self, rate=DATA_RATE_SPS, size=BUFFER_SIZE, axes=AXES,
+                 decim=DECIMATION, gain=GAIN, autorange=AUTORANGE):
+        super().__init__(daemon=True)
+        self.lock = threading.Lock()
+        self.buffer = collections.deque(maxlen=size)
+        self.axes = tuple(axes)
+        self.channels = (0,) + tuple(ch for ch in self.axes if ch != 0)
+        self.axis_samples = None
+        self.rate = rate
+        self.new_rate = None
+        self.decim = decim
+        self.gain = gain
+        self.new_gain = None
+        self.autorange = autorange
+        self.gain_changes = 0
+        self.noise_var = None     # AIN0 sample noise, V^2
+        self.measured_rate = 0.0
+        self.errors = 0
+        self.seq = 0
+
+    def set_rate(self, rate):
+        if rate not in VALID_RATES:
+            raise ValueError(rate)
+        with self.lock:
+            self.new_rate = rate
+
+    def set_decim(self, decim):
+        if not 1 <= decim <= MAX_DECIMATION:
+            raise ValueError(decim)
+        with self.lock:
+            self.decim = decim
+            self.noise_var = None
+
+    def set_gain(self, gain):
+        """Fixed PGA gain, or autorange from the current one with None."""
+        with self.lock:
+            self.autorange = gain is None
+            if gain is not None:
+                self.new_gain = gain
+
+    def resolution(self):
+        """
+        Effective resolution of AIN0 samples: (bits, noise V rms, noise
+        gauss rms, sample rate). The noise comes from second differences of
+        consecutive samples, so slow field changes do not count, and is never
+        below the quantisation noise of the averaged conversions.
+        """
+        with self.lock:
+            fs, decim, var = FULL_SCALE_V[self.gain], self.decim, self.noise_var
+        n = len(self.channels)
+        q = fs / 32768 / (12 * decim) ** 0.5
+        noise = max(var ** 0.5, q) if var is not None else q
+        _, sens, divider = CHANNEL_CAL[0]
+        bits = math.log2(2 * fs / (12 ** 0.5 * noise))
+        rate = self.rate / (decim if n == 1 else n * (decim + 1))
+        return bits, noise, noise * divider / abs(sens), rate
+
+    def latest(self):
+        """Latest sample and its age in seconds, or (None, None)."""
+        with self.lock:
+            if not self.buffer:
+                return None, None
+            sample = self.buffer[-1]
+        return sample, time.monotonic() - sample.t
+
+    def latest_axes(self):
+        """Latest X, Y, Z samples and their age in seconds, or (None, None)."""
+        with self.lock:
+            samples = self.axis_samples
+        if not samples:
+            return None, None
+        return samples, time.monotonic() - samples[-1].t
+
+    def since(self, seq, n):
+        """
+        Up to n samples newer than seq, oldest first, with the number of
+        samples lost to buffer overwrite and the number still pending.
+        """
+        with self.lock:
+            if not self.buffer:
+                return [], 0, 0
+            oldest = self.buffer[0].seq
+            newest = self.buffer[-1].seq
+            first = max(seq + 1, oldest)
+            lost = max(0, oldest - seq - 1) if seq else 0
+            count = max(0, min(n, newest - first + 1))
+            start = first - oldest
+            samples = [self.buffer[i] for i in range(start, start + count)]
+        return samples, lost, newest - first + 1 - count
+
+    def convert(self, inputs, decim):
+        """
+        decim conversions of every input one conversion period apart: the
+        conversion lists and the mean read time of the first input.
+        """
+        blocks, times = [], []
+        for ain in inputs:
+            raws = []
+            t_conv = time.monotonic()
+            for i in range(decim):
+                if i:
+                    t_conv += 1.0 / self.rate
+                    delay = t_conv - time.monotonic()
+                    if delay > 0:
+                        time.sleep(delay)
+                raws.append(ain.value)
+                if not blocks:
+                    times.append(time.monotonic())
+            blocks.append(raws)
+        return blocks, sum(times) / len(times)
+
+    def next_gain(self, peak, hold):
+        """Autorange step for a block peak in counts, and the new hold count."""
+        i = VALID_GAINS.index(self.gain)
+        if peak >= RANGE_DOWN * 32767 and i > 0:
+            return VALID_GAINS[i - 1], 0
+        if i + 1 < len(VALID_GAINS):
+            up = VALID_GAINS[i + 1]
+            if peak * FULL_SCALE_V[self.gain] / FULL_SCALE_V[up] < RANGE_UP * 32767:
+                hold += 1
+                return (up, 0) if hold >= RANGE_HOLD else (None, hold)
+        return None, 0
+
+    def run(self):
+        i2c = ads = inputs = None
+        count, t_count = 0, time.monotonic()
+        hold, history = 0, collections.deque(maxlen=3)
+        while True:
+            try:
+                with self.lock:
+                    new_rate, self.new_rate = self.new_rate, None
+                    new_gain, self.new_gain = self.new_gain, None
+                    decim, autorange = self.decim, self.autorange
+                if ads is None or new_rate or new_gain:
+                    if new_rate:
+                        self.rate = new_rate
+                    if new_gain:
+                        self.gain = new_gain
+                    if i2c is None:
+                        i2c = busio.I2C(board.SCL, board.SDA)   # bus I2C-1 sul Raspberry Pi
+                    # A new ADS1115 on the open bus: in continuous mode the
+                    # driver writes the config register only on its first
+                    # read or a mux change, so rate and gain need a new one
+                    ads, inputs = setup_adc(i2c, self.rate, self.channels, self.gain)
+                    if verbose:
+                        print(f"Sampler: rate={ads.data_rate} SPS, gain={gain_name(self.gain)}, "
+                              f"decim={decim}, inputs={self.channels}")
+                    t_next = time.monotonic()
+                    count, t_count = 0, t_next
+                    hold = 0
+                    history.clear()
+                n = len(self.channels)
+                period = (decim if n == 1 else n * (decim + 1)) / self.rate
+                blocks, t = self.convert(inputs, decim)
+                scale = FULL_SCALE_V[self.gain] / 32768 / RAW_LSB
+                codes = [round(sum(raws) * scale / len(raws)) for raws in blocks]
+                with self.lock:
+                    self.seq += 1
+                    read = {ch: Sample(self.seq, t, code, *convert_sample(code, ch))
+                            for ch, code in zip(self.channels, codes)}
+                    self.buffer.append(read[0])
+                    if self.axes:
+                        self.axis_samples = [read[ch] for ch in self.axes]
+                    history.append(read[0].v_adc)
+                    if len(history) == 3:
+                        d2 = history[2] - 2 * history[1] + history[0]
+                        var = d2 * d2 / 6
+                        if self.noise_var is None:
+                            self.noise_var = var
+                        else:
+                            self.noise_var += (var - self.noise_var) / NOISE_WINDOW
+                if autorange:
+                    gain, hold = self.next_gain(max(abs(x) for raws in blocks for x in raws), hold)
+                    if gain:
+                        with self.lock:
+                            self.new_gain = gain
+                            self.gain_changes += 1
+                        if verbose:
+                            print(f"Sampler: autorange to gain {gain_name(gain)}")
+                count += 1
+                if t - t_count >= 1.0:
+                    self.measured_rate = count / (t - t_count)
+                    count, t_count = 0, t
+                t_next += period
+                delay = t_next - time.monotonic()
+                if delay > 0:
+                    time.sleep(delay)
+                else:
+                    t_next = time.monotonic()       # fell behind, do not burst
+            except (OSError, ValueError) as e:
+                self.errors += 1
+                if verbose:
+                    print(f"Sampler: ADC error {e}")
+                if isinstance(e, OSError) and i2c is not None:
+                    try:
+                        i2c.deinit()
+                    except (OSError, ValueError):
+                        pass
+                    i2c = None
+                ads = None
+                time.sleep(0.5)
+
+
+class Pusher:
+    """
+    Subscription of one connection: every 1/rate s the latest sample is
+    queued if it is new and, with a threshold, if B moved by at least the
+    threshold since the last push. A writer thread sends the queue, so a
+    slow client loses the oldest queued samples (counted in 'dropped')
+    instead of stalling the sampler or the command handler.
+    """
+    def __init__(self, send, is_on, binary, rate, threshold):
+        self.send = send
+        self.is_on = is_on
+        self.binary = binary
+        self.period = 1.0 / rate
+        self.threshold = threshold
+        self.queue = collections.deque()
+        self.cond = threading.Condition()
+        self.running = True
+        self.dropped = 0
+        self.push_seq = 0
+        self.threads = [threading.Thread(target=self.produce, daemon=True),
+                        threading.Thread(target=self.write, daemon=True)]
+        for t in self.threads:
+            t.start()
+
+    def stop(self):
+        with self.cond:
+            self.running = False
+            self.cond.notify()
+        for t in self.threads:
+            t.join()
+
+    def produce(self):
+        last_seq, last_B = 0, None
+        t_next = time.monotonic()
+        while self.running:
+            t_next += self.period
+            delay = t_next - time.monotonic()
+            if delay > 0:
+                time.sleep(delay)
+            else:
+                t_next = time.monotonic()
+            sample, _ = sampler.latest()
+            if not sample or sample.seq == last_seq or not self.is_on():
+                continue
+            if self.threshold and last_B is not None and abs(sample.B - last_B) < self.threshold:
+                continue
+            last_seq, last_B = sample.seq, sample.B
+            with self.cond:
+                if len(self.queue) >= PUSH_QUEUE:
+                    self.queue.popleft()
+                    self.dropped += 1
+                self.queue.append(sample)
+                self.cond.notify()
+
+    def write(self):
+        while True:
+            with self.cond:
+                while self.running and not self.queue:
+                    self.cond.wait()
+                if not self.running:
+                    return
+                sample = self.queue.popleft()
+                dropped = self.dropped
+            self.push_seq = (self.push_seq + 1) & 0xFFFFFFFF
+            age = time.monotonic() - sample.t
+            if self.binary:
+                data = make_frame(FRAME_PUSH, self.push_seq, push_payload(sample, dropped, age))
+            else:
+                data = (f'PUSH: {self.push_seq} {dropped} {sample.seq} {age * 1e3:.1f} '
+                        f'{sample.delta_v:.5f} {sample.B:.4f} {sample.t:.6f}\r\n').encode('utf-8')
+            try:
+                self.send(data)
+            except OSError:
+                with self.cond:
+                    self.running = False
+                return
+
+
 class HallSensor(socketserver.StreamRequestHandler):
+    def send(self, data):
+        """Writes from the command handler and the pusher are serialised."""
+        with self.write_lock:
+            self.wfile.write(data)
+            self.wfile.flush()
+
     def handle(self):
         global status
         global verbose
@@ -92,17 +487,20 @@ class HallSensor(socketserver.StreamRequestHandler):
             #status[client]['mgfield'] = mgfield
             status[client]['on'] = on
 
-        # setup ADC
-        ads, ch0 = setup_adc()
         if verbose:
-            print("Hall Sensor initialized.")
-            print(f"Addr=0x{I2C_ADDR:02X}, gain={ads.gain}, rate={ads.data_rate} SPS")
-            print(f"Divider ratio={DIVIDER_RATIO}, V0={V0} V, Sens={SENS_V_PER_G*1e3:.2f} mV/G")
+            print(f"Client {client} connected")
+        cursor = None   # last sample sent by MGFLD:BUF? on this connection
+        binary = False  # MGFLD:BUF? replies as binary frames
+        frame_seq = 0
+        pusher = None   # SUB subscription
+        self.write_lock = threading.Lock()
 
         while True:
             line = self.rfile.readline().strip()
             
             if not line:
+                if pusher:
+                    pusher.stop()
                 break
             
             line = line.decode('utf-8')  # Decode bytes to string
@@ -122,19 +520,189 @@ class HallSensor(socketserver.StreamRequestHandler):
 
             # Magnetic Field Reading Command
             elif line == 'MGFLD?':               
-                if on:
-                    _, _, B_g, = read_sample(ch0)
-                    reply = f'MGFLD: {B_g:.4f}'
+                sample, _ = sampler.latest()
+                if on and sample:
+                    reply = f'MGFLD: {sample.B:.4f}'
                 else:
                     reply = 'MGFLD: 0.0000'
 
             # Sensor Voltage Reading Command
             elif line == 'VOLT?':
-                if on:
-                    v_ads, v_sens, B_g = read_sample(ch0)
-                    reply = f'VOLT: {v_sens:.4f}'
+                sample, _ = sampler.latest()
+                if on and sample:
+                    reply = f'VOLT: {sample.delta_v:.4f}'
                 else:
                     reply = 'VOLT: 0.0000' 
+
+            # Field, voltage, sample code (RAW_LSB units), sample number and
+            # age in ms, all from the same sample
+            elif line == 'READ?':
+                sample, age = sampler.latest()
+                if on and sample:
+                    reply = (f'READ: {sample.B:.4f} {sample.delta_v:.5f} {sample.raw} '
+                             f'{sample.seq} {age * 1e3:.1f}')
+                else:
+                    reply = 'READ: 0.0000 0.00000 0 0 -1.0'
+
+            # 3-axis probe: Bx By Bz, sample number and age in ms of one set
+            elif line == 'MGFLD3?':
+                samples, age = sampler.latest_axes()
+                if not sampler.axes:
+                    reply = 'ERR MGFLD3? no axes'
+                elif on and samples:
+                    reply = ('MGFLD3: ' + ' '.join(f'{x.B:.4f}' for x in samples) +
+                             f' {samples[0].seq} {age * 1e3:.1f}')
+                else:
+                    reply = 'MGFLD3: 0.0000 0.0000 0.0000 0 -1.0'
+
+            elif line == 'AXES?':
+                reply = 'AXES: ' + (' '.join(str(ch) for ch in sampler.axes) or 'NONE')
+
+            # Calibration of one input: CAL n V0 sens_V_per_G divider, applied
+            # to conversions from the next sample on
+            elif len(args) == 2 and args[0] == 'CAL?':
+                try:
+                    ch = int(args[1])
+                    reply = 'CAL {} {:g} {:g} {:g}'.format(ch, *CHANNEL_CAL[ch])
+                except (ValueError, KeyError):
+                    reply = 'ERR CAL? 0..3'
+
+            elif len(args) == 5 and args[0] == 'CAL':
+                try:
+                    ch = int(args[1])
+                    v0, sens, divider = (float(x) for x in args[2:])
+                    if ch not in CHANNEL_CAL or sens == 0 or divider <= 0:
+                        raise ValueError(line)
+                except ValueError:
+                    reply = 'ERR CAL n V0 sens divider'
+                else:
+                    CHANNEL_CAL[ch] = [v0, sens, divider]
+                    reply = f'CAL {ch} {v0:g} {sens:g} {divider:g}'
+
+            # Age of the cached sample in ms, -1 before the first conversion
+            elif line == 'AGE?':
+                _, age = sampler.latest()
+                reply = f'AGE: {age * 1e3:.1f}' if age is not None else 'AGE: -1.0'
+
+            # Clock of the capture times, for offset and drift estimation
+            elif line == 'TIME?':
+                reply = f'TIME: {time.monotonic():.6f}'
+
+            # Burst: up to N samples since the previous burst on this
+            # connection (the latest N on the first one), oldest first.
+            # MGFLD:BUF: n lost pending age_ms t_cap t,V,B ... with t in s
+            # relative to the newest sample, age_ms the age of that one and
+            # t_cap its capture time.
+            # In binary mode the same content is sent as a FRAME_BURST frame.
+            elif len(args) == 2 and args[0] == 'MGFLD:BUF?':
+                try:
+                    n = max(1, min(int(args[1]), MAX_BURST))
+                except ValueError:
+                    n = 0
+                samples, lost, pending, age = [], 0, 0, -1e-3
+                if n and on:
+                    if cursor is None:
+                        latest, _ = sampler.latest()
+                        cursor = max(0, latest.seq - n) if latest else None
+                    if cursor is not None:
+                        samples, lost, pending = sampler.since(cursor, n)
+                    if samples:
+                        cursor = samples[-1].seq
+                        age = time.monotonic() - samples[-1].t
+                if not n:
+                    reply = 'ERR MGFLD:BUF? N'
+                elif binary:
+                    frame_seq = (frame_seq + 1) & 0xFFFFFFFF
+                    self.send(make_frame(FRAME_BURST, frame_seq,
+                                         burst_payload(samples, lost, pending, age)))
+                    if verbose:
+                        print(f"<-- frame {frame_seq}, {len(samples)} samples")
+                else:
+                    t_last = samples[-1].t if samples else 0.0
+                    reply = (f'MGFLD:BUF: {len(samples)} {lost} {pending} {age * 1e3:.1f} '
+                             f'{t_last:.6f}')
+                    if samples:
+                        reply += ' ' + ' '.join(f'{x.t - t_last:.6f},{x.delta_v:.5f},{x.B:.4f}'
+                                                for x in samples)
+
+            # Push subscription: SUB rate_hz [threshold_gauss], pushes use the
+            # transport selected by MODE at the time of SUB. The ack is sent
+            # before the first push; after UNSUB pushes already queued may
+            # still arrive before the ack.
+            elif len(args) in (2, 3) and args[0] == 'SUB':
+                try:
+                    rate = float(args[1])
+                    threshold = float(args[2]) if len(args) == 3 else 0.0
+                    if not 0 < rate <= 1000 or threshold < 0:
+                        raise ValueError(line)
+                except ValueError:
+                    reply = 'ERR SUB rate [threshold]'
+                else:
+                    if pusher:
+                        pusher.stop()
+                    self.send(f'SUB {rate:g} {threshold:g}\r\n'.encode('utf-8'))
+                    pusher = Pusher(self.send, lambda: status[client]['on'],
+                                    binary, rate, threshold)
+
+            elif line == 'UNSUB':
+                if pusher:
+                    pusher.stop()
+                    pusher = None
+                reply = 'UNSUB'
+
+            # Transport for data replies on this connection
+            elif line == 'MODE?':
+                reply = 'MODE ' + ('BIN' if binary else 'ASCII')
+
+            elif line == 'MODE BIN':
+                binary = True
+                frame_seq = 0
+                reply = f'MODE BIN {FRAME_VERSION}'
+
+            elif line == 'MODE ASCII':
+                binary = False
+                reply = 'MODE ASCII'
+
+            # Configured and measured sampler rate
+            elif line == 'RATE?':
+                reply = f'RATE: {sampler.rate} {sampler.measured_rate:.1f} {sampler.errors}'
+
+            elif len(args) > 1 and args[0] == 'RATE':
+                try:
+                    sampler.set_rate(int(args[1]))
+                    reply = f'RATE {int(args[1])}'
+                except ValueError:
+                    reply = 'ERR RATE ' + ' '.join(str(r) for r in VALID_RATES)
+
+            # Conversions averaged into one sample
+            elif line == 'DECIM?':
+                reply = f'DECIM: {sampler.decim}'
+
+            elif len(args) == 2 and args[0] == 'DECIM':
+                try:
+                    sampler.set_decim(int(args[1]))
+                    reply = f'DECIM {int(args[1])}'
+                except ValueError:
+                    reply = f'ERR DECIM 1..{MAX_DECIMATION}'
+
+            # PGA gain in use, its full scale in V, autorange flag and the
+            # number of autorange steps so far
+            elif line == 'GAIN?':
+                reply = (f'GAIN: {gain_name(sampler.gain)} {FULL_SCALE_V[sampler.gain]:g} '
+                         f'{int(sampler.autorange)} {sampler.gain_changes}')
+
+            elif len(args) == 2 and args[0] == 'GAIN':
+                try:
+                    sampler.set_gain(parse_gain(args[1]))
+                    reply = 'GAIN ' + args[1].upper()
+                except ValueError:
+                    reply = 'ERR GAIN AUTO ' + ' '.join(gain_name(g) for g in VALID_GAINS)
+
+            # Effective resolution of the field samples: bits, noise in uV
+            # and gauss rms, sample rate
+            elif line == 'ENOB?':
+                bits, noise, noise_B, rate = sampler.resolution()
+                reply = f'ENOB: {bits:.2f} {noise * 1e6:.2f} {noise_B:.5f} {rate:.2f}'
                        
             elif len(args) > 1:
                 try:
@@ -152,7 +720,7 @@ class HallSensor(socketserver.StreamRequestHandler):
                     pass
             
             if reply:
-                self.wfile.write((reply + '\r\n').encode('utf-8'))  # Encode string to bytes
+                self.send((reply + '\r\n').encode('utf-8'))  # Encode string to bytes
                 if verbose:
                     print("<-- " + reply)
 
@@ -162,6 +730,35 @@ class Server(socketserver.ThreadingMixIn, socketserver.TCPServer):
     def __init__(self, server_address, RequestHandlerClass):
         super().__init__(server_address, RequestHandlerClass)
 
+parser = argparse.ArgumentParser(description="Hall sensor TCP server")
+parser.add_argument("--verbose", action="store_true")
+parser.add_argument("--rate", type=int, default=DATA_RATE_SPS, choices=VALID_RATES,
+                    help="ADC data rate in samples/s")
+parser.add_argument("--decim", type=int, default=DECIMATION,
+                    help=f"conversions averaged into one sample, 1..{MAX_DECIMATION}")
+parser.add_argument("--gain", type=parse_gain, default=None if AUTORANGE else GAIN,
+                    help="PGA gain: " + ", ".join(gain_name(g) for g in VALID_GAINS) + " or AUTO")
+parser.add_argument("--buffer", type=int, default=BUFFER_SIZE,
+                    help="samples kept in the ring buffer")
+parser.add_argument("--axes", type=lambda s: tuple(int(x) for x in s.split(',')),
+                    default=AXES, help="ADS inputs of a 3-axis probe as X,Y,Z, e.g. 1,2,3")
+opts = parser.parse_args()
+if opts.axes and (len(opts.axes) != 3 or not set(opts.axes) <= set(CHANNEL_CAL)):
+    parser.error("--axes takes three inputs out of 0..3")
+if not 1 <= opts.decim <= MAX_DECIMATION:
+    parser.error(f"--decim takes 1..{MAX_DECIMATION}")
+
+sampler = Sampler(opts.rate, opts.buffer, opts.axes, opts.decim,
+                  opts.gain or GAIN, opts.gain is None)
+sampler.start()
+if verbose:
+    print("Hall Sensor initialized.")
+    print(f"Addr=0x{I2C_ADDR:02X}, gain={'AUTO' if opts.gain is None else gain_name(opts.gain)}, "
+          f"rate={opts.rate} SPS, decim={opts.decim}, buffer={opts.buffer}")
+    print(f"Divider ratio={DIVIDER_RATIO}, V0={V0} V, Sens={SENS_V_PER_G*1e3:.2f} mV/G")
+    if opts.axes:
+        print(f"3-axis probe on inputs X,Y,Z={opts.axes}")
+
 server = Server(('0.0.0.0', 10000), HallSensor)
 print("Serving on TCP 10000")
 print("Terminate with Ctrl-C")
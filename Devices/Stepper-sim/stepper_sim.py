@@ -0,0 +1,316 @@
+#!/usr/bin/env python3
+
+"""
+Stepper Driver - Simulator
+
+Description:
+    TCP simulation of the stepper motor driver used by the motorcontrol IOC
+    (drvStepper). Axes move with trapezoidal velocity profiles, or S-curves
+    when a move is given a jerk, between two limit switches; the switches
+    are seen with a small latency, so where a move stops on a switch depends
+    on the approach speed, as on the bench.
+
+Protocol, one command per line (CR LF), positions in steps, velocities in
+steps/s, accelerations in steps/s^2, jerk in steps/s^3:
+    *IDN?                   STEPPER SIM <version> <axes>
+    BOOT?                   BOOT: <id>, changes at every power-up
+    STAT? n                 STAT n <position> <flags>
+    MOVE n pos vel acc [jerk]   absolute move, S-curve with jerk
+    MOVR n dist vel acc [jerk]  relative move
+    JOG n vel acc           constant velocity, signed
+    HOME n dir vel acc      runs onto the limit switch, dir 1 = high side
+    STOP n acc              decelerated stop
+    SETPOS n pos            redefines the current position
+    POWER n 0|1             motor current off / on
+    RESET                   simulated power cycle of the driver
+Commands answer OK or ERR <reason>. Flags: 1 done, 2 moving, 4 high limit,
+8 low limit, 16 home (= high limit switch), 32 fault, 64 power on.
+"""
+
+__version__ = "1.1.0"
+__license__ = "MIT"
+
+
+import socketserver
+import sys
+import time
+import math
+import random
+import argparse
+import threading
+
+
+# ========================== Configuration ==========================
+N_AXES         = 1
+TICK           = 0.001    # s, motion update period
+LOW_SWITCH     = 0        # steps, physical position of the low limit switch
+HIGH_SWITCH    = 4800     # steps, physical position of the high limit switch
+START_RANGE    = (1000, 3000)   # physical position at first power-up
+SWITCH_LATENCY = 0.002    # s, switch input filter of the driver
+SWITCH_JITTER  = 0.001    # s, uniform spread of the latency
+SWITCH_SPREAD  = 0.3      # steps rms, mechanical repeatability of the switch
+STOP_ACCEL     = 40000    # steps/s^2, stop on a limit switch
+MAX_VELOCITY   = 5000     # steps/s
+# ====================================================================
+
+FLAG_DONE      = 1
+FLAG_MOVING    = 2
+FLAG_HIGH      = 4
+FLAG_LOW       = 8
+FLAG_HOME      = 16
+FLAG_FAULT     = 32
+FLAG_POWER     = 64
+
+verbose = "--verbose" in sys.argv
+
+
+def s_curve(dist, vel, acc, jerk):
+    """Segments (duration, jerk) of the S-curve from rest to rest over dist >= 0,
+    time-optimal within the limits as planned by drvStepper."""
+    def ramp(v):
+        if v * jerk >= acc * acc:
+            return v / acc + acc / jerk
+        return 2 * math.sqrt(v / jerk)
+    if vel * ramp(vel) > dist:
+        vel = 0.5 * acc * (math.sqrt(acc * acc / (jerk * jerk) + 4 * dist / acc) - acc / jerk)
+        if vel * jerk < acc * acc:
+            vel = (0.25 * dist * dist * jerk) ** (1 / 3)
+    tj = min(acc / jerk, math.sqrt(vel / jerk))
+    ta = vel / (jerk * tj) - tj
+    tc = max(0.0, dist / vel - ramp(vel)) if vel > 0 else 0.0
+    return [(tj, jerk), (ta, 0), (tj, -jerk), (tc, 0), (tj, -jerk), (ta, 0), (tj, jerk)]
+
+
+class Axis:
+    """One motor: physical position and the counter the driver reports."""
+    def __init__(self, phys):
+        self.phys = float(phys)   # steps from the low switch
+        self.origin = self.phys   # physical position of counter 0
+        self.vel = 0.0
+        self.acc = 1000.0
+        self.vmax = 0.0
+        self.mode = None          # None, 'move', 'profile', 'jog', 'stop'
+        self.target = 0.0
+        self.profile = []         # (t, s, v, a, jerk) segment starts of an S-curve
+        self.power = True
+        self.latched = 0          # switch flags seen by the driver
+        self.pending = []         # (time seen, flag) switch edges in the filter
+        self.trip = {FLAG_LOW: LOW_SWITCH, FLAG_HIGH: HIGH_SWITCH}
+
+    @property
+    def pos(self):
+        return self.phys - self.origin
+
+    def start(self, mode, vel, acc, target=0.0):
+        if not self.power:
+            raise ValueError('power off')
+        if acc <= 0 or not 0 < abs(vel) <= MAX_VELOCITY:
+            raise ValueError('velocity or acceleration')
+        direction = math.copysign(1, vel if mode == 'jog' else target - self.pos)
+        if (direction > 0 and self.latched & FLAG_HIGH) or \
+           (direction < 0 and self.latched & FLAG_LOW):
+            raise ValueError('on limit')
+        self.mode, self.vmax, self.acc, self.target = mode, vel, acc, target
+
+    def start_profile(self, vel, acc, jerk, target):
+        """S-curve move; from rest only, a moving axis blends as a trapezoid."""
+        if self.mode or jerk <= 0:
+            return self.start('move', vel, acc, target)
+        self.start('move', vel, acc, target)
+        self.profile, t, s, v, a = [], time.monotonic(), 0.0, 0.0, 0.0
+        self.start_pos = self.pos
+        for dt, j in s_curve(abs(target - self.pos), vel, acc, jerk):
+            self.profile.append((t, s, v, a, j))
+            t, s, v, a = t + dt, s + v * dt + a * dt * dt / 2 + j * dt ** 3 / 6, \
+                v + a * dt + j * dt * dt / 2, a + j * dt
+        self.profile.append((t, s, 0.0, 0.0, 0.0))
+        self.mode = 'profile'
+
+    def stop(self, acc):
+        if self.mode:
+            self.mode, self.acc = 'stop', max(acc, 1.0)
+
+    def switches(self):
+        """Switch inputs at the physical position, with their spread."""
+        flags = 0
+        if self.phys <= self.trip[FLAG_LOW]:
+            flags |= FLAG_LOW
+        if self.phys >= self.trip[FLAG_HIGH]:
+            flags |= FLAG_HIGH
+        return flags
+
+    def update(self, now, dt):
+        # Switch edges reach the driver after the input filter
+        raw = self.switches()
+        for flag in (FLAG_LOW, FLAG_HIGH):
+            if raw & flag and not self.latched & flag and \
+               not any(f == flag for _, f in self.pending):
+                delay = SWITCH_LATENCY + random.uniform(0, SWITCH_JITTER)
+                self.pending.append((now + delay, flag))
+            elif not raw & flag:
+                self.latched &= ~flag
+                self.pending = [p for p in self.pending if p[1] != flag]
+                center = LOW_SWITCH if flag == FLAG_LOW else HIGH_SWITCH
+                self.trip[flag] = center + random.gauss(0, SWITCH_SPREAD)
+        for p in [p for p in self.pending if p[0] <= now]:
+            self.pending.remove(p)
+            self.latched |= p[1]
+            moving_into = (p[1] == FLAG_HIGH and self.vel > 0) or \
+                          (p[1] == FLAG_LOW and self.vel < 0)
+            if moving_into:
+                self.mode, self.acc = 'stop', STOP_ACCEL
+
+        if self.mode == 'profile':
+            sign = math.copysign(1, self.target - self.start_pos)
+            if now >= self.profile[-1][0]:
+                self.phys = self.target + self.origin
+                self.vel, self.mode = 0.0, None
+                return
+            t0, s0, v0, a0, j = [p for p in self.profile if p[0] <= now][-1] \
+                if now >= self.profile[0][0] else self.profile[0]
+            dt = max(0.0, now - t0)
+            self.phys = self.origin + self.start_pos + sign * \
+                (s0 + v0 * dt + a0 * dt * dt / 2 + j * dt ** 3 / 6)
+            self.vel = sign * (v0 + a0 * dt + j * dt * dt / 2)
+            return
+        if self.mode == 'move':
+            d = self.target - self.pos
+            v_want = math.copysign(min(self.vmax, math.sqrt(2 * self.acc * abs(d))), d)
+        elif self.mode == 'jog':
+            v_want = self.vmax
+        else:
+            v_want = 0.0
+        dv = self.acc * dt
+        self.vel += max(-dv, min(dv, v_want - self.vel))
+        step = self.vel * dt
+        if self.mode == 'move' and (abs(step) >= abs(self.target - self.pos) or
+                                    (abs(self.target - self.pos) < 0.5 and abs(self.vel) <= 2 * dv)):
+            self.phys = self.target + self.origin
+            self.vel, self.mode = 0.0, None
+        else:
+            self.phys += step
+            if self.mode == 'stop' and self.vel == 0.0:
+                self.mode = None
+
+    def flags(self):
+        moving = self.mode is not None
+        flags = (FLAG_MOVING if moving else FLAG_DONE) | self.latched
+        if self.latched & FLAG_HIGH:
+            flags |= FLAG_HOME
+        if self.power:
+            flags |= FLAG_POWER
+        return flags
+
+
+class Driver(threading.Thread):
+    """Motion of all axes, updated every TICK."""
+    def __init__(self, n_axes, start):
+        super().__init__(daemon=True)
+        self.lock = threading.Lock()
+        self.axes = [Axis(start) for _ in range(n_axes)]
+        self.power_up()
+
+    def power_up(self):
+        self.boot_id = f'{random.getrandbits(32):08X}'
+        for axis in self.axes:
+            axis.origin = axis.phys
+            axis.vel, axis.mode = 0.0, None
+
+    def run(self):
+        t_last = time.monotonic()
+        while True:
+            time.sleep(TICK)
+            now = time.monotonic()
+            with self.lock:
+                for axis in self.axes:
+                    axis.update(now, now - t_last)
+            t_last = now
+
+    def command(self, line):
+        args = line.split()
+        if not args:
+            return None
+        if line == '*IDN?':
+            return f'STEPPER SIM {__version__} {len(self.axes)}'
+        if line == 'BOOT?':
+            return f'BOOT: {self.boot_id}'
+        if line == 'RESET':
+            with self.lock:
+                self.power_up()
+            return 'OK'
+        try:
+            n = int(args[1])
+            axis = self.axes[n]
+            vals = [float(x) for x in args[2:]]
+        except (IndexError, ValueError):
+            return 'ERR syntax'
+        with self.lock:
+            try:
+                if args[0] == 'STAT?' and not vals:
+                    return f'STAT {n} {round(axis.pos)} {axis.flags()}'
+                elif args[0] == 'MOVE' and len(vals) in (3, 4):
+                    axis.start_profile(abs(vals[1]), vals[2], vals[3] if len(vals) == 4 else 0,
+                                       round(vals[0]))
+                elif args[0] == 'MOVR' and len(vals) in (3, 4):
+                    axis.start_profile(abs(vals[1]), vals[2], vals[3] if len(vals) == 4 else 0,
+                                       round(axis.pos + vals[0]))
+                elif args[0] == 'JOG' and len(vals) == 2:
+                    axis.start('jog', vals[0], vals[1])
+                elif args[0] == 'HOME' and len(vals) == 3:
+                    axis.start('jog', abs(vals[1]) if vals[0] > 0 else -abs(vals[1]), vals[2])
+                elif args[0] == 'STOP' and len(vals) == 1:
+                    axis.stop(vals[0])
+                elif args[0] == 'SETPOS' and len(vals) == 1:
+                    if axis.mode:
+                        raise ValueError('moving')
+                    axis.origin = axis.phys - vals[0]
+                elif args[0] == 'POWER' and len(vals) == 1:
+                    axis.power = vals[0] != 0
+                    if not axis.power:
+                        axis.vel, axis.mode = 0.0, None
+                else:
+                    return 'ERR syntax'
+            except ValueError as e:
+                return f'ERR {e}'
+        return 'OK'
+
+
+class StepperHandler(socketserver.StreamRequestHandler):
+    def handle(self):
+        if verbose:
+            print(f"Client {self.client_address[0]} connected")
+        while True:
+            line = self.rfile.readline()
+            if not line:
+                break
+            line = line.decode('utf-8').strip()
+            reply = driver.command(line)
+            if verbose and not line.startswith('STAT?'):
+                print(f"--> {line}\n<-- {reply}")
+            if reply:
+                self.wfile.write((reply + '\r\n').encode('utf-8'))
+
+
+class Server(socketserver.ThreadingMixIn, socketserver.TCPServer):
+    daemon_threads = True
+    allow_reuse_address = True
+
+
+parser = argparse.ArgumentParser(description="Stepper driver simulator")
+parser.add_argument("--verbose", action="store_true")
+parser.add_argument("--port", type=int, default=10001, help="TCP port")
+parser.add_argument("--axes", type=int, default=N_AXES, help="number of axes")
+parser.add_argument("--start", type=float, default=None,
+                    help="physical start position in steps, random by default")
+opts = parser.parse_args()
+
+driver = Driver(opts.axes, opts.start if opts.start is not None else random.uniform(*START_RANGE))
+driver.start()
+
+server = Server(('0.0.0.0', opts.port), StepperHandler)
+print(f"Stepper simulator, {opts.axes} axes, serving on TCP {opts.port}")
+print("Terminate with Ctrl-C")
+try:
+    server.serve_forever()
+except KeyboardInterrupt:
+    sys.exit(0)
@@ -0,0 +1,170 @@
+#!/usr/bin/env python3
+
+"""
+Stepper Driver - drvStepper test against the simulator
+
+Description:
+    Starts stepper_sim.py and the iocstepsim test IOC of motorcontrol, whose
+    drvStepper port connects to the simulator, then checks over Channel
+    Access that:
+      - at rest the motor record RBV is the position the simulator reports
+      - a move reaches its target, with RBV polled along the way
+      - STOP during a move ends it short of the target, and it stays there
+    Needs caget/caput of EPICS base on PATH and the IOC built. Exits with 0
+    when all checks pass, 1 otherwise.
+
+    python3 test_drvStepper.py [--ioc DIR] [--port N]
+"""
+
+__version__ = "1.0.0"
+__license__ = "MIT"
+
+
+import os
+import sys
+import time
+import socket
+import argparse
+import subprocess
+
+
+# ========================== Configuration ==========================
+MOTOR          = 'SIM:Ax1_Mtr'   # motor record of iocstepsim
+START          = 2000     # steps, physical start of the simulator
+MOVE_DIST      = 400      # steps, checked move
+STOP_DIST      = 1600     # steps, move interrupted by STOP
+STOP_AFTER     = 1.0      # s into the move before STOP
+TOLERANCE      = 1        # steps, RBV against the simulator
+CONNECT_TIME   = 15.0     # s, IOC up and motor connected
+MOVE_TIME      = 15.0     # s, longest move
+# ====================================================================
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+IOC_DIR = os.path.join(HERE, '..', '..', 'Magnets_full_build_1', 'Motor_control_1',
+                       'iocBoot', 'iocstepsim')
+
+
+def caget(field):
+    out = subprocess.run(['caget', '-t', '-w', '2', f'{MOTOR}.{field}'],
+                         capture_output=True, text=True)
+    if out.returncode:
+        raise RuntimeError(f'caget {MOTOR}.{field}: {out.stderr.strip()}')
+    return float(out.stdout.split()[0])
+
+def caput(field, value):
+    out = subprocess.run(['caput', '-t', '-w', '2', f'{MOTOR}.{field}', str(value)],
+                         capture_output=True, text=True)
+    if out.returncode:
+        raise RuntimeError(f'caput {MOTOR}.{field}: {out.stderr.strip()}')
+
+def sim_position(port):
+    """Position of axis 0 read from the simulator on a connection of its own."""
+    with socket.create_connection(('localhost', port), timeout=2) as s:
+        s.sendall(b'STAT? 0\r\n')
+        reply = s.makefile('r').readline().split()
+    return int(reply[2]), int(reply[3])
+
+def wait_done(timeout=MOVE_TIME):
+    """RBV samples until DMOV, None on timeout."""
+    samples = []
+    t_end = time.monotonic() + timeout
+    while time.monotonic() < t_end:
+        samples.append(caget('RBV'))
+        if caget('DMOV') == 1:
+            return samples
+        time.sleep(0.05)
+    return None
+
+
+class Checks:
+    def __init__(self):
+        self.failed = 0
+
+    def check(self, ok, what):
+        print(('PASS ' if ok else 'FAIL ') + what)
+        if not ok:
+            self.failed += 1
+        return ok
+
+
+def run_checks(port):
+    c = Checks()
+
+    # Rest: RBV is what the driver polls from the simulator
+    rbv = caget('RBV')
+    pos, flags = sim_position(port)
+    c.check(abs(rbv - pos) <= TOLERANCE, f'at rest RBV {rbv:g} = simulator {pos}')
+
+    # Move: reaches the target, RBV updated by the moving poll
+    target = rbv + MOVE_DIST
+    caput('VAL', target)
+    samples = wait_done()
+    if c.check(samples is not None, f'move to {target:g} done'):
+        between = {s for s in samples if min(rbv, target) < s < max(rbv, target)}
+        c.check(len(between) >= 3, f'RBV polled during the move ({len(between)} positions)')
+        rbv = caget('RBV')
+        pos, flags = sim_position(port)
+        c.check(abs(rbv - target) <= TOLERANCE and abs(pos - target) <= TOLERANCE,
+                f'move ends at {target:g}: RBV {rbv:g}, simulator {pos}')
+
+    # Stop: ends short of the target and stays there
+    start, target = rbv, rbv - STOP_DIST
+    caput('VAL', target)
+    time.sleep(STOP_AFTER)
+    caput('STOP', 1)
+    samples = wait_done()
+    if c.check(samples is not None, 'stop done'):
+        rbv = caget('RBV')
+        c.check(target < rbv < start, f'stopped at {rbv:g}, between {start:g} and {target:g}')
+        time.sleep(0.5)
+        pos, flags = sim_position(port)
+        c.check(abs(pos - rbv) <= TOLERANCE and flags & 1 and not flags & 2,
+                f'simulator still at {pos}, done, flags {flags}')
+    return c.failed
+
+
+def main():
+    parser = argparse.ArgumentParser(description="drvStepper test against stepper_sim.py")
+    parser.add_argument("--ioc", default=IOC_DIR, help="iocstepsim directory")
+    parser.add_argument("--port", type=int, default=10001, help="simulator TCP port")
+    opts = parser.parse_args()
+
+    arch = os.environ.get('EPICS_HOST_ARCH', 'linux-x86_64')
+    os.environ.update(EPICS_CA_AUTO_ADDR_LIST='NO', EPICS_CA_ADDR_LIST='localhost')
+    env = dict(os.environ, STEPPER_HOST=f'localhost:{opts.port}')
+
+    sim = subprocess.Popen([sys.executable, os.path.join(HERE, 'stepper_sim.py'),
+                            '--port', str(opts.port), '--start', str(START)],
+                           stdout=subprocess.DEVNULL)
+    # stdin stays open, at EOF the IOC shell exits
+    ioc = subprocess.Popen([os.path.join('..', '..', 'bin', arch, 'motorcontrol'), 'st.cmd'],
+                           cwd=opts.ioc, env=env, stdin=subprocess.PIPE,
+                           stdout=subprocess.DEVNULL)
+    try:
+        t_end = time.monotonic() + CONNECT_TIME
+        while True:
+            try:
+                # MSTA bit 1 (done) once the driver has reported the axis
+                if int(caget('MSTA')) & 2:
+                    break
+            except RuntimeError:
+                pass
+            if time.monotonic() > t_end or ioc.poll() is not None:
+                print('FAIL IOC not up or motor not connected')
+                return 1
+            time.sleep(0.5)
+        failed = run_checks(opts.port)
+    except RuntimeError as e:
+        print(f'FAIL {e}')
+        failed = 1
+    finally:
+        ioc.terminate()
+        sim.terminate()
+        ioc.wait()
+        sim.wait()
+    print('OK' if not failed else f'{failed} checks failed')
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -16,9 +16,24 @@ raspignet_registerRecordDeviceDriver pdbbase
 
 ## Load record instances
 dbLoadRecords "../../db/gsmtr.db","user=iocadm"
+dbLoadRecords "../../db/gsmtrDriver.db","P=GSMTR:,PORT=GSMTR_DRV,NELM=1000"
+## 3-axis probe: uncomment when the server is started with --axes
+#dbLoadRecords "../../db/gsmtrAxes.db","P=GSMTR:,PORT=RASPY1"
+## ADC rate, oversampling and PGA gain
+dbLoadRecords "../../db/gsmtrAdc.db","P=GSMTR:,PORT=RASPY1"
 
 drvAsynIPPortConfigure("RASPY1", "172.30.84.235:10000", 0, 0, 0)
 
+## Separate connections for block transfers and pushed samples, so neither
+## delays the StreamDevice records on RASPY1
+drvAsynIPPortConfigure("RASPY1_DATA", "172.30.84.235:10000", 0, 0, 0)
+drvAsynIPPortConfigure("RASPY1_PUSH", "172.30.84.235:10000", 0, 0, 0)
+drvGaussmeterConfigure("GSMTR_DRV", "RASPY1_DATA", "RASPY1_PUSH", 1000, "hallSensor.cal")
+
+## Filtered copy of the burst field blocks
+gmFilterConfigure("GSMTR_FLT", 1000)
+dbLoadRecords "../../db/gmFilter.db","P=GSMTR:flt:,PORT=GSMTR_FLT,INPUT=GSMTR:bufField,NELM=1000"
+
 iocInit()
 
 ## Start any sequence programs
@@ -0,0 +1,1112 @@
+/* drvGaussmeter.cpp */
+/*
+ * Gaussmeter data driver.
+ *
+ * Every GM_BUF_PERIOD seconds the poll thread sends "MGFLD:BUF? N" and gets
+ * back every sample taken by the Pi since the previous burst, at most N:
+ *
+ *     MGFLD:BUF: n lost pending age_ms t_cap t,V,B t,V,B ...
+ *
+ * t is in seconds relative to the newest sample of the block, age_ms is the
+ * age of that sample when the reply was built and t_cap its capture time on
+ * the Pi monotonic clock. The block is published on the GM_BUF_FIELD,
+ * GM_BUF_VOLT and GM_BUF_TIME waveforms with the record time stamp set to
+ * the acquisition time of the newest sample.
+ *
+ * Every GM_SYNC_PERIOD seconds the same thread sends a few "TIME?" requests
+ * and adds the one with the shortest round trip to a linear fit of the Pi
+ * clock against the IOC clock (offset and drift). Once the fit exists, time
+ * stamps of bursts and pushes come from t_cap through it; before that, and
+ * with the sync disabled, from the reply arrival time minus age_ms, which
+ * carries the network latency.
+ *
+ * With GM_BIN_MODE set the driver sends "MODE BIN" first and the same burst
+ * comes back as a length-prefixed frame carrying int32 sample codes, the
+ * code-to-volt scale and the sensor calibration, a frame sequence number
+ * and a CRC-16. Any framing error flushes the input and renegotiates.
+ *
+ * The push connection sends "SUB rate threshold" while GM_PUSH_ENABLE is
+ * set; the server then pushes the latest sample at up to rate Hz, only when
+ * B moved by threshold if that is non-zero. Each sample is published on
+ * the GM_PUSH_FIELD/GM_PUSH_VOLT I/O Intr parameters and appended to the
+ * GM_PUSH_HISTORY waveform, which is posted at most 10 times a second.
+ * Samples dropped by the server for a slow client and gaps in the push
+ * sequence add up in GM_PUSH_DROPPED.
+ *
+ * With GM_CAL_ENABLE set and a table loaded (GM_CAL_LOAD_FILE, or the
+ * calFile argument), burst and push fields are recomputed in the IOC from
+ * the sensor voltage, delta_v + V0, through the table in gmCalibration,
+ * optionally corrected for the temperature written to GM_CAL_TEMP. V0 comes
+ * with every binary frame; for ASCII data it is read with "CAL? 0" when the
+ * connection is negotiated. Without a table the Pi conversion is kept.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <epicsThread.h>
+#include <epicsMath.h>
+#include <epicsTime.h>
+#include <epicsStdio.h>
+#include <errlog.h>
+#include <iocsh.h>
+
+#include "asynDriver.h"
+#include "asynOctetSyncIO.h"
+#include "drvGaussmeter.h"
+
+#include <epicsExport.h>
+
+static const char *driverName = "drvGaussmeter";
+
+#define GM_TIMEOUT      1.0
+/* Reply bytes per sample: "-0.123456,-0.12345,-1234.5678 " */
+#define GM_SAMPLE_CHARS 32
+/* Read timeout on the push connection, bounds the reaction to PV changes */
+#define GM_PUSH_POLL    0.2
+/* Minimum interval between GM_PUSH_HISTORY callbacks, s */
+#define GM_HISTORY_INTERVAL 0.1
+/* TIME? exchanges per sync round and sync points kept in the clock fit */
+#define GM_SYNC_TRIES   5
+#define GM_SYNC_WINDOW  32
+/* A point this far off the fit means the Pi clock restarted, s */
+#define GM_SYNC_RESET   0.05
+
+/*
+ * Fits ioc = iocRef + slope (dev - devRef) with devRef the newest point, so
+ * iocRef - devRef is the current offset. Below a few seconds of spread the
+ * slope is not observable and is held at 1.
+ */
+void gmClock::addPoint(double dev, double ioc, size_t window)
+{
+    double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0, x, r, ss = 0.0;
+    size_t i, n;
+
+    if (valid() && fabs(toIoc(dev) - ioc) > GM_SYNC_RESET)
+        clear();
+    dev_.push_back(dev);
+    ioc_.push_back(ioc);
+    while (dev_.size() > window) {
+        dev_.pop_front();
+        ioc_.pop_front();
+    }
+
+    n = dev_.size();
+    devRef_ = dev;
+    for (i = 0; i < n; i++) {
+        x = dev_[i] - devRef_;
+        sx += x;
+        sy += ioc_[i];
+        sxx += x * x;
+        sxy += x * ioc_[i];
+    }
+    if (n >= 2 && dev_.back() - dev_.front() > 5.0) {
+        slope_ = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+        iocRef_ = (sy - slope_ * sx) / n;
+    } else {
+        slope_ = 1.0;
+        iocRef_ = (sy - sx) / n;
+    }
+    for (i = 0; i < n; i++) {
+        r = ioc_[i] - toIoc(dev_[i]);
+        ss += r * r;
+    }
+    residual_ = sqrt(ss / n);
+}
+
+static void pollTaskC(void *drvPvt)
+{
+    drvGaussmeter *pPvt = (drvGaussmeter *)drvPvt;
+    pPvt->pollTask();
+}
+
+static void pushTaskC(void *drvPvt)
+{
+    drvGaussmeter *pPvt = (drvGaussmeter *)drvPvt;
+    pPvt->pushTask();
+}
+
+drvGaussmeter::drvGaussmeter(const char *portName, const char *ioPortName,
+                             const char *pushPortName, int maxSamples, const char *calFile)
+    : asynPortDriver(portName, 1,
+                     asynInt32Mask | asynFloat64Mask | asynOctetMask |
+                     asynFloat64ArrayMask | asynDrvUserMask,
+                     asynInt32Mask | asynFloat64Mask | asynOctetMask |
+                     asynFloat64ArrayMask,
+                     0, 1, 0, 0),
+      pasynUserIO_(NULL), maxSamples_(maxSamples > 0 ? maxSamples : 500),
+      lastBurst_(0), rate_(0.0), binActive_(-1), frameSeq_(0),
+      pasynUserPush_(NULL), resubscribe_(false), pushSeq_(0), droppedBase_(0),
+      pushGaps_(0), rateStart_(0), lastHistory_(0), rateCount_(0),
+      cal_(NULL), calActive_(false), serverV0_(epicsNAN)
+{
+    static const char *functionName = "drvGaussmeter";
+    char errMsg[128];
+    asynStatus status;
+
+    reply_.resize(maxSamples_ * GM_SAMPLE_CHARS + 64);
+    field_.reserve(maxSamples_);
+    volt_.reserve(maxSamples_);
+    time_.reserve(maxSamples_);
+    vSens_.reserve(maxSamples_);
+    wakeup_ = epicsEventMustCreate(epicsEventEmpty);
+    pushWakeup_ = epicsEventMustCreate(epicsEventEmpty);
+    pushBuffer_.resize(256);
+
+    createParam(GM_BUF_ENABLE_STRING,  asynParamInt32,        &P_BufEnable);
+    createParam(GM_BUF_PERIOD_STRING,  asynParamFloat64,      &P_BufPeriod);
+    createParam(GM_BUF_FIELD_STRING,   asynParamFloat64Array, &P_BufField);
+    createParam(GM_BUF_VOLT_STRING,    asynParamFloat64Array, &P_BufVolt);
+    createParam(GM_BUF_TIME_STRING,    asynParamFloat64Array, &P_BufTime);
+    createParam(GM_BUF_NREAD_STRING,   asynParamInt32,        &P_BufNRead);
+    createParam(GM_BUF_LOST_STRING,    asynParamInt32,        &P_BufLost);
+    createParam(GM_BUF_PENDING_STRING, asynParamInt32,        &P_BufPending);
+    createParam(GM_BUF_AGE_STRING,     asynParamFloat64,      &P_BufAge);
+    createParam(GM_BUF_RATE_STRING,    asynParamFloat64,      &P_BufRate);
+    createParam(GM_BUF_ERRORS_STRING,  asynParamInt32,        &P_BufErrors);
+    createParam(GM_BUF_BYTES_STRING,   asynParamInt32,        &P_BufBytes);
+    createParam(GM_BIN_MODE_STRING,    asynParamInt32,        &P_BinMode);
+    createParam(GM_BIN_ACTIVE_STRING,  asynParamInt32,        &P_BinActive);
+    createParam(GM_BIN_CRC_ERRORS_STRING, asynParamInt32,     &P_BinCrcErrors);
+    createParam(GM_BIN_SEQ_GAPS_STRING, asynParamInt32,       &P_BinSeqGaps);
+    createParam(GM_PUSH_ENABLE_STRING, asynParamInt32,        &P_PushEnable);
+    createParam(GM_PUSH_RATE_STRING,   asynParamFloat64,      &P_PushRate);
+    createParam(GM_PUSH_THRESHOLD_STRING, asynParamFloat64,   &P_PushThreshold);
+    createParam(GM_PUSH_ACTIVE_STRING, asynParamInt32,        &P_PushActive);
+    createParam(GM_PUSH_FIELD_STRING,  asynParamFloat64,      &P_PushField);
+    createParam(GM_PUSH_VOLT_STRING,   asynParamFloat64,      &P_PushVolt);
+    createParam(GM_PUSH_AGE_STRING,    asynParamFloat64,      &P_PushAge);
+    createParam(GM_PUSH_HISTORY_STRING, asynParamFloat64Array, &P_PushHistory);
+    createParam(GM_PUSH_COUNT_STRING,  asynParamInt32,        &P_PushCount);
+    createParam(GM_PUSH_DROPPED_STRING, asynParamInt32,       &P_PushDropped);
+    createParam(GM_PUSH_RX_RATE_STRING, asynParamFloat64,     &P_PushRxRate);
+    createParam(GM_PUSH_ERRORS_STRING, asynParamInt32,        &P_PushErrors);
+    createParam(GM_SYNC_PERIOD_STRING, asynParamFloat64,      &P_SyncPeriod);
+    createParam(GM_SYNC_VALID_STRING,  asynParamInt32,        &P_SyncValid);
+    createParam(GM_SYNC_OFFSET_STRING, asynParamFloat64,      &P_SyncOffset);
+    createParam(GM_SYNC_DRIFT_STRING,  asynParamFloat64,      &P_SyncDrift);
+    createParam(GM_SYNC_RTT_STRING,    asynParamFloat64,      &P_SyncRtt);
+    createParam(GM_SYNC_RESIDUAL_STRING, asynParamFloat64,    &P_SyncResidual);
+    createParam(GM_SYNC_COUNT_STRING,  asynParamInt32,        &P_SyncCount);
+    createParam(GM_CAL_ENABLE_STRING,  asynParamInt32,        &P_CalEnable);
+    createParam(GM_CAL_ACTIVE_STRING,  asynParamInt32,        &P_CalActive);
+    createParam(GM_CAL_LOAD_FILE_STRING, asynParamOctet,      &P_CalLoadFile);
+    createParam(GM_CAL_VERSION_STRING, asynParamOctet,        &P_CalVersion);
+    createParam(GM_CAL_NPTS_STRING,    asynParamInt32,        &P_CalNpts);
+    createParam(GM_CAL_TEMP_COMP_STRING, asynParamInt32,      &P_CalTempComp);
+    createParam(GM_CAL_TEMP_STRING,    asynParamFloat64,      &P_CalTemp);
+    createParam(GM_CAL_TREF_STRING,    asynParamFloat64,      &P_CalTref);
+    createParam(GM_CAL_OUTSIDE_STRING, asynParamInt32,        &P_CalOutside);
+    createParam(GM_CAL_V0_STRING,      asynParamFloat64,      &P_CalV0);
+
+    setIntegerParam(P_BufEnable, 0);
+    setDoubleParam(P_BufPeriod, 0.5);
+    setIntegerParam(P_BufNRead, 0);
+    setIntegerParam(P_BufLost, 0);
+    setIntegerParam(P_BufPending, 0);
+    setDoubleParam(P_BufAge, 0.0);
+    setDoubleParam(P_BufRate, 0.0);
+    setIntegerParam(P_BufErrors, 0);
+    setIntegerParam(P_BufBytes, 0);
+    setIntegerParam(P_BinMode, 0);
+    setIntegerParam(P_BinActive, 0);
+    setIntegerParam(P_BinCrcErrors, 0);
+    setIntegerParam(P_BinSeqGaps, 0);
+    setIntegerParam(P_PushEnable, 0);
+    setDoubleParam(P_PushRate, 10.0);
+    setDoubleParam(P_PushThreshold, 0.0);
+    setIntegerParam(P_PushActive, 0);
+    setIntegerParam(P_PushCount, 0);
+    setIntegerParam(P_PushDropped, 0);
+    setDoubleParam(P_PushRxRate, 0.0);
+    setIntegerParam(P_PushErrors, 0);
+    setDoubleParam(P_SyncPeriod, 10.0);
+    setIntegerParam(P_SyncValid, 0);
+    setDoubleParam(P_SyncOffset, 0.0);
+    setDoubleParam(P_SyncDrift, 0.0);
+    setDoubleParam(P_SyncRtt, 0.0);
+    setDoubleParam(P_SyncResidual, 0.0);
+    setIntegerParam(P_SyncCount, 0);
+    setIntegerParam(P_CalEnable, 0);
+    setIntegerParam(P_CalActive, 0);
+    setStringParam(P_CalLoadFile, "");
+    setStringParam(P_CalVersion, "Pi");
+    setIntegerParam(P_CalNpts, 0);
+    setIntegerParam(P_CalTempComp, 0);
+    setDoubleParam(P_CalTemp, 25.0);
+    setDoubleParam(P_CalTref, 25.0);
+    setIntegerParam(P_CalOutside, 0);
+    setDoubleParam(P_CalV0, 0.0);
+
+    if (calFile && calFile[0]) {
+        setStringParam(P_CalLoadFile, calFile);
+        if (loadCalibration(calFile, errMsg, sizeof errMsg) != asynSuccess)
+            errlogPrintf("%s::%s: %s: %s\n", driverName, functionName, calFile, errMsg);
+    }
+
+    if (pushPortName && pushPortName[0]) {
+        status = pasynOctetSyncIO->connect(pushPortName, 0, &pasynUserPush_, NULL);
+        if (status == asynSuccess) {
+            pasynOctetSyncIO->setInputEos(pasynUserPush_, "\r\n", 2);
+            pasynOctetSyncIO->setOutputEos(pasynUserPush_, "\r\n", 2);
+            epicsThreadCreate("gmPush", epicsThreadPriorityMedium,
+                              epicsThreadGetStackSize(epicsThreadStackMedium),
+                              (EPICSTHREADFUNC)pushTaskC, this);
+        } else {
+            errlogPrintf("%s::%s: cannot connect to push port %s\n",
+                         driverName, functionName, pushPortName);
+        }
+    }
+
+    status = pasynOctetSyncIO->connect(ioPortName, 0, &pasynUserIO_, NULL);
+    if (status != asynSuccess) {
+        errlogPrintf("%s::%s: cannot connect to port %s\n",
+                     driverName, functionName, ioPortName);
+        return;
+    }
+    pasynOctetSyncIO->setInputEos(pasynUserIO_, "\r\n", 2);
+    pasynOctetSyncIO->setOutputEos(pasynUserIO_, "\r\n", 2);
+
+    epicsThreadCreate(portName, epicsThreadPriorityMedium,
+                      epicsThreadGetStackSize(epicsThreadStackMedium),
+                      (EPICSTHREADFUNC)pollTaskC, this);
+}
+
+/*
+ * Parses the header and the samples in place. Returns the number of
+ * samples, or -1 if the reply is malformed.
+ */
+int drvGaussmeter::parseBurst(char *reply, int *lost, int *pending, double *age,
+                              double *tDev)
+{
+    static const char *header = "MGFLD:BUF:";
+    char *p = reply, *end;
+    long i, n;
+
+    if (strncmp(p, header, strlen(header)) != 0)
+        return -1;
+    p += strlen(header);
+    n = strtol(p, &end, 10);
+    if (end == p || n < 0 || (size_t)n > maxSamples_)
+        return -1;
+    *lost = (int)strtol(end, &p, 10);
+    *pending = (int)strtol(p, &end, 10);
+    *age = strtod(end, &p);
+    if (p == end)
+        return -1;
+    *tDev = strtod(p, &end);
+    if (end == p)
+        return -1;
+    p = end;
+
+    field_.resize(n);
+    volt_.resize(n);
+    time_.resize(n);
+    for (i = 0; i < n; i++) {
+        time_[i] = strtod(p, &end);
+        if (end == p || *end != ',')
+            return -1;
+        volt_[i] = strtod(end + 1, &p);
+        if (p == end + 1 || *p != ',')
+            return -1;
+        field_[i] = strtod(p + 1, &end);
+        if (end == p + 1)
+            return -1;
+        p = end;
+    }
+    return (int)n;
+}
+
+static epicsUInt32 getU32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((epicsUInt32)p[3] << 24);
+}
+
+static epicsUInt16 getU16(const unsigned char *p)
+{
+    return (epicsUInt16)(p[0] | (p[1] << 8));
+}
+
+static double getF32(const unsigned char *p)
+{
+    epicsUInt32 u = getU32(p);
+    epicsFloat32 f;
+
+    memcpy(&f, &u, sizeof f);
+    return f;
+}
+
+static double getF64(const unsigned char *p)
+{
+    epicsUInt64 u = getU32(p) | ((epicsUInt64)getU32(p + 4) << 32);
+    epicsFloat64 f;
+
+    memcpy(&f, &u, sizeof f);
+    return f;
+}
+
+/* CRC-16/CCITT-FALSE, as binascii.crc_hqx(data, 0xFFFF) on the Pi */
+static epicsUInt16 crc16(const unsigned char *p, size_t n)
+{
+    epicsUInt16 crc = 0xFFFF;
+    int bit;
+
+    while (n--) {
+        crc ^= (epicsUInt16)(*p++ << 8);
+        for (bit = 0; bit < 8; bit++)
+            crc = (crc & 0x8000) ? (epicsUInt16)((crc << 1) ^ 0x1021) : (epicsUInt16)(crc << 1);
+    }
+    return crc;
+}
+
+/*
+ * Switches the transport of the data replies on this connection. The
+ * acknowledgement is always an ASCII line, and the line terminator is left
+ * set; callers clear it only while reading frames, which go by length.
+ */
+asynStatus drvGaussmeter::negotiate(asynUser *pasynUser, int binary)
+{
+    const char *command = binary ? "MODE BIN" : "MODE ASCII";
+    char reply[64], expect[32];
+    double v0;
+    size_t nwrite, nread;
+    int eom;
+    asynStatus status;
+
+    pasynOctetSyncIO->flush(pasynUser);
+    pasynOctetSyncIO->setInputEos(pasynUser, "\r\n", 2);
+    status = pasynOctetSyncIO->writeRead(pasynUser, command, strlen(command),
+                                         reply, sizeof reply - 1, GM_TIMEOUT,
+                                         &nwrite, &nread, &eom);
+    if (status != asynSuccess)
+        return status;
+    reply[nread] = '\0';
+    if (binary)
+        epicsSnprintf(expect, sizeof expect, "MODE BIN %d", GM_FRAME_VERSION);
+    else
+        epicsSnprintf(expect, sizeof expect, "MODE ASCII");
+    if (strcmp(reply, expect) != 0)
+        return asynError;
+
+    /* Zero-field voltage of the probe, to rebuild sensor volts from ASCII data */
+    status = pasynOctetSyncIO->writeRead(pasynUser, "CAL? 0", 6, reply, sizeof reply - 1,
+                                         GM_TIMEOUT, &nwrite, &nread, &eom);
+    if (status != asynSuccess)
+        return status;
+    reply[nread] = '\0';
+    if (sscanf(reply, "CAL 0 %lf", &v0) == 1) {
+        lock();
+        serverV0_ = v0;
+        setDoubleParam(P_CalV0, v0);
+        unlock();
+    }
+    return asynSuccess;
+}
+
+/* *got tells a timeout before any byte from one in the middle of a frame */
+asynStatus drvGaussmeter::readExact(asynUser *pasynUser, char *buffer, size_t nBytes,
+                                    double timeout, size_t *got)
+{
+    size_t nread;
+    int eom;
+    asynStatus status;
+
+    *got = 0;
+    while (*got < nBytes) {
+        status = pasynOctetSyncIO->read(pasynUser, buffer + *got, nBytes - *got,
+                                        timeout, &nread, &eom);
+        if (status != asynSuccess)
+            return status;
+        *got += nread;
+    }
+    return asynSuccess;
+}
+
+/*
+ * Reads one frame of the given type into buffer and checks it. Returns
+ * asynTimeout only if nothing at all arrived within the timeout.
+ */
+asynStatus drvGaussmeter::readFrame(asynUser *pasynUser, int type, unsigned char *buffer,
+                                    size_t bufferSize, double timeout,
+                                    size_t *length, epicsUInt32 *seq)
+{
+    size_t got;
+    int errors;
+    asynStatus status;
+
+    status = readExact(pasynUser, (char *)buffer, GM_FRAME_HEADER_SIZE, timeout, &got);
+    if (status != asynSuccess)
+        return (status == asynTimeout && got == 0) ? asynTimeout : asynError;
+    *length = getU32(buffer + 4);
+    if (getU16(buffer) != GM_FRAME_MAGIC || buffer[2] != type ||
+        buffer[3] != GM_FRAME_VERSION || GM_FRAME_HEADER_SIZE + *length + 2 > bufferSize)
+        return asynError;
+    status = readExact(pasynUser, (char *)buffer + GM_FRAME_HEADER_SIZE, *length + 2,
+                       GM_TIMEOUT, &got);
+    if (status != asynSuccess)
+        return asynError;
+    if (crc16(buffer, GM_FRAME_HEADER_SIZE + *length) !=
+        getU16(buffer + GM_FRAME_HEADER_SIZE + *length)) {
+        lock();
+        getIntegerParam(P_BinCrcErrors, &errors);
+        setIntegerParam(P_BinCrcErrors, errors + 1);
+        unlock();
+        return asynError;
+    }
+    *seq = getU32(buffer + 8);
+    return asynSuccess;
+}
+
+asynStatus drvGaussmeter::readBurstAscii(size_t *nBytes, int *n, int *lost, int *pending,
+                                         double *age, double *tDev)
+{
+    char command[32];
+    size_t nwrite, nread;
+    int eom;
+    asynStatus status;
+
+    epicsSnprintf(command, sizeof command, "MGFLD:BUF? %lu", (unsigned long)maxSamples_);
+    status = pasynOctetSyncIO->writeRead(pasynUserIO_, command, strlen(command),
+                                         &reply_[0], reply_.size() - 1, GM_TIMEOUT,
+                                         &nwrite, &nread, &eom);
+    if (status != asynSuccess)
+        return status;
+    reply_[nread] = '\0';
+    *nBytes = nread + 2;
+    *n = parseBurst(&reply_[0], lost, pending, age, tDev);
+    return *n < 0 ? asynError : asynSuccess;
+}
+
+/* Same content as the ASCII reply, from sample codes and the frame calibration */
+asynStatus drvGaussmeter::readBurstBinary(size_t *nBytes, int *n, int *lost, int *pending,
+                                          double *age, double *tDev, double *v0)
+{
+    unsigned char *frame = (unsigned char *)&reply_[0];
+    const unsigned char *payload, *times, *codes;
+    char command[32];
+    size_t nwrite, length;
+    epicsUInt32 seq;
+    double scale, sens;
+    int i, errors;
+    asynStatus status;
+
+    epicsSnprintf(command, sizeof command, "MGFLD:BUF? %lu", (unsigned long)maxSamples_);
+    status = pasynOctetSyncIO->write(pasynUserIO_, command, strlen(command),
+                                     GM_TIMEOUT, &nwrite);
+    /* Frames are read by length; restore the line terminator on every exit */
+    if (status == asynSuccess) {
+        pasynOctetSyncIO->setInputEos(pasynUserIO_, "", 0);
+        status = readFrame(pasynUserIO_, GM_FRAME_BURST, frame, reply_.size(),
+                           GM_TIMEOUT, &length, &seq);
+        pasynOctetSyncIO->setInputEos(pasynUserIO_, "\r\n", 2);
+    }
+    if (status != asynSuccess || length < GM_BURST_HEADER_SIZE)
+        return asynError;
+    *nBytes = GM_FRAME_HEADER_SIZE + length + 2;
+    if (frameSeq_ && seq != frameSeq_ + 1) {
+        lock();
+        getIntegerParam(P_BinSeqGaps, &errors);
+        setIntegerParam(P_BinSeqGaps, errors + 1);
+        unlock();
+    }
+    frameSeq_ = seq;
+
+    payload = frame + GM_FRAME_HEADER_SIZE;
+    *n = getU16(payload + 4);
+    *lost = (int)getU32(payload + 8);
+    *pending = (int)getU32(payload + 12);
+    *age = getF32(payload + 16);
+    scale = getF32(payload + 20);
+    *v0 = getF32(payload + 24);
+    sens = getF32(payload + 28);
+    *tDev = getF64(payload + 32);
+    if ((size_t)*n > maxSamples_ || length != GM_BURST_HEADER_SIZE + (size_t)*n * 8 ||
+        sens == 0.0)
+        return asynError;
+
+    times = payload + GM_BURST_HEADER_SIZE;
+    codes = times + 4 * *n;
+    field_.resize(*n);
+    volt_.resize(*n);
+    time_.resize(*n);
+    for (i = 0; i < *n; i++) {
+        time_[i] = (epicsInt32)getU32(times + 4 * i) * 1e-6;
+        volt_[i] = (epicsInt32)getU32(codes + 4 * i) * scale - *v0;
+        field_[i] = -volt_[i] / sens;
+    }
+    return asynSuccess;
+}
+
+asynStatus drvGaussmeter::readBurst()
+{
+    size_t nBytes = 0;
+    int n = 0, lost = 0, pending = 0, totalLost, errors, binMode;
+    double age = 0.0, tDev = 0.0, v0 = epicsNAN, dt;
+    epicsTimeStamp stamp;
+    epicsUInt64 now;
+    asynStatus status = asynSuccess;
+
+    lock();
+    getIntegerParam(P_BinMode, &binMode);
+    unlock();
+    if (binActive_ != binMode) {
+        status = negotiate(pasynUserIO_, binMode);
+        if (status == asynSuccess) {
+            binActive_ = binMode;
+            frameSeq_ = 0;
+        }
+    }
+    if (status == asynSuccess) {
+        if (binActive_)
+            status = readBurstBinary(&nBytes, &n, &lost, &pending, &age, &tDev, &v0);
+        else
+            status = readBurstAscii(&nBytes, &n, &lost, &pending, &age, &tDev);
+    }
+    now = epicsMonotonicGet();
+
+    lock();
+    if (status != asynSuccess) {
+        /* Resynchronise: drop partial input and negotiate again */
+        pasynOctetSyncIO->flush(pasynUserIO_);
+        binActive_ = -1;
+        setIntegerParam(P_BinActive, 0);
+        getIntegerParam(P_BufErrors, &errors);
+        setIntegerParam(P_BufErrors, errors + 1);
+        callParamCallbacks();
+        unlock();
+        return status;
+    }
+
+    if (n > 0) {
+        calibrate(v0, &volt_[0], &field_[0], n);
+        stampSample(tDev, age, &stamp);
+        setTimeStamp(&stamp);
+        doCallbacksFloat64Array(&field_[0], n, P_BufField, 0);
+        doCallbacksFloat64Array(&volt_[0], n, P_BufVolt, 0);
+        doCallbacksFloat64Array(&time_[0], n, P_BufTime, 0);
+        setDoubleParam(P_BufAge, age);
+    }
+    if (lastBurst_) {
+        dt = (now - lastBurst_) * 1e-9;
+        rate_ = rate_ ? rate_ * 0.9 + 0.1 * n / dt : n / dt;
+        setDoubleParam(P_BufRate, rate_);
+    }
+    lastBurst_ = now;
+    getIntegerParam(P_BufLost, &totalLost);
+    setIntegerParam(P_BufLost, totalLost + lost);
+    setIntegerParam(P_BufNRead, n);
+    setIntegerParam(P_BufPending, pending);
+    setIntegerParam(P_BufBytes, (int)nBytes);
+    setIntegerParam(P_BinActive, binActive_);
+    callParamCallbacks();
+    unlock();
+    return asynSuccess;
+}
+
+/*
+ * Replaces the Pi fields by the table ones when the calibration is active.
+ * Called with the lock held; v0 is NaN for ASCII data.
+ */
+void drvGaussmeter::calibrate(double v0, const double *volt, double *field, size_t n)
+{
+    size_t i;
+    int outside;
+
+    if (!isfinite(v0))
+        v0 = serverV0_;
+    if (!calActive_ || !isfinite(v0)) {
+        setIntegerParam(P_CalActive, 0);
+        return;
+    }
+    vSens_.resize(n);
+    for (i = 0; i < n; i++)
+        vSens_[i] = volt[i] + v0;
+    getIntegerParam(P_CalOutside, &outside);
+    setIntegerParam(P_CalOutside, outside + cal_->convert(&vSens_[0], field, n));
+    setIntegerParam(P_CalActive, 1);
+}
+
+/* Applies enable and temperature to the loaded table. Called with the lock held. */
+void drvGaussmeter::updateCalibration()
+{
+    double temp;
+    int enable, tempComp;
+
+    getIntegerParam(P_CalEnable, &enable);
+    getIntegerParam(P_CalTempComp, &tempComp);
+    getDoubleParam(P_CalTemp, &temp);
+    calActive_ = enable && cal_;
+    if (cal_)
+        cal_->setTemperature(tempComp ? temp : cal_->tref());
+    if (!calActive_)
+        setIntegerParam(P_CalActive, 0);
+}
+
+/*
+ * Builds the new table aside and swaps it in; an empty name goes back to
+ * the Pi conversion. Called with the lock held.
+ */
+asynStatus drvGaussmeter::loadCalibration(const char *fileName, char *errMsg, size_t errSize)
+{
+    gmCalibration *pNew = NULL;
+
+    if (fileName[0]) {
+        pNew = new gmCalibration;
+        if (pNew->load(fileName, errMsg, errSize)) {
+            delete pNew;
+            return asynError;
+        }
+    }
+    delete cal_;
+    cal_ = pNew;
+    setStringParam(P_CalVersion, cal_ ? cal_->version() : "Pi");
+    setIntegerParam(P_CalNpts, cal_ ? cal_->nPoints() : 0);
+    setDoubleParam(P_CalTref, cal_ ? cal_->tref() : 25.0);
+    setIntegerParam(P_CalOutside, 0);
+    updateCalibration();
+    callParamCallbacks();
+    return asynSuccess;
+}
+
+/*
+ * Capture time of a sample in IOC time. Called with the lock held. Without
+ * a clock fit the sample is taken to be age_ms older than the reply.
+ */
+void drvGaussmeter::stampSample(double tDev, double age, epicsTimeStamp *stamp)
+{
+    epicsTimeGetCurrent(stamp);
+    if (clock_.valid())
+        epicsTimeAddSeconds(stamp, clock_.toIoc(tDev) - epicsMonotonicGet() * 1e-9);
+    else
+        epicsTimeAddSeconds(stamp, -age * 1e-3);
+}
+
+/*
+ * One sync round on the data connection. TIME? is answered with an ASCII
+ * line also in binary mode; the connection keeps the line terminator
+ * outside the binary burst reads.
+ */
+asynStatus drvGaussmeter::syncClock()
+{
+    char reply[64];
+    size_t nwrite, nread;
+    double t0, t1, dev, rtt = -1.0, bestDev = 0.0, bestIoc = 0.0;
+    int i, eom, errors;
+    asynStatus status = asynSuccess;
+
+    for (i = 0; i < GM_SYNC_TRIES && status == asynSuccess; i++) {
+        t0 = epicsMonotonicGet() * 1e-9;
+        status = pasynOctetSyncIO->writeRead(pasynUserIO_, "TIME?", 5, reply,
+                                             sizeof reply - 1, GM_TIMEOUT,
+                                             &nwrite, &nread, &eom);
+        t1 = epicsMonotonicGet() * 1e-9;
+        if (status != asynSuccess)
+            break;
+        reply[nread] = '\0';
+        if (sscanf(reply, "TIME: %lf", &dev) != 1) {
+            status = asynError;
+            break;
+        }
+        if (rtt < 0.0 || t1 - t0 < rtt) {
+            rtt = t1 - t0;
+            bestDev = dev;
+            bestIoc = 0.5 * (t0 + t1);
+        }
+    }
+    lock();
+    if (status != asynSuccess) {
+        /* Counted with the burst errors, same connection */
+        pasynOctetSyncIO->flush(pasynUserIO_);
+        binActive_ = -1;
+        setIntegerParam(P_BinActive, 0);
+        getIntegerParam(P_BufErrors, &errors);
+        setIntegerParam(P_BufErrors, errors + 1);
+    } else {
+        clock_.addPoint(bestDev, bestIoc, GM_SYNC_WINDOW);
+        setIntegerParam(P_SyncValid, 1);
+        setIntegerParam(P_SyncCount, (int)clock_.count());
+        setDoubleParam(P_SyncOffset, clock_.offset());
+        setDoubleParam(P_SyncDrift, clock_.drift());
+        setDoubleParam(P_SyncRtt, rtt * 1e3);
+        setDoubleParam(P_SyncResidual, clock_.residual() * 1e3);
+    }
+    callParamCallbacks();
+    unlock();
+    return status;
+}
+
+void drvGaussmeter::pollTask()
+{
+    double period, syncPeriod;
+    epicsUInt64 lastSync = 0;
+    int enable;
+
+    for (;;) {
+        lock();
+        getDoubleParam(P_BufPeriod, &period);
+        getIntegerParam(P_BufEnable, &enable);
+        getDoubleParam(P_SyncPeriod, &syncPeriod);
+        unlock();
+        epicsEventWaitWithTimeout(wakeup_, period);
+        if (syncPeriod > 0.0 &&
+            (!lastSync || (epicsMonotonicGet() - lastSync) * 1e-9 >= syncPeriod)) {
+            syncClock();
+            lastSync = epicsMonotonicGet();
+        }
+        if (!enable) {
+            lastBurst_ = 0;
+            continue;
+        }
+        readBurst();
+    }
+}
+
+/*
+ * The acknowledgement "SUB rate threshold" is an ASCII line sent before the
+ * first push, also in binary mode.
+ */
+asynStatus drvGaussmeter::subscribe(int binary, double rate, double threshold)
+{
+    char command[64], reply[64];
+    size_t nwrite, nread;
+    int eom;
+    asynStatus status;
+
+    status = negotiate(pasynUserPush_, binary);
+    if (status != asynSuccess)
+        return status;
+    epicsSnprintf(command, sizeof command, "SUB %g %g", rate, threshold);
+    status = pasynOctetSyncIO->writeRead(pasynUserPush_, command, strlen(command),
+                                         reply, sizeof reply - 1, GM_TIMEOUT,
+                                         &nwrite, &nread, &eom);
+    if (status != asynSuccess)
+        return status;
+    reply[nread] = '\0';
+    if (strncmp(reply, "SUB ", 4) != 0)
+        return asynError;
+    if (binary)
+        pasynOctetSyncIO->setInputEos(pasynUserPush_, "", 0);
+    pushSeq_ = 0;
+    return asynSuccess;
+}
+
+/* Pushes queued before the ack may still arrive, so the ack is not parsed */
+void drvGaussmeter::unsubscribe()
+{
+    size_t nwrite;
+
+    pasynOctetSyncIO->write(pasynUserPush_, "UNSUB", 5, GM_TIMEOUT, &nwrite);
+    epicsThreadSleep(0.1);
+    pasynOctetSyncIO->flush(pasynUserPush_);
+}
+
+/* ASCII: "PUSH: push_seq dropped sample_seq age_ms V B t_cap" */
+asynStatus drvGaussmeter::readPush(int binary, epicsUInt32 *seq, int *dropped, double *age,
+                                   double *volt, double *field, double *tDev, double *v0)
+{
+    unsigned char *frame = (unsigned char *)&pushBuffer_[0];
+    const unsigned char *payload;
+    size_t length, nread;
+    double scale, sens;
+    unsigned long pushSeq, sampleSeq;
+    int eom;
+    asynStatus status;
+
+    if (binary) {
+        status = readFrame(pasynUserPush_, GM_FRAME_PUSH, frame, pushBuffer_.size(),
+                           GM_PUSH_POLL, &length, seq);
+        if (status != asynSuccess)
+            return status;
+        if (length != GM_PUSH_PAYLOAD_SIZE)
+            return asynError;
+        payload = frame + GM_FRAME_HEADER_SIZE;
+        *dropped = (int)getU32(payload + 4);
+        *age = getF32(payload + 8);
+        scale = getF32(payload + 16);
+        *v0 = getF32(payload + 20);
+        sens = getF32(payload + 24);
+        *tDev = getF64(payload + 28);
+        if (sens == 0.0)
+            return asynError;
+        *volt = (epicsInt32)getU32(payload + 12) * scale - *v0;
+        *field = -*volt / sens;
+        return asynSuccess;
+    }
+
+    status = pasynOctetSyncIO->read(pasynUserPush_, &pushBuffer_[0], pushBuffer_.size() - 1,
+                                    GM_PUSH_POLL, &nread, &eom);
+    if (status != asynSuccess)
+        return (status == asynTimeout && nread == 0) ? asynTimeout : asynError;
+    pushBuffer_[nread] = '\0';
+    if (sscanf(&pushBuffer_[0], "PUSH: %lu %d %lu %lf %lf %lf %lf", &pushSeq, dropped,
+               &sampleSeq, age, volt, field, tDev) != 7)
+        return asynError;
+    *v0 = epicsNAN;
+    *seq = (epicsUInt32)pushSeq;
+    return asynSuccess;
+}
+
+void drvGaussmeter::publishPush(epicsUInt32 seq, int dropped, double age, double volt,
+                                double field, double tDev, double v0)
+{
+    epicsTimeStamp stamp;
+    epicsUInt64 now = epicsMonotonicGet();
+    int count;
+
+    lock();
+    calibrate(v0, &volt, &field, 1);
+    stampSample(tDev, age, &stamp);
+    if (pushSeq_ && seq != pushSeq_ + 1)
+        pushGaps_ += (int)(seq - pushSeq_ - 1);
+    pushSeq_ = seq;
+    /* Pushes can arrive several per read, so count over about a second */
+    rateCount_++;
+    if (!rateStart_) {
+        rateStart_ = now;
+        rateCount_ = 0;
+    } else if ((now - rateStart_) * 1e-9 >= 1.0) {
+        setDoubleParam(P_PushRxRate, rateCount_ / ((now - rateStart_) * 1e-9));
+        rateStart_ = now;
+        rateCount_ = 0;
+    }
+
+    if (history_.size() >= maxSamples_)
+        history_.erase(history_.begin());
+    history_.push_back(field);
+
+    setTimeStamp(&stamp);
+    setDoubleParam(P_PushField, field);
+    setDoubleParam(P_PushVolt, volt);
+    setDoubleParam(P_PushAge, age);
+    getIntegerParam(P_PushCount, &count);
+    setIntegerParam(P_PushCount, count + 1);
+    setIntegerParam(P_PushDropped, droppedBase_ + dropped + pushGaps_);
+    if ((now - lastHistory_) * 1e-9 >= GM_HISTORY_INTERVAL) {
+        doCallbacksFloat64Array(&history_[0], history_.size(), P_PushHistory, 0);
+        lastHistory_ = now;
+    }
+    callParamCallbacks();
+    unlock();
+}
+
+void drvGaussmeter::pushTask()
+{
+    double rate, threshold, age, volt, field, tDev, v0;
+    int enable, binary = 0, dropped = 0, lastDropped = 0, errors;
+    bool subscribed = false, resubscribe;
+    epicsUInt32 seq;
+    asynStatus status;
+
+    for (;;) {
+        lock();
+        getIntegerParam(P_PushEnable, &enable);
+        getDoubleParam(P_PushRate, &rate);
+        getDoubleParam(P_PushThreshold, &threshold);
+        resubscribe = resubscribe_;
+        resubscribe_ = false;
+        if (!subscribed || resubscribe)
+            getIntegerParam(P_BinMode, &binary);
+        unlock();
+
+        if (subscribed && (!enable || resubscribe)) {
+            unsubscribe();
+            subscribed = false;
+            lock();
+            droppedBase_ += lastDropped;
+            lastDropped = 0;
+            setIntegerParam(P_PushActive, 0);
+            callParamCallbacks();
+            unlock();
+        }
+        if (!enable) {
+            epicsEventWaitWithTimeout(pushWakeup_, 1.0);
+            continue;
+        }
+        if (!subscribed) {
+            status = subscribe(binary, rate, threshold);
+            lock();
+            if (status == asynSuccess) {
+                subscribed = true;
+                rateStart_ = 0;
+            } else {
+                getIntegerParam(P_PushErrors, &errors);
+                setIntegerParam(P_PushErrors, errors + 1);
+            }
+            setIntegerParam(P_PushActive, subscribed);
+            callParamCallbacks();
+            unlock();
+            if (!subscribed) {
+                epicsEventWaitWithTimeout(pushWakeup_, 1.0);
+                continue;
+            }
+        }
+
+        status = readPush(binary, &seq, &dropped, &age, &volt, &field, &tDev, &v0);
+        if (status == asynTimeout)
+            continue;
+        if (status != asynSuccess) {
+            /* Lost sync: drop the subscription and start over */
+            unsubscribe();
+            subscribed = false;
+            lock();
+            droppedBase_ += lastDropped;
+            lastDropped = 0;
+            getIntegerParam(P_PushErrors, &errors);
+            setIntegerParam(P_PushErrors, errors + 1);
+            setIntegerParam(P_PushActive, 0);
+            callParamCallbacks();
+            unlock();
+            continue;
+        }
+        lastDropped = dropped;
+        publishPush(seq, dropped, age, volt, field, tDev, v0);
+    }
+}
+
+asynStatus drvGaussmeter::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+
+    if (function == P_BinMode || function == P_PushEnable) {
+        setIntegerParam(function, value ? 1 : 0);
+        resubscribe_ = true;
+        callParamCallbacks();
+        epicsEventSignal(pushWakeup_);
+        return asynSuccess;
+    }
+    if (function == P_BufEnable) {
+        setIntegerParam(P_BufEnable, value ? 1 : 0);
+        callParamCallbacks();
+        epicsEventSignal(wakeup_);
+        return asynSuccess;
+    }
+    if (function == P_CalEnable || function == P_CalTempComp) {
+        setIntegerParam(function, value ? 1 : 0);
+        updateCalibration();
+        callParamCallbacks();
+        return asynSuccess;
+    }
+    return asynPortDriver::writeInt32(pasynUser, value);
+}
+
+asynStatus drvGaussmeter::writeFloat64(asynUser *pasynUser, epicsFloat64 value)
+{
+    int function = pasynUser->reason;
+
+    if (function == P_CalTemp) {
+        setDoubleParam(P_CalTemp, value);
+        updateCalibration();
+        callParamCallbacks();
+        return asynSuccess;
+    }
+    if (function == P_SyncPeriod) {
+        /* 0 disables the sync, the fit in use is kept */
+        setDoubleParam(P_SyncPeriod, value > 0.0 ? value : 0.0);
+        callParamCallbacks();
+        return asynSuccess;
+    }
+    if (function == P_BufPeriod) {
+        if (!(value >= 0.01)) {
+            epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                          "%s: period must be at least 0.01 s", driverName);
+            return asynError;
+        }
+        setDoubleParam(P_BufPeriod, value);
+        callParamCallbacks();
+        epicsEventSignal(wakeup_);
+        return asynSuccess;
+    }
+    if (function == P_PushRate || function == P_PushThreshold) {
+        if (function == P_PushRate ? !(value > 0.0 && value <= 1000.0) : !(value >= 0.0)) {
+            epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                          "%s: push rate must be in (0, 1000] Hz, threshold >= 0",
+                          driverName);
+            return asynError;
+        }
+        setDoubleParam(function, value);
+        resubscribe_ = true;
+        callParamCallbacks();
+        return asynSuccess;
+    }
+    return asynPortDriver::writeFloat64(pasynUser, value);
+}
+
+asynStatus drvGaussmeter::writeOctet(asynUser *pasynUser, const char *value,
+                                     size_t maxChars, size_t *nActual)
+{
+    int function = pasynUser->reason;
+    char fileName[256], errMsg[128];
+
+    if (function == P_CalLoadFile) {
+        if (maxChars >= sizeof fileName)
+            maxChars = sizeof fileName - 1;
+        memcpy(fileName, value, maxChars);
+        fileName[maxChars] = '\0';
+        *nActual = maxChars;
+        setStringParam(P_CalLoadFile, fileName);
+        if (loadCalibration(fileName, errMsg, sizeof errMsg)) {
+            epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                          "%s: %s: %s", driverName, fileName, errMsg);
+            return asynError;
+        }
+        return asynSuccess;
+    }
+    return asynPortDriver::writeOctet(pasynUser, value, maxChars, nActual);
+}
+
+void drvGaussmeter::report(FILE *fp, int details)
+{
+    fprintf(fp, "%s: burst up to %lu samples, %.1f samples/s, %s transport\n",
+            portName, (unsigned long)maxSamples_, rate_,
+            binActive_ == 1 ? "binary" : binActive_ == 0 ? "ASCII" : "unnegotiated");
+    fprintf(fp, "  calibration: %s%s\n", cal_ ? cal_->version() : "Pi",
+            cal_ && !calActive_ ? " (loaded, disabled)" : "");
+    if (clock_.valid())
+        fprintf(fp, "  clock fit: %lu points, offset %.6f s, drift %.2f ppm, residual %.3f ms\n",
+                (unsigned long)clock_.count(), clock_.offset(), clock_.drift(),
+                clock_.residual() * 1e3);
+    asynPortDriver::report(fp, details);
+}
+
+/* Configuration routine. Called directly, or from the iocsh function below */
+
+extern "C" {
+
+int drvGaussmeterConfigure(const char *portName, const char *ioPortName,
+                           const char *pushPortName, int maxSamples, const char *calFile)
+{
+    if (!portName || !ioPortName) {
+        errlogPrintf("Usage: drvGaussmeterConfigure portName ioPortName pushPortName "
+                     "maxSamples calFile\n");
+        return -1;
+    }
+    new drvGaussmeter(portName, ioPortName, pushPortName, maxSamples, calFile);
+    return 0;
+}
+
+/* EPICS iocsh shell commands */
+
+static const iocshArg initArg0 = { "portName",   iocshArgString };
+static const iocshArg initArg1 = { "ioPortName", iocshArgString };
+static const iocshArg initArg2 = { "pushPortName", iocshArgString };
+static const iocshArg initArg3 = { "maxSamples", iocshArgInt };
+static const iocshArg initArg4 = { "calFile",    iocshArgString };
+static const iocshArg * const initArgs[] = { &initArg0, &initArg1, &initArg2, &initArg3,
+                                             &initArg4 };
+static const iocshFuncDef initFuncDef = { "drvGaussmeterConfigure", 5, initArgs };
+
+static void initCallFunc(const iocshArgBuf *args)
+{
+    drvGaussmeterConfigure(args[0].sval, args[1].sval, args[2].sval, args[3].ival,
+                           args[4].sval);
+}
+
+static void drvGaussmeterRegister(void)
+{
+    iocshRegister(&initFuncDef, initCallFunc);
+}
+
+epicsExportRegistrar(drvGaussmeterRegister);
+
+}
@@ -0,0 +1,216 @@
+/* drvGaussmeter.h */
+
+#ifndef DRVGAUSSMETER_H
+#define DRVGAUSSMETER_H
+
+#include <vector>
+#include <deque>
+
+#include <epicsTypes.h>
+#include <epicsEvent.h>
+#include <epicsTime.h>
+
+#include "asynPortDriver.h"
+#include "gmCalibration.h"
+
+#define GM_BUF_ENABLE_STRING    "GM_BUF_ENABLE"
+#define GM_BUF_PERIOD_STRING    "GM_BUF_PERIOD"
+#define GM_BUF_FIELD_STRING     "GM_BUF_FIELD"
+#define GM_BUF_VOLT_STRING      "GM_BUF_VOLT"
+#define GM_BUF_TIME_STRING      "GM_BUF_TIME"
+#define GM_BUF_NREAD_STRING     "GM_BUF_NREAD"
+#define GM_BUF_LOST_STRING      "GM_BUF_LOST"
+#define GM_BUF_PENDING_STRING   "GM_BUF_PENDING"
+#define GM_BUF_AGE_STRING       "GM_BUF_AGE"
+#define GM_BUF_RATE_STRING      "GM_BUF_RATE"
+#define GM_BUF_ERRORS_STRING    "GM_BUF_ERRORS"
+#define GM_BUF_BYTES_STRING     "GM_BUF_BYTES"
+#define GM_BIN_MODE_STRING      "GM_BIN_MODE"
+#define GM_BIN_ACTIVE_STRING    "GM_BIN_ACTIVE"
+#define GM_BIN_CRC_ERRORS_STRING "GM_BIN_CRC_ERRORS"
+#define GM_BIN_SEQ_GAPS_STRING  "GM_BIN_SEQ_GAPS"
+#define GM_PUSH_ENABLE_STRING   "GM_PUSH_ENABLE"
+#define GM_PUSH_RATE_STRING     "GM_PUSH_RATE"
+#define GM_PUSH_THRESHOLD_STRING "GM_PUSH_THRESHOLD"
+#define GM_PUSH_ACTIVE_STRING   "GM_PUSH_ACTIVE"
+#define GM_PUSH_FIELD_STRING    "GM_PUSH_FIELD"
+#define GM_PUSH_VOLT_STRING     "GM_PUSH_VOLT"
+#define GM_PUSH_AGE_STRING      "GM_PUSH_AGE"
+#define GM_PUSH_HISTORY_STRING  "GM_PUSH_HISTORY"
+#define GM_PUSH_COUNT_STRING    "GM_PUSH_COUNT"
+#define GM_PUSH_DROPPED_STRING  "GM_PUSH_DROPPED"
+#define GM_PUSH_RX_RATE_STRING  "GM_PUSH_RX_RATE"
+#define GM_PUSH_ERRORS_STRING   "GM_PUSH_ERRORS"
+#define GM_SYNC_PERIOD_STRING   "GM_SYNC_PERIOD"
+#define GM_SYNC_VALID_STRING    "GM_SYNC_VALID"
+#define GM_SYNC_OFFSET_STRING   "GM_SYNC_OFFSET"
+#define GM_SYNC_DRIFT_STRING    "GM_SYNC_DRIFT"
+#define GM_SYNC_RTT_STRING      "GM_SYNC_RTT"
+#define GM_SYNC_RESIDUAL_STRING "GM_SYNC_RESIDUAL"
+#define GM_SYNC_COUNT_STRING    "GM_SYNC_COUNT"
+#define GM_CAL_ENABLE_STRING    "GM_CAL_ENABLE"
+#define GM_CAL_ACTIVE_STRING    "GM_CAL_ACTIVE"
+#define GM_CAL_LOAD_FILE_STRING "GM_CAL_LOAD_FILE"
+#define GM_CAL_VERSION_STRING   "GM_CAL_VERSION"
+#define GM_CAL_NPTS_STRING      "GM_CAL_NPTS"
+#define GM_CAL_TEMP_COMP_STRING "GM_CAL_TEMP_COMP"
+#define GM_CAL_TEMP_STRING      "GM_CAL_TEMP"
+#define GM_CAL_TREF_STRING      "GM_CAL_TREF"
+#define GM_CAL_OUTSIDE_STRING   "GM_CAL_OUTSIDE"
+#define GM_CAL_V0_STRING        "GM_CAL_V0"
+
+/* Binary frames, see raspy_hallSensor.py */
+#define GM_FRAME_MAGIC          0x5AA5
+#define GM_FRAME_VERSION        3
+#define GM_FRAME_BURST          1
+#define GM_FRAME_PUSH           2
+#define GM_FRAME_HEADER_SIZE    12
+#define GM_BURST_HEADER_SIZE    40
+#define GM_PUSH_PAYLOAD_SIZE    36
+
+/*
+ * Linear map from the Pi monotonic clock to the IOC monotonic clock,
+ * least-squares fitted to the last sync points. Each point is the best
+ * (lowest round trip) TIME? exchange of one sync round, taken at the middle
+ * of the round trip.
+ */
+class gmClock {
+public:
+    gmClock() : devRef_(0.0), iocRef_(0.0), slope_(1.0), residual_(0.0) {}
+    void clear() { dev_.clear(); ioc_.clear(); }
+    void addPoint(double dev, double ioc, size_t window);
+    bool valid() const { return !dev_.empty(); }
+    size_t count() const { return dev_.size(); }
+    double toIoc(double dev) const { return iocRef_ + slope_ * (dev - devRef_); }
+    double offset() const { return iocRef_ - devRef_; }
+    double drift() const { return (slope_ - 1.0) * 1e6; }     /* ppm */
+    double residual() const { return residual_; }
+
+private:
+    std::deque<double> dev_, ioc_;
+    double devRef_, iocRef_, slope_, residual_;
+};
+
+/*
+ * Gaussmeter data driver. Talks to the Hall sensor server on its own
+ * connections, separate from the StreamDevice port: one polls blocks of
+ * buffered samples for waveform records, the other, if configured, holds a
+ * push subscription feeding I/O Intr records.
+ */
+class drvGaussmeter : public asynPortDriver {
+public:
+    drvGaussmeter(const char *portName, const char *ioPortName, const char *pushPortName,
+                  int maxSamples, const char *calFile);
+
+    virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+    virtual asynStatus writeFloat64(asynUser *pasynUser, epicsFloat64 value);
+    virtual asynStatus writeOctet(asynUser *pasynUser, const char *value,
+                                  size_t maxChars, size_t *nActual);
+    virtual void report(FILE *fp, int details);
+
+    /* Not for public use, called from the C thread functions */
+    void pollTask();
+    void pushTask();
+
+protected:
+    int P_BufEnable;
+    int P_BufPeriod;
+    int P_BufField;
+    int P_BufVolt;
+    int P_BufTime;
+    int P_BufNRead;
+    int P_BufLost;
+    int P_BufPending;
+    int P_BufAge;
+    int P_BufRate;
+    int P_BufErrors;
+    int P_BufBytes;
+    int P_BinMode;
+    int P_BinActive;
+    int P_BinCrcErrors;
+    int P_BinSeqGaps;
+    int P_PushEnable;
+    int P_PushRate;
+    int P_PushThreshold;
+    int P_PushActive;
+    int P_PushField;
+    int P_PushVolt;
+    int P_PushAge;
+    int P_PushHistory;
+    int P_PushCount;
+    int P_PushDropped;
+    int P_PushRxRate;
+    int P_PushErrors;
+    int P_SyncPeriod;
+    int P_SyncValid;
+    int P_SyncOffset;
+    int P_SyncDrift;
+    int P_SyncRtt;
+    int P_SyncResidual;
+    int P_SyncCount;
+    int P_CalEnable;
+    int P_CalActive;
+    int P_CalLoadFile;
+    int P_CalVersion;
+    int P_CalNpts;
+    int P_CalTempComp;
+    int P_CalTemp;
+    int P_CalTref;
+    int P_CalOutside;
+    int P_CalV0;
+
+private:
+    asynStatus readBurst();
+    asynStatus readBurstAscii(size_t *nBytes, int *n, int *lost, int *pending, double *age,
+                              double *tDev);
+    asynStatus readBurstBinary(size_t *nBytes, int *n, int *lost, int *pending, double *age,
+                               double *tDev, double *v0);
+    asynStatus readExact(asynUser *pasynUser, char *buffer, size_t nBytes,
+                         double timeout, size_t *got);
+    asynStatus readFrame(asynUser *pasynUser, int type, unsigned char *buffer,
+                         size_t bufferSize, double timeout, size_t *length,
+                         epicsUInt32 *seq);
+    asynStatus negotiate(asynUser *pasynUser, int binary);
+    asynStatus subscribe(int binary, double rate, double threshold);
+    void unsubscribe();
+    asynStatus readPush(int binary, epicsUInt32 *seq, int *dropped, double *age,
+                        double *volt, double *field, double *tDev, double *v0);
+    void publishPush(epicsUInt32 seq, int dropped, double age, double volt, double field,
+                     double tDev, double v0);
+    int parseBurst(char *reply, int *lost, int *pending, double *age, double *tDev);
+    asynStatus syncClock();
+    void stampSample(double tDev, double age, epicsTimeStamp *stamp);
+    asynStatus loadCalibration(const char *fileName, char *errMsg, size_t errSize);
+    void updateCalibration();
+    void calibrate(double v0, const double *volt, double *field, size_t n);
+
+    asynUser *pasynUserIO_;
+    epicsEventId wakeup_;
+    size_t maxSamples_;
+    std::vector<char> reply_;
+    std::vector<epicsFloat64> field_, volt_, time_;
+    epicsUInt64 lastBurst_;
+    double rate_;
+    int binActive_;             /* -1 until negotiated on this connection */
+    epicsUInt32 frameSeq_;
+
+    asynUser *pasynUserPush_;
+    epicsEventId pushWakeup_;
+    bool resubscribe_;
+    std::vector<char> pushBuffer_;
+    std::vector<epicsFloat64> history_;     /* oldest first */
+    epicsUInt32 pushSeq_;
+    int droppedBase_;           /* dropped in earlier subscriptions */
+    int pushGaps_;
+    epicsUInt64 rateStart_, lastHistory_;
+    int rateCount_;
+
+    gmClock clock_;             /* guarded by the driver lock */
+
+    gmCalibration *cal_;        /* NULL: conversion done on the Pi */
+    bool calActive_;
+    double serverV0_;           /* from CAL? 0, for ASCII data */
+    std::vector<double> vSens_;
+};
+
+#endif /* DRVGAUSSMETER_H */
@@ -0,0 +1,163 @@
+/* gmCalibration.cpp */
+/*
+ * Calibration table file, one point per line after the keywords:
+ *
+ *     version  <text>          reported as the active calibration
+ *     interp   linear|spline   default linear
+ *     tref     <degC>          temperature of the table, default 25
+ *     tcsens   <1/K>           sensitivity coefficient, default 0
+ *     tcoffset <V/K>           zero-field voltage drift, default 0
+ *     <sensor V>  <field gauss>
+ *
+ * '#' starts a comment. Voltages must be strictly increasing. Without a
+ * version keyword the file name is used.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <epicsStdio.h>
+
+#include "gmCalibration.h"
+
+gmCalibration::gmCalibration()
+    : vMin_(0.0), vMax_(0.0), invStep_(0.0), last_(0.0), shift_(0.0), gain_(1.0),
+      tref_(25.0), tcSens_(0.0), tcOffset_(0.0), interp_(GM_CAL_LINEAR), nPoints_(0)
+{
+}
+
+int gmCalibration::load(const char *fileName, char *errMsg, size_t errSize)
+{
+    std::vector<double> v, b;
+    char line[256], key[32], text[128];
+    FILE *fp;
+    int lineNo = 0;
+
+    version_ = fileName;
+    fp = fopen(fileName, "r");
+    if (!fp) {
+        epicsSnprintf(errMsg, errSize, "cannot open file");
+        return -1;
+    }
+    while (fgets(line, sizeof line, fp)) {
+        double x[2];
+        char *hash = strchr(line, '#');
+        int n;
+
+        lineNo++;
+        if (hash)
+            *hash = '\0';
+        n = sscanf(line, "%lf %lf", &x[0], &x[1]);
+        if (n == 2 && v.size() < GM_CAL_MAX_POINTS) {
+            v.push_back(x[0]);
+            b.push_back(x[1]);
+            continue;
+        }
+        n = sscanf(line, "%31s %127[^\r\n]", key, text);
+        if (n <= 0)
+            continue;
+        if (n == 2 && strcmp(key, "version") == 0)
+            version_ = text;
+        else if (n == 2 && strcmp(key, "interp") == 0 && strncmp(text, "spline", 6) == 0)
+            interp_ = GM_CAL_SPLINE;
+        else if (n == 2 && strcmp(key, "interp") == 0 && strncmp(text, "linear", 6) == 0)
+            interp_ = GM_CAL_LINEAR;
+        else if (n == 2 && strcmp(key, "tref") == 0 && sscanf(text, "%lf", &tref_) == 1)
+            ;
+        else if (n == 2 && strcmp(key, "tcsens") == 0 && sscanf(text, "%lf", &tcSens_) == 1)
+            ;
+        else if (n == 2 && strcmp(key, "tcoffset") == 0 && sscanf(text, "%lf", &tcOffset_) == 1)
+            ;
+        else {
+            fclose(fp);
+            epicsSnprintf(errMsg, errSize, "bad line %d", lineNo);
+            return -1;
+        }
+    }
+    fclose(fp);
+    return build(v, b, errMsg, errSize);
+}
+
+int gmCalibration::build(const std::vector<double> &v, const std::vector<double> &b,
+                         char *errMsg, size_t errSize)
+{
+    size_t n = v.size(), k;
+    std::vector<double> m(n, 0.0), grid(GM_CAL_GRID_SIZE);
+    double h, t;
+    int j;
+
+    if (n < 2) {
+        epicsSnprintf(errMsg, errSize, "need at least 2 points");
+        return -1;
+    }
+    for (k = 1; k < n; k++) {
+        if (!(v[k] > v[k - 1])) {
+            epicsSnprintf(errMsg, errSize, "voltage not increasing at point %u", (unsigned)k);
+            return -1;
+        }
+    }
+
+    /* Natural spline second derivatives, tridiagonal solve */
+    if (interp_ == GM_CAL_SPLINE && n > 2) {
+        std::vector<double> c(n, 0.0), d(n, 0.0);
+        for (k = 1; k + 1 < n; k++) {
+            double h0 = v[k] - v[k - 1], h1 = v[k + 1] - v[k];
+            double r = 6.0 * ((b[k + 1] - b[k]) / h1 - (b[k] - b[k - 1]) / h0);
+            double p = 2.0 * (h0 + h1) - h0 * c[k - 1];
+            c[k] = h1 / p;
+            d[k] = (r - h0 * d[k - 1]) / p;
+        }
+        for (k = n - 2; k >= 1; k--)
+            m[k] = d[k] - c[k] * m[k + 1];
+    }
+
+    vMin_ = v[0];
+    vMax_ = v[n - 1];
+    invStep_ = (GM_CAL_GRID_SIZE - 1) / (vMax_ - vMin_);
+    for (j = 0, k = 0; j < GM_CAL_GRID_SIZE; j++) {
+        double x = vMin_ + j / invStep_;
+        while (k + 2 < n && x > v[k + 1])
+            k++;
+        h = v[k + 1] - v[k];
+        t = (x - v[k]) / h;
+        grid[j] = b[k] + t * (b[k + 1] - b[k]) -
+                  h * h / 6.0 * t * (1.0 - t) * ((2.0 - t) * m[k] + (1.0 + t) * m[k + 1]);
+    }
+
+    /* Cell j covers [grid j, grid j+1]; one spare cell for u == last_ */
+    a_.resize(GM_CAL_GRID_SIZE);
+    b_.resize(GM_CAL_GRID_SIZE);
+    for (j = 0; j + 1 < GM_CAL_GRID_SIZE; j++) {
+        double x0 = vMin_ + j / invStep_;
+        b_[j] = (grid[j + 1] - grid[j]) * invStep_;
+        a_[j] = grid[j] - b_[j] * x0;
+    }
+    a_[GM_CAL_GRID_SIZE - 1] = a_[GM_CAL_GRID_SIZE - 2];
+    b_[GM_CAL_GRID_SIZE - 1] = b_[GM_CAL_GRID_SIZE - 2];
+    last_ = GM_CAL_GRID_SIZE - 1;
+    nPoints_ = (int)n;
+    setTemperature(tref_);
+    return 0;
+}
+
+void gmCalibration::setTemperature(double temp)
+{
+    double dt = isfinite(temp) ? temp - tref_ : 0.0;
+
+    shift_ = tcOffset_ * dt;
+    gain_ = 1.0 / (1.0 + tcSens_ * dt);
+}
+
+int gmCalibration::convert(const double *v, double *b, size_t n) const
+{
+    size_t i;
+    int outside = 0;
+
+    for (i = 0; i < n; i++) {
+        double w = v[i] - shift_;
+        b[i] = field(v[i]);
+        outside += (w < vMin_) | (w > vMax_);
+    }
+    return outside;
+}
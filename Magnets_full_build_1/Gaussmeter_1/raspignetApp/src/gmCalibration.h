@@ -0,0 +1,60 @@
+/* gmCalibration.h */
+
+#ifndef GMCALIBRATION_H
+#define GMCALIBRATION_H
+
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#define GM_CAL_GRID_SIZE        4096
+#define GM_CAL_MAX_POINTS       1024
+
+/* Table interpolation */
+#define GM_CAL_LINEAR           0
+#define GM_CAL_SPLINE           1
+
+/*
+ * Hall sensor calibration: sensor volts to gauss. The table, piecewise
+ * linear or a natural cubic spline through the points, is resampled onto a
+ * uniform grid of cells holding intercept and slope, so a conversion is a
+ * clamped index computation and one multiply-add. Outside the table the end
+ * cells extrapolate linearly.
+ *
+ * Temperature correction, relative to tref:
+ *     V' = V - tcOffset (T - tref)
+ *     B  = table(V') / (1 + tcSens (T - tref))
+ */
+class gmCalibration {
+public:
+    gmCalibration();
+    int load(const char *fileName, char *errMsg, size_t errSize);
+    void setTemperature(double temp);
+    double field(double v) const
+    {
+        double w = v - shift_;
+        double u = std::min(std::max((w - vMin_) * invStep_, 0.0), last_);
+        int k = (int)u;
+        return gain_ * (a_[k] + b_[k] * w);
+    }
+    /* Converts n samples, returns how many were outside the table */
+    int convert(const double *v, double *b, size_t n) const;
+
+    const char *version() const { return version_.c_str(); }
+    int nPoints() const { return nPoints_; }
+    int interp() const { return interp_; }
+    double tref() const { return tref_; }
+
+private:
+    int build(const std::vector<double> &v, const std::vector<double> &b,
+              char *errMsg, size_t errSize);
+
+    std::vector<double> a_, b_;
+    double vMin_, vMax_, invStep_, last_;
+    double shift_, gain_;
+    double tref_, tcSens_, tcOffset_;
+    int interp_, nPoints_;
+    std::string version_;
+};
+
+#endif /* GMCALIBRATION_H */
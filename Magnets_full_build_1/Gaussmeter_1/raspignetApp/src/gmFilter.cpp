@@ -0,0 +1,363 @@
+/* gmFilter.cpp */
+/*
+ * Filter stage for gaussmeter sample blocks.
+ *
+ * Blocks are written to FLT_INPUT, normally by an aao record following the
+ * burst waveform of drvGaussmeter through a CP link, and the filtered block
+ * is posted on FLT_OUTPUT next to the raw one. FLT_TYPE selects
+ *
+ *     Boxcar   mean of the last FLT_LENGTH samples
+ *     Median   median of the last FLT_LENGTH samples
+ *     EMA      exponential average, alpha = 2 / (FLT_LENGTH + 1)
+ *     FIR      Blackman windowed-sinc low pass of FLT_LENGTH taps with
+ *              cutoff FLT_CUTOFF cycles/sample, lowered to the output
+ *              Nyquist frequency when decimating
+ *
+ * and every FLT_DECIMATE-th output is kept. The FIR only computes the kept
+ * outputs. Boxcar and FIR work on one contiguous buffer holding the history
+ * followed by the block; the FIR loops over taps outside and outputs inside
+ * so the inner loop is a plain multiply-add over consecutive samples, which
+ * the compiler vectorises without reassociating sums. Changing the filter
+ * clears the state; the history is then primed with the first new sample.
+ */
+
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+#include <epicsTime.h>
+#include <epicsStdio.h>
+#include <errlog.h>
+#include <iocsh.h>
+
+#include "asynDriver.h"
+#include "gmFilter.h"
+
+#include <epicsExport.h>
+
+static const char *driverName = "gmFilter";
+
+gmFilter::gmFilter(const char *portName, int maxSamples)
+    : asynPortDriver(portName, 1,
+                     asynInt32Mask | asynFloat64Mask | asynFloat64ArrayMask | asynDrvUserMask,
+                     asynInt32Mask | asynFloat64Mask | asynFloat64ArrayMask,
+                     0, 1, 0, 0),
+      type_(FLT_NONE), length_(1), decimate_(1), phase_(0), primed_(false),
+      alpha_(1.0), state_(0.0), oldest_(0),
+      maxSamples_(maxSamples > 0 ? maxSamples : 1000)
+{
+    createParam(FLT_TYPE_STRING,      asynParamInt32,        &P_Type);
+    createParam(FLT_LENGTH_STRING,    asynParamInt32,        &P_Length);
+    createParam(FLT_DECIMATE_STRING,  asynParamInt32,        &P_Decimate);
+    createParam(FLT_CUTOFF_STRING,    asynParamFloat64,      &P_Cutoff);
+    createParam(FLT_RESET_STRING,     asynParamInt32,        &P_Reset);
+    createParam(FLT_INPUT_STRING,     asynParamFloat64Array, &P_Input);
+    createParam(FLT_OUTPUT_STRING,    asynParamFloat64Array, &P_Output);
+    createParam(FLT_LAST_STRING,      asynParamFloat64,      &P_Last);
+    createParam(FLT_NIN_STRING,       asynParamInt32,        &P_NIn);
+    createParam(FLT_NOUT_STRING,      asynParamInt32,        &P_NOut);
+    createParam(FLT_DELAY_STRING,     asynParamFloat64,      &P_Delay);
+    createParam(FLT_PROC_TIME_STRING, asynParamFloat64,      &P_ProcTime);
+
+    setIntegerParam(P_Type, FLT_NONE);
+    setIntegerParam(P_Length, 1);
+    setIntegerParam(P_Decimate, 1);
+    setDoubleParam(P_Cutoff, 0.1);
+    setDoubleParam(P_Last, 0.0);
+    setIntegerParam(P_NIn, 0);
+    setIntegerParam(P_NOut, 0);
+    setDoubleParam(P_ProcTime, 0.0);
+
+    out_.resize(maxSamples_);
+    ext_.reserve(FLT_MAX_LENGTH + maxSamples_);
+    configure();
+}
+
+/* Applies the parameters and clears the filter state */
+void gmFilter::configure()
+{
+    static const double pi = 3.14159265358979323846;
+    double cutoff, delay = 0.0, m, sum = 0.0;
+    int type, length, decimate;
+    size_t k;
+
+    getIntegerParam(P_Type, &type);
+    getIntegerParam(P_Length, &length);
+    getIntegerParam(P_Decimate, &decimate);
+    getDoubleParam(P_Cutoff, &cutoff);
+    type_ = type;
+    length_ = length;
+    decimate_ = decimate;
+
+    switch (type_) {
+    case FLT_BOXCAR:
+    case FLT_MEDIAN:
+        delay = (length_ - 1) / 2.0;
+        break;
+    case FLT_EMA:
+        alpha_ = 2.0 / (length_ + 1);
+        delay = (1.0 - alpha_) / alpha_;
+        break;
+    case FLT_FIR:
+        cutoff = std::min(cutoff, 0.5 / decimate_);
+        taps_.resize(length_);
+        m = (length_ - 1) / 2.0;
+        for (k = 0; k < length_; k++) {
+            double x = k - m;
+            double w = length_ > 1 ? 0.42 - 0.5 * cos(2 * pi * k / (length_ - 1)) +
+                                     0.08 * cos(4 * pi * k / (length_ - 1)) : 1.0;
+            taps_[k] = (x == 0.0 ? 2 * cutoff : sin(2 * pi * cutoff * x) / (pi * x)) * w;
+            sum += taps_[k];
+        }
+        for (k = 0; k < length_; k++)
+            taps_[k] /= sum;
+        delay = m;
+        break;
+    default:
+        break;
+    }
+    setDoubleParam(P_Delay, delay);
+
+    phase_ = 0;
+    primed_ = false;
+    ext_.clear();
+}
+
+/* Appends the block to the history, priming the history if needed */
+void gmFilter::extend(const epicsFloat64 *x, size_t n)
+{
+    if (!primed_)
+        ext_.assign(length_ - 1, x[0]);
+    ext_.insert(ext_.end(), x, x + n);
+}
+
+size_t gmFilter::boxcar(size_t n, epicsFloat64 *out)
+{
+    const double *e = &ext_[0];
+    double sum = 0.0, scale = 1.0 / length_;
+    size_t i, next = phase_, nOut = 0;
+
+    for (i = 0; i + 1 < length_; i++)
+        sum += e[i];
+    for (i = 0; i < n; i++) {
+        sum += e[i + length_ - 1];
+        if (i == next) {
+            out[nOut++] = sum * scale;
+            next += decimate_;
+        }
+        sum -= e[i];
+    }
+    phase_ = next - n;
+    return nOut;
+}
+
+size_t gmFilter::median(const epicsFloat64 *x, size_t n, epicsFloat64 *out)
+{
+    std::vector<double>::iterator it;
+    size_t i, next = phase_, nOut = 0, mid = length_ / 2;
+
+    if (!primed_) {
+        window_.assign(length_, x[0]);
+        sorted_.assign(length_, x[0]);
+        oldest_ = 0;
+    }
+    for (i = 0; i < n; i++) {
+        /* Replace the oldest sample, keeping sorted_ in order */
+        it = std::lower_bound(sorted_.begin(), sorted_.end(), window_[oldest_]);
+        sorted_.erase(it);
+        sorted_.insert(std::upper_bound(sorted_.begin(), sorted_.end(), x[i]), x[i]);
+        window_[oldest_] = x[i];
+        oldest_ = oldest_ + 1 == length_ ? 0 : oldest_ + 1;
+        if (i == next) {
+            out[nOut++] = length_ & 1 ? sorted_[mid] : 0.5 * (sorted_[mid - 1] + sorted_[mid]);
+            next += decimate_;
+        }
+    }
+    phase_ = next - n;
+    return nOut;
+}
+
+size_t gmFilter::ema(const epicsFloat64 *x, size_t n, epicsFloat64 *out)
+{
+    double y = primed_ ? state_ : x[0];
+    size_t i, next = phase_, nOut = 0;
+
+    for (i = 0; i < n; i++) {
+        y += alpha_ * (x[i] - y);
+        if (i == next) {
+            out[nOut++] = y;
+            next += decimate_;
+        }
+    }
+    state_ = y;
+    phase_ = next - n;
+    return nOut;
+}
+
+size_t gmFilter::fir(size_t n, epicsFloat64 *out)
+{
+    const double *e, *h = &taps_[0];
+    size_t j, k, nOut = phase_ < n ? (n - phase_ + decimate_ - 1) / decimate_ : 0;
+
+    if (nOut == 0) {
+        phase_ -= n;
+        return 0;
+    }
+    e = &ext_[phase_];
+    for (j = 0; j < nOut; j++)
+        out[j] = 0.0;
+    if (decimate_ == 1) {
+        for (k = 0; k < length_; k++)
+            for (j = 0; j < nOut; j++)
+                out[j] += h[k] * e[j + k];
+    } else {
+        for (k = 0; k < length_; k++)
+            for (j = 0; j < nOut; j++)
+                out[j] += h[k] * e[j * decimate_ + k];
+    }
+    phase_ = phase_ + nOut * decimate_ - n;
+    return nOut;
+}
+
+size_t gmFilter::process(const epicsFloat64 *x, size_t n, epicsFloat64 *out)
+{
+    size_t i, next = phase_, nOut = 0;
+
+    if (n == 0)
+        return 0;
+    switch (type_) {
+    case FLT_BOXCAR:
+        extend(x, n);
+        nOut = boxcar(n, out);
+        break;
+    case FLT_MEDIAN:
+        nOut = median(x, n, out);
+        break;
+    case FLT_EMA:
+        nOut = ema(x, n, out);
+        break;
+    case FLT_FIR:
+        extend(x, n);
+        nOut = fir(n, out);
+        break;
+    default:
+        for (i = next; i < n; i += decimate_)
+            out[nOut++] = x[i];
+        phase_ = next + nOut * decimate_ - n;
+        break;
+    }
+    /* Keep the last length_-1 inputs as history */
+    if (type_ == FLT_BOXCAR || type_ == FLT_FIR)
+        ext_.erase(ext_.begin(), ext_.begin() + n);
+    primed_ = true;
+    return nOut;
+}
+
+asynStatus gmFilter::writeFloat64Array(asynUser *pasynUser, epicsFloat64 *value,
+                                       size_t nElements)
+{
+    epicsUInt64 start;
+    size_t nOut;
+
+    if (pasynUser->reason != P_Input)
+        return asynPortDriver::writeFloat64Array(pasynUser, value, nElements);
+
+    if (nElements > out_.size())
+        out_.resize(nElements);
+    start = epicsMonotonicGet();
+    nOut = process(value, nElements, &out_[0]);
+    if (nElements)
+        setDoubleParam(P_ProcTime, (epicsMonotonicGet() - start) * 1e-3 / nElements);
+    setIntegerParam(P_NIn, (int)nElements);
+    setIntegerParam(P_NOut, (int)nOut);
+    if (nOut) {
+        setDoubleParam(P_Last, out_[nOut - 1]);
+        doCallbacksFloat64Array(&out_[0], nOut, P_Output, 0);
+    }
+    callParamCallbacks();
+    return asynSuccess;
+}
+
+asynStatus gmFilter::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+
+    if (function == P_Type || function == P_Length || function == P_Decimate) {
+        if ((function == P_Type && (value < FLT_NONE || value > FLT_FIR)) ||
+            (function == P_Length && (value < 1 || value > FLT_MAX_LENGTH)) ||
+            (function == P_Decimate && (value < 1 || value > FLT_MAX_DECIMATE))) {
+            epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                          "%s: type 0..%d, length 1..%d, decimation 1..%d", driverName,
+                          FLT_FIR, FLT_MAX_LENGTH, FLT_MAX_DECIMATE);
+            return asynError;
+        }
+        setIntegerParam(function, value);
+    } else if (function != P_Reset) {
+        return asynPortDriver::writeInt32(pasynUser, value);
+    }
+    configure();
+    callParamCallbacks();
+    return asynSuccess;
+}
+
+asynStatus gmFilter::writeFloat64(asynUser *pasynUser, epicsFloat64 value)
+{
+    if (pasynUser->reason == P_Cutoff) {
+        if (!(value > 0.0 && value <= 0.5)) {
+            epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                          "%s: cutoff must be in (0, 0.5] cycles/sample", driverName);
+            return asynError;
+        }
+        setDoubleParam(P_Cutoff, value);
+        configure();
+        callParamCallbacks();
+        return asynSuccess;
+    }
+    return asynPortDriver::writeFloat64(pasynUser, value);
+}
+
+void gmFilter::report(FILE *fp, int details)
+{
+    static const char *names[] = { "none", "boxcar", "median", "EMA", "FIR" };
+    double procTime;
+
+    getDoubleParam(P_ProcTime, &procTime);
+    fprintf(fp, "%s: %s, length %lu, decimation %lu, %.3f us/sample\n", portName,
+            names[type_], (unsigned long)length_, (unsigned long)decimate_, procTime);
+    asynPortDriver::report(fp, details);
+}
+
+/* Configuration routine. Called directly, or from the iocsh function below */
+
+extern "C" {
+
+int gmFilterConfigure(const char *portName, int maxSamples)
+{
+    if (!portName) {
+        errlogPrintf("Usage: gmFilterConfigure portName maxSamples\n");
+        return -1;
+    }
+    new gmFilter(portName, maxSamples);
+    return 0;
+}
+
+/* EPICS iocsh shell commands */
+
+static const iocshArg initArg0 = { "portName",   iocshArgString };
+static const iocshArg initArg1 = { "maxSamples", iocshArgInt };
+static const iocshArg * const initArgs[] = { &initArg0, &initArg1 };
+static const iocshFuncDef initFuncDef = { "gmFilterConfigure", 2, initArgs };
+
+static void initCallFunc(const iocshArgBuf *args)
+{
+    gmFilterConfigure(args[0].sval, args[1].ival);
+}
+
+static void gmFilterRegister(void)
+{
+    iocshRegister(&initFuncDef, initCallFunc);
+}
+
+epicsExportRegistrar(gmFilterRegister);
+
+}
@@ -0,0 +1,88 @@
+/* gmFilter.h */
+
+#ifndef GMFILTER_H
+#define GMFILTER_H
+
+#include <vector>
+
+#include <epicsTypes.h>
+
+#include "asynPortDriver.h"
+
+#define FLT_TYPE_STRING         "FLT_TYPE"
+#define FLT_LENGTH_STRING       "FLT_LENGTH"
+#define FLT_DECIMATE_STRING     "FLT_DECIMATE"
+#define FLT_CUTOFF_STRING       "FLT_CUTOFF"
+#define FLT_RESET_STRING        "FLT_RESET"
+#define FLT_INPUT_STRING        "FLT_INPUT"
+#define FLT_OUTPUT_STRING       "FLT_OUTPUT"
+#define FLT_LAST_STRING         "FLT_LAST"
+#define FLT_NIN_STRING          "FLT_NIN"
+#define FLT_NOUT_STRING         "FLT_NOUT"
+#define FLT_DELAY_STRING        "FLT_DELAY"
+#define FLT_PROC_TIME_STRING    "FLT_PROC_TIME"
+
+/* FLT_TYPE */
+#define FLT_NONE                0
+#define FLT_BOXCAR              1
+#define FLT_MEDIAN              2
+#define FLT_EMA                 3
+#define FLT_FIR                 4
+
+#define FLT_MAX_LENGTH          1024
+#define FLT_MAX_DECIMATE        1000
+
+/*
+ * Streaming filter for blocks of field samples. The state is carried from
+ * one block to the next, so the output is the same whatever the block size.
+ * Every FLT_DECIMATE-th filtered sample is published.
+ */
+class gmFilter : public asynPortDriver {
+public:
+    gmFilter(const char *portName, int maxSamples);
+
+    virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+    virtual asynStatus writeFloat64(asynUser *pasynUser, epicsFloat64 value);
+    virtual asynStatus writeFloat64Array(asynUser *pasynUser, epicsFloat64 *value,
+                                         size_t nElements);
+    virtual void report(FILE *fp, int details);
+
+    /* Filters n samples into out, returns the number of outputs */
+    size_t process(const epicsFloat64 *x, size_t n, epicsFloat64 *out);
+
+protected:
+    int P_Type;
+    int P_Length;
+    int P_Decimate;
+    int P_Cutoff;
+    int P_Reset;
+    int P_Input;
+    int P_Output;
+    int P_Last;
+    int P_NIn;
+    int P_NOut;
+    int P_Delay;
+    int P_ProcTime;
+
+private:
+    void configure();
+    void extend(const epicsFloat64 *x, size_t n);
+    size_t boxcar(size_t n, epicsFloat64 *out);
+    size_t median(const epicsFloat64 *x, size_t n, epicsFloat64 *out);
+    size_t ema(const epicsFloat64 *x, size_t n, epicsFloat64 *out);
+    size_t fir(size_t n, epicsFloat64 *out);
+
+    int type_;
+    size_t length_, decimate_;
+    size_t phase_;              /* inputs to skip before the next output */
+    bool primed_;               /* history holds real samples */
+    double alpha_, state_;
+    std::vector<double> taps_;
+    std::vector<double> ext_;   /* length_-1 samples of history, then the block */
+    std::vector<double> window_, sorted_;   /* median: arrival order, sorted */
+    size_t oldest_;
+    std::vector<epicsFloat64> out_;
+    size_t maxSamples_;
+};
+
+#endif /* GMFILTER_H */
@@ -14,12 +14,41 @@ epicsEnvSet("STREAM_PROTOCOL_PATH", "../../db")
 dbLoadDatabase "../../dbd/motorcontrol.dbd"
 motorcontrol_registerRecordDeviceDriver pdbbase
 
+## Stepper driver, served directly by this IOC. STEPPER_HOST can point at
+## Devices/Stepper-sim/stepper_sim.py (default port 10001) for tests.
+epicsEnvSet("STEPPER_HOST", "172.30.84.151:10001")
+drvAsynIPPortConfigure("MOTOR", "$(STEPPER_HOST)", 0, 0, 0)
+drvStepperConfigure("STEPPER", "MOTOR", 1, 50, 500)
+
+## Homing of GR1:Ax1:RunCalibration: seek switch at +10000 steps (fast
+## approach, slow final seek, velocities in motorcontrol.db), zero 400
+## steps back from it, 4000 steps of travel. The calibration is
+## kept in GR1_Ax1.home and restored at iocInit; the axis is homed then
+## only if the driver was power cycled or the motor was moved meanwhile
+motorHomingConfigure("GR1:Ax1:", "GR1:Ax1_Mtr", 10000, 400, 4000, "GR1_Ax1.home", "GR1:Ax1_Mtr:bootId", 1)
+
+## Fly scans of GR1:Ax1 sampling the gaussmeter IOC (GSMTR:bufField/bufTime
+## over CA, burst buffer enabled), -200 steps/mm as in mmtostep
+flyScanConfigure("FLY", "GR1:Ax1_Mtr", "GSMTR:", -200, 20000)
+
+## Gantry of X (GR1:Ax1) only on this bench; with Y and Z on the controller
+## give drvStepperConfigure 3 axes, list their motors here and load the
+## commented records below
+gantryConfigure("GANTRY", "GR1:Ax1_Mtr", 10000)
+
 ## Load record instances
-dbLoadRecords("../../db/motorcontrol.db","P=GR1:Ax1:,MOTOR=GR1:Ax1_Mtr")
-#drvAsynIPPortConfigure("MOTOR", "172.30.84.151", 0, 0, 0)
+dbLoadRecords("../../db/stepperAxis.db","MOTOR=GR1:Ax1_Mtr,PORT=STEPPER,ADDR=0")
+dbLoadRecords("../../db/moveProfile.db","P=GR1:Ax1:plan:,PORT=STEPPER,ADDR=0,MODE=Trapezoid")
+dbLoadRecords("../../db/motorcontrol.db","P=GR1:Ax1:,MOTOR=GR1:Ax1_Mtr,SCALE=-200,HOME_FAST=2000,HOME_SLOW=100,HOME_PROBE=100")
+dbLoadRecords("../../db/flyScan.db","P=GR1:Ax1:fly:,PORT=FLY,NELM=20000")
+dbLoadRecords("../../db/positionCompare.db","P=GR1:Ax1:pcmp:,PORT=STEPPER,AXIS=0,SCALE=-200,TRIGGER=GSMTR:acqmagfield.PROC,FIELD=GSMTR:acqmagfield")
+dbLoadRecords("../../db/motorTrace.db","P=GR1:Ax1:trace:,PORT=STEPPER,AXIS=0,SCALE=-200")
+dbLoadRecords("../../db/gantry.db","P=GR1:gantry:,PORT=GANTRY,NELM=10000,TRIGGER=GSMTR:acqmagfield.PROC,FIELD=GSMTR:acqmagfield")
+dbLoadRecords("../../db/gantryAxis.db","P=GR1:gantry:X:,PORT=GANTRY,ADDR=0,SCALE=-200,NELM=10000")
+#dbLoadRecords("../../db/gantryAxis.db","P=GR1:gantry:Y:,PORT=GANTRY,ADDR=1,SCALE=-200,NELM=10000")
+#dbLoadRecords("../../db/gantryAxis.db","P=GR1:gantry:Z:,PORT=GANTRY,ADDR=2,SCALE=-200,NELM=10000")
 
 iocInit()
 
 ## Start any sequence programs
 #seq sncmotorcontrol,"user=iocadm"
-registrar(motorcalibration)
\ No newline at end of file
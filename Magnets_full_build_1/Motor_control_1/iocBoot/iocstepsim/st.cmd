@@ -0,0 +1,20 @@
+#!../../bin/linux-x86_64/motorcontrol
+
+## Test IOC: drvStepper against Devices/Stepper-sim/stepper_sim.py, one
+## motor record and nothing else. Devices/Stepper-sim/test_drvStepper.py
+## starts the simulator, then this IOC, and checks move, poll and stop.
+
+< envPaths
+
+## Register all support components
+dbLoadDatabase "../../dbd/motorcontrol.dbd"
+motorcontrol_registerRecordDeviceDriver pdbbase
+
+epicsEnvSet("STEPPER_HOST", "$(STEPPER_HOST=localhost:10001)")
+drvAsynIPPortConfigure("MOTOR", "$(STEPPER_HOST)", 0, 0, 0)
+drvStepperConfigure("STEPPER", "MOTOR", 1, 50, 500)
+
+## Load record instances
+dbLoadRecords("../../db/stepperAxis.db","MOTOR=SIM:Ax1_Mtr,PORT=STEPPER,ADDR=0")
+
+iocInit()
@@ -0,0 +1,907 @@
+/* drvStepper.cpp */
+/*
+ * asyn motor driver for the stepper driver, replacing the motor record of
+ * the external IOC. Positions are in steps, velocities in steps/s and
+ * accelerations in steps/s^2; each command is answered by "OK" or
+ * "ERR <reason>":
+ *
+ *     STAT? n                 -> STAT n <position> <flags>
+ *     MOVE n pos vel acc [jerk]   absolute move, S-curve with jerk
+ *     MOVR n dist vel acc [jerk]  relative move
+ *     JOG n vel acc           signed constant velocity
+ *     HOME n dir vel acc      onto the limit switch, dir 1 = high side
+ *     STOP n acc
+ *     SETPOS n pos
+ *     POWER n 0|1
+ *     BOOT?                   -> BOOT: <id>, new at every power-up
+ *
+ * The poller runs at movingPollPeriod while any axis moves and at
+ * idlePollPeriod otherwise; every move forces a few fast polls first, so
+ * short moves are not missed. Devices/Stepper-sim/stepper_sim.py speaks the
+ * same protocol.
+ *
+ * BOOT? is read at start and every STEPPER_BOOT_PERIOD from the poller and
+ * published as STEPPER_BOOT_ID, so a power cycle of the driver, which loses
+ * the calibrated position, is seen by motorHoming even across IOC restarts.
+ *
+ * Position compare: while PCMP_ARM is set a separate thread reads STAT? of
+ * PCMP_AXIS every PCMP_PERIOD. When the position passes the next point of
+ * the grid PCMP_START + i PCMP_STEP (i < PCMP_COUNT, mm, steps = mm *
+ * PCMP_SCALE), the crossing time is interpolated between the two reads,
+ * PCMP_INDEX is posted with the point index and PCMP_TRIGGER with a count
+ * that never repeats, so its I/O Intr record fires the acquisition at
+ * every crossing. The latency from the crossing to the post, and the position
+ * the axis had reached by then at the measured velocity, are recorded per
+ * point. Points are passed in index order, so the sign of PCMP_STEP gives
+ * the direction of the scan. A value written to PCMP_FIELD_IN is the
+ * reading of the point crossed last, if it arrives within
+ * PCMP_FIELD_TIMEOUT of that crossing and the point has no reading yet;
+ * other values are dropped and a point left without one stays NaN. The
+ * reading must thus come back before the next crossing.
+ *
+ * Trajectory trace: with TRACE_ENABLE set, every move, jog or home of
+ * TRACE_AXIS is followed by reading STAT? every TRACE_PERIOD until the axis
+ * is done. The samples go to a ring of TRACE_MAX_POINTS, so a long move
+ * keeps its end, and are published when the axis stops: TRACE_TIME in s
+ * from TRACE_T0 (s past the EPICS epoch), TRACE_STEPS and TRACE_MM
+ * (steps / TRACE_SCALE).
+ *
+ * Move planner, per axis: with PLAN_MODE Trapezoid or S-curve each move is
+ * sent with the velocity and acceleration of the motor record capped by
+ * the limits of the mechanics PLAN_VMAX and PLAN_AMAX (and ramped at the
+ * jerk PLAN_JMAX), the velocity lowered to the peak the distance allows.
+ * The record still asks for the speed, so homing and fly scans keep theirs
+ * and the gantry its proportional profiles. The duration
+ * is predicted for every move, published as PLAN_TIME when the move starts,
+ * and the poller is woken at the predicted end rather than at the next
+ * moving poll, so done is seen within a few ms. The time until done was
+ * seen is PLAN_ACTUAL; both go to the PLAN_LOG_ arrays and to the
+ * ASYN_TRACE_FLOW trace. Writing a distance to PLAN_QUERY predicts its
+ * duration in PLAN_QUERY_TIME without moving.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <epicsThread.h>
+#include <epicsTime.h>
+#include <epicsMath.h>
+#include <epicsStdio.h>
+#include <errlog.h>
+#include <iocsh.h>
+
+#include "asynOctetSyncIO.h"
+#include "drvStepper.h"
+
+#include <epicsExport.h>
+
+static const char *driverName = "drvStepper";
+
+#define STEPPER_TIMEOUT         1.0
+/* Fast polls after a move starts, before the moving flag is trusted */
+#define STEPPER_FORCED_POLLS    2
+/* Update period of PCMP_RATE, s */
+#define PCMP_RATE_PERIOD        0.5
+/* Re-poll period when a move runs past its predicted end, and how long for, s */
+#define PLAN_RECHECK            0.005
+#define PLAN_RECHECK_WINDOW     0.1
+/* Period of the BOOT? check, s */
+#define STEPPER_BOOT_PERIOD     1.0
+
+static void compareTaskC(void *drvPvt)
+{
+    drvStepperController *pPvt = (drvStepperController *)drvPvt;
+    pPvt->compareTask();
+}
+
+static void traceTaskC(void *drvPvt)
+{
+    drvStepperController *pPvt = (drvStepperController *)drvPvt;
+    pPvt->traceTask();
+}
+
+static void endTimerC(void *drvPvt)
+{
+    asynMotorController *pC = (asynMotorController *)drvPvt;
+    pC->wakeupPoller();
+}
+
+drvStepperController::drvStepperController(const char *portName, const char *ioPortName,
+                                           int numAxes, double movingPollPeriod,
+                                           double idlePollPeriod)
+    : asynMotorController(portName, numAxes, 0,
+                          0, 0,
+                          ASYN_CANBLOCK | ASYN_MULTIDEVICE,
+                          1, 0, 0),
+      compareArmed_(false), compareAxis_(0), compareScale_(1.0), compareNext_(0),
+      compareTriggers_(0), latencySum_(0.0), latencyMax_(0.0),
+      tracePending_(false),
+      traceT_(TRACE_MAX_POINTS), traceP_(TRACE_MAX_POINTS), traceHead_(0), traceCount_(0),
+      traceTotal_(0)
+{
+    static const char *functionName = "drvStepperController";
+    char threadName[64];
+    size_t nwrite, nread;
+    int axis, eom;
+    asynStatus status;
+
+    idn_[0] = '\0';
+    bootId_[0] = '\0';
+    bootChecked_ = 0;
+    compareEvent_ = epicsEventMustCreate(epicsEventEmpty);
+    traceEvent_ = epicsEventMustCreate(epicsEventEmpty);
+    timerQueue_ = epicsTimerQueueAllocate(1, epicsThreadPriorityScanHigh);
+
+    createParam(STEPPER_BOOT_ID_STRING,   asynParamOctet,        &P_BootId);
+    createParam(PCMP_AXIS_STRING,         asynParamInt32,        &P_PcmpAxis);
+    createParam(PCMP_SCALE_STRING,        asynParamFloat64,      &P_PcmpScale);
+    createParam(PCMP_START_STRING,        asynParamFloat64,      &P_PcmpStart);
+    createParam(PCMP_STEP_STRING,         asynParamFloat64,      &P_PcmpStep);
+    createParam(PCMP_COUNT_STRING,        asynParamInt32,        &P_PcmpCount);
+    createParam(PCMP_PERIOD_STRING,       asynParamFloat64,      &P_PcmpPeriod);
+    createParam(PCMP_ARM_STRING,          asynParamInt32,        &P_PcmpArm);
+    createParam(PCMP_STATE_STRING,        asynParamInt32,        &P_PcmpState);
+    createParam(PCMP_TRIGGER_STRING,      asynParamInt32,        &P_PcmpTrigger);
+    createParam(PCMP_INDEX_STRING,        asynParamInt32,        &P_PcmpIndex);
+    createParam(PCMP_NFIRED_STRING,       asynParamInt32,        &P_PcmpNFired);
+    createParam(PCMP_LATENCY_STRING,      asynParamFloat64,      &P_PcmpLatency);
+    createParam(PCMP_LATENCY_MEAN_STRING, asynParamFloat64,      &P_PcmpLatencyMean);
+    createParam(PCMP_LATENCY_MAX_STRING,  asynParamFloat64,      &P_PcmpLatencyMax);
+    createParam(PCMP_POS_ERROR_STRING,    asynParamFloat64,      &P_PcmpPosError);
+    createParam(PCMP_RATE_STRING,         asynParamFloat64,      &P_PcmpRate);
+    createParam(PCMP_FIELD_IN_STRING,     asynParamFloat64,      &P_PcmpFieldIn);
+    createParam(PCMP_FIELD_TIMEOUT_STRING, asynParamFloat64,     &P_PcmpFieldTimeout);
+    createParam(PCMP_GRID_STRING,         asynParamFloat64Array, &P_PcmpGrid);
+    createParam(PCMP_FIRE_POS_STRING,     asynParamFloat64Array, &P_PcmpFirePos);
+    createParam(PCMP_LATENCIES_STRING,    asynParamFloat64Array, &P_PcmpLatencies);
+    createParam(PCMP_FIELD_STRING,        asynParamFloat64Array, &P_PcmpField);
+    createParam(TRACE_AXIS_STRING,        asynParamInt32,        &P_TraceAxis);
+    createParam(TRACE_SCALE_STRING,       asynParamFloat64,      &P_TraceScale);
+    createParam(TRACE_PERIOD_STRING,      asynParamFloat64,      &P_TracePeriod);
+    createParam(TRACE_ENABLE_STRING,      asynParamInt32,        &P_TraceEnable);
+    createParam(TRACE_NPOINTS_STRING,     asynParamInt32,        &P_TraceNPoints);
+    createParam(TRACE_DROPPED_STRING,     asynParamInt32,        &P_TraceDropped);
+    createParam(TRACE_RATE_STRING,        asynParamFloat64,      &P_TraceRate);
+    createParam(TRACE_T0_STRING,          asynParamFloat64,      &P_TraceT0);
+    createParam(TRACE_DURATION_STRING,    asynParamFloat64,      &P_TraceDuration);
+    createParam(TRACE_TIME_STRING,        asynParamFloat64Array, &P_TraceTime);
+    createParam(TRACE_STEPS_STRING,       asynParamFloat64Array, &P_TraceSteps);
+    createParam(TRACE_MM_STRING,          asynParamFloat64Array, &P_TraceMm);
+    createParam(PLAN_MODE_STRING,         asynParamInt32,        &P_PlanMode);
+    createParam(PLAN_VMAX_STRING,         asynParamFloat64,      &P_PlanVmax);
+    createParam(PLAN_AMAX_STRING,         asynParamFloat64,      &P_PlanAmax);
+    createParam(PLAN_JMAX_STRING,         asynParamFloat64,      &P_PlanJmax);
+    createParam(PLAN_VELOCITY_STRING,     asynParamFloat64,      &P_PlanVelocity);
+    createParam(PLAN_ACCEL_STRING,        asynParamFloat64,      &P_PlanAccel);
+    createParam(PLAN_TIME_STRING,         asynParamFloat64,      &P_PlanTime);
+    createParam(PLAN_ACTUAL_STRING,       asynParamFloat64,      &P_PlanActual);
+    createParam(PLAN_ERROR_STRING,        asynParamFloat64,      &P_PlanError);
+    createParam(PLAN_ERROR_MEAN_STRING,   asynParamFloat64,      &P_PlanErrorMean);
+    createParam(PLAN_COUNT_STRING,        asynParamInt32,        &P_PlanCount);
+    createParam(PLAN_QUERY_STRING,        asynParamFloat64,      &P_PlanQuery);
+    createParam(PLAN_QUERY_TIME_STRING,   asynParamFloat64,      &P_PlanQueryTime);
+    createParam(PLAN_LOG_DIST_STRING,     asynParamFloat64Array, &P_PlanLogDist);
+    createParam(PLAN_LOG_TIME_STRING,     asynParamFloat64Array, &P_PlanLogTime);
+    createParam(PLAN_LOG_ACTUAL_STRING,   asynParamFloat64Array, &P_PlanLogActual);
+
+    setStringParam(P_BootId, "");
+    setIntegerParam(P_PcmpAxis, 0);
+    setDoubleParam(P_PcmpScale, -200.0);
+    setDoubleParam(P_PcmpStart, 0.0);
+    setDoubleParam(P_PcmpStep, 1.0);
+    setIntegerParam(P_PcmpCount, 21);
+    setDoubleParam(P_PcmpPeriod, 0.002);
+    setIntegerParam(P_PcmpArm, 0);
+    setIntegerParam(P_PcmpState, PCMP_STATE_IDLE);
+    setIntegerParam(P_PcmpTrigger, 0);
+    setIntegerParam(P_PcmpIndex, 0);
+    setIntegerParam(P_PcmpNFired, 0);
+    setDoubleParam(P_PcmpLatency, 0.0);
+    setDoubleParam(P_PcmpLatencyMean, 0.0);
+    setDoubleParam(P_PcmpLatencyMax, 0.0);
+    setDoubleParam(P_PcmpPosError, 0.0);
+    setDoubleParam(P_PcmpRate, 0.0);
+    setDoubleParam(P_PcmpFieldTimeout, 0.5);
+    setIntegerParam(P_TraceAxis, 0);
+    setDoubleParam(P_TraceScale, -200.0);
+    setDoubleParam(P_TracePeriod, 0.002);
+    setIntegerParam(P_TraceEnable, 1);
+    setIntegerParam(P_TraceNPoints, 0);
+    setIntegerParam(P_TraceDropped, 0);
+    setDoubleParam(P_TraceRate, 0.0);
+    setDoubleParam(P_TraceT0, 0.0);
+    setDoubleParam(P_TraceDuration, 0.0);
+    status = pasynOctetSyncIO->connect(ioPortName, 0, &pasynUserController_, NULL);
+    if (status) {
+        errlogPrintf("%s::%s: cannot connect to port %s\n",
+                     driverName, functionName, ioPortName);
+        return;
+    }
+    pasynOctetSyncIO->setInputEos(pasynUserController_, "\r\n", 2);
+    pasynOctetSyncIO->setOutputEos(pasynUserController_, "\r\n", 2);
+    status = pasynOctetSyncIO->writeRead(pasynUserController_, "*IDN?", 5,
+                                         idn_, sizeof idn_ - 1, STEPPER_TIMEOUT,
+                                         &nwrite, &nread, &eom);
+    idn_[status == asynSuccess ? nread : 0] = '\0';
+    readBootId();
+
+    for (axis = 0; axis < numAxes; axis++)
+        new drvStepperAxis(this, axis);
+
+    startPoller(movingPollPeriod / 1000., idlePollPeriod / 1000., STEPPER_FORCED_POLLS);
+
+    epicsSnprintf(threadName, sizeof threadName, "%sCmp", portName);
+    epicsThreadCreate(threadName, epicsThreadPriorityHigh,
+                      epicsThreadGetStackSize(epicsThreadStackMedium),
+                      (EPICSTHREADFUNC)compareTaskC, this);
+
+    epicsSnprintf(threadName, sizeof threadName, "%sTrc", portName);
+    epicsThreadCreate(threadName, epicsThreadPriorityHigh,
+                      epicsThreadGetStackSize(epicsThreadStackMedium),
+                      (EPICSTHREADFUNC)traceTaskC, this);
+}
+
+drvStepperAxis *drvStepperController::getAxis(asynUser *pasynUser)
+{
+    return static_cast<drvStepperAxis *>(asynMotorController::getAxis(pasynUser));
+}
+
+drvStepperAxis *drvStepperController::getAxis(int axisNo)
+{
+    return static_cast<drvStepperAxis *>(asynMotorController::getAxis(axisNo));
+}
+
+/* Sends outString_, fails unless the driver answers OK */
+asynStatus drvStepperController::command()
+{
+    asynStatus status = writeReadController();
+
+    if (status != asynSuccess)
+        return status;
+    if (strcmp(inString_, "OK") != 0) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s: %s -> %s\n",
+                  driverName, outString_, inString_);
+        return asynError;
+    }
+    return asynSuccess;
+}
+
+/* One STAT? for the compare and trace threads, time at the middle of the exchange */
+asynStatus drvStepperController::readPosition(int axis, double *position, int *flags,
+                                              double *time)
+{
+    epicsUInt64 t0, t1;
+    int replyAxis;
+    asynStatus status;
+
+    epicsSnprintf(outString_, sizeof outString_, "STAT? %d", axis);
+    t0 = epicsMonotonicGet();
+    status = writeReadController();
+    t1 = epicsMonotonicGet();
+    if (status != asynSuccess)
+        return status;
+    if (sscanf(inString_, "STAT %d %lf %d", &replyAxis, position, flags) != 3 ||
+        replyAxis != axis)
+        return asynError;
+    *time = 0.5e-9 * (double)(t0 + t1);
+    return asynSuccess;
+}
+
+/* BOOT? into STEPPER_BOOT_ID, logs a change */
+asynStatus drvStepperController::readBootId()
+{
+    static const char *functionName = "readBootId";
+    char id[sizeof bootId_];
+    asynStatus status;
+
+    bootChecked_ = epicsMonotonicGet();
+    epicsSnprintf(outString_, sizeof outString_, "BOOT?");
+    status = writeReadController();
+    if (status != asynSuccess)
+        return status;
+    if (sscanf(inString_, "BOOT: %31s", id) != 1)
+        return asynError;
+    if (strcmp(id, bootId_) != 0) {
+        if (bootId_[0])
+            errlogPrintf("%s::%s: %s: driver power cycled, boot id %s -> %s\n",
+                         driverName, functionName, portName, bootId_, id);
+        strcpy(bootId_, id);
+        setStringParam(P_BootId, bootId_);
+        callParamCallbacks();
+    }
+    return asynSuccess;
+}
+
+/* Called by the poller with the lock held, before the axes */
+asynStatus drvStepperController::poll()
+{
+    if (1e-9 * (double)(epicsMonotonicGet() - bootChecked_) >= STEPPER_BOOT_PERIOD)
+        readBootId();
+    return asynSuccess;
+}
+
+void drvStepperController::armCompare()
+{
+    double start, step, scale;
+    int count, axis;
+    size_t i;
+
+    getDoubleParam(P_PcmpStart, &start);
+    getDoubleParam(P_PcmpStep, &step);
+    getDoubleParam(P_PcmpScale, &scale);
+    getIntegerParam(P_PcmpCount, &count);
+    getIntegerParam(P_PcmpAxis, &axis);
+
+    compareAxis_ = axis;
+    compareScale_ = scale != 0.0 ? scale : 1.0;
+    grid_.resize(count);
+    gridMm_.resize(count);
+    for (i = 0; i < (size_t)count; i++) {
+        gridMm_[i] = start + i * step;
+        grid_[i] = gridMm_[i] * compareScale_;
+    }
+    firePos_.assign(count, epicsNAN);
+    latencies_.assign(count, epicsNAN);
+    field_.assign(count, epicsNAN);
+    crossTime_.assign(count, 0.0);
+    compareNext_ = 0;
+    latencySum_ = 0.0;
+    latencyMax_ = 0.0;
+    compareArmed_ = true;
+
+    setIntegerParam(P_PcmpState, PCMP_STATE_ARMED);
+    setIntegerParam(P_PcmpNFired, 0);
+    setDoubleParam(P_PcmpLatency, 0.0);
+    setDoubleParam(P_PcmpLatencyMean, 0.0);
+    setDoubleParam(P_PcmpLatencyMax, 0.0);
+    setDoubleParam(P_PcmpPosError, 0.0);
+    doCallbacksFloat64Array(&gridMm_[0], gridMm_.size(), P_PcmpGrid, 0);
+    publishCompare();
+    epicsEventSignal(compareEvent_);
+}
+
+void drvStepperController::publishCompare()
+{
+    if (firePos_.empty())
+        return;
+    doCallbacksFloat64Array(&firePos_[0], firePos_.size(), P_PcmpFirePos, 0);
+    doCallbacksFloat64Array(&latencies_[0], latencies_.size(), P_PcmpLatencies, 0);
+    doCallbacksFloat64Array(&field_[0], field_.size(), P_PcmpField, 0);
+}
+
+/* Triggers point compareNext_, crossed at crossTime moving at velocity (steps/s) */
+void drvStepperController::fire(double crossTime, double velocity)
+{
+    size_t i = compareNext_;
+    double latency, error;
+
+    /* The index repeats across runs, so it cannot be the trigger itself */
+    setIntegerParam(P_PcmpIndex, (int)i);
+    setIntegerParam(P_PcmpTrigger, ++compareTriggers_);
+    callParamCallbacks();
+    latency = 1e-9 * (double)epicsMonotonicGet() - crossTime;
+    error = velocity * latency / compareScale_;
+
+    crossTime_[i] = crossTime;
+    latencies_[i] = latency;
+    firePos_[i] = gridMm_[i] + error;
+    latencySum_ += latency;
+    if (latency > latencyMax_)
+        latencyMax_ = latency;
+    compareNext_ = i + 1;
+
+    setIntegerParam(P_PcmpNFired, (int)compareNext_);
+    setDoubleParam(P_PcmpLatency, latency);
+    setDoubleParam(P_PcmpLatencyMean, latencySum_ / compareNext_);
+    setDoubleParam(P_PcmpLatencyMax, latencyMax_);
+    setDoubleParam(P_PcmpPosError, error);
+}
+
+void drvStepperController::compareTask()
+{
+    double position, time, lastPosition = 0.0, lastTime = 0.0, period;
+    double rateTime = 0.0, d0, d1;
+    bool primed = false;
+    int nPolls = 0, flags;
+
+    lock();
+    for (;;) {
+        if (!compareArmed_) {
+            primed = false;
+            unlock();
+            epicsEventMustWait(compareEvent_);
+            lock();
+            continue;
+        }
+        if (readPosition(compareAxis_, &position, &flags, &time) != asynSuccess) {
+            compareArmed_ = false;
+            setIntegerParam(P_PcmpState, PCMP_STATE_ERROR);
+            setIntegerParam(P_PcmpArm, 0);
+            publishCompare();
+            callParamCallbacks();
+            continue;
+        }
+
+        if (!primed) {
+            rateTime = time;
+            nPolls = 0;
+        } else if (time > lastTime) {
+            while (compareNext_ < grid_.size()) {
+                d0 = lastPosition - grid_[compareNext_];
+                d1 = position - grid_[compareNext_];
+                if (!((d0 <= 0.0 && d1 >= 0.0) || (d0 >= 0.0 && d1 <= 0.0)))
+                    break;
+                fire(d0 == d1 ? lastTime : lastTime + (time - lastTime) * d0 / (d0 - d1),
+                     (position - lastPosition) / (time - lastTime));
+            }
+            if (compareNext_ >= grid_.size()) {
+                compareArmed_ = false;
+                setIntegerParam(P_PcmpState, PCMP_STATE_DONE);
+                setIntegerParam(P_PcmpArm, 0);
+                publishCompare();
+            }
+        }
+        nPolls++;
+        if (time - rateTime >= PCMP_RATE_PERIOD) {
+            setDoubleParam(P_PcmpRate, nPolls / (time - rateTime));
+            rateTime = time;
+            nPolls = 0;
+        }
+        callParamCallbacks();
+        lastPosition = position;
+        lastTime = time;
+        primed = true;
+
+        getDoubleParam(P_PcmpPeriod, &period);
+        unlock();
+        epicsThreadSleep(period);
+        lock();
+    }
+}
+
+/* Called by the axes when they start moving */
+void drvStepperController::startTrace(int axis)
+{
+    int traceAxis, enable;
+
+    getIntegerParam(P_TraceAxis, &traceAxis);
+    getIntegerParam(P_TraceEnable, &enable);
+    if (axis != traceAxis || !enable)
+        return;
+    tracePending_ = true;
+    epicsEventSignal(traceEvent_);
+}
+
+/* Unrolls the ring, oldest sample first */
+void drvStepperController::publishTrace(const epicsTimeStamp *start)
+{
+    size_t i, j, first = (traceHead_ + TRACE_MAX_POINTS - traceCount_) % TRACE_MAX_POINTS;
+    double scale, span;
+
+    getDoubleParam(P_TraceScale, &scale);
+    if (scale == 0.0)
+        scale = 1.0;
+    traceTime_.resize(traceCount_);
+    traceSteps_.resize(traceCount_);
+    traceMm_.resize(traceCount_);
+    for (i = 0; i < traceCount_; i++) {
+        j = (first + i) % TRACE_MAX_POINTS;
+        traceTime_[i] = traceT_[j];
+        traceSteps_[i] = traceP_[j];
+        traceMm_[i] = traceP_[j] / scale;
+    }
+    span = traceCount_ > 1 ? traceTime_[traceCount_ - 1] - traceTime_[0] : 0.0;
+
+    setIntegerParam(P_TraceNPoints, (int)traceCount_);
+    setIntegerParam(P_TraceDropped, (int)(traceTotal_ - traceCount_));
+    setDoubleParam(P_TraceRate, span > 0.0 ? (traceCount_ - 1) / span : 0.0);
+    setDoubleParam(P_TraceT0, start->secPastEpoch + 1e-9 * start->nsec);
+    setDoubleParam(P_TraceDuration, traceCount_ ? traceTime_[traceCount_ - 1] : 0.0);
+    if (traceCount_ == 0)
+        return;
+    doCallbacksFloat64Array(&traceTime_[0], traceCount_, P_TraceTime, 0);
+    doCallbacksFloat64Array(&traceSteps_[0], traceCount_, P_TraceSteps, 0);
+    doCallbacksFloat64Array(&traceMm_[0], traceCount_, P_TraceMm, 0);
+}
+
+void drvStepperController::traceTask()
+{
+    epicsTimeStamp start;
+    double position, time, startTime, period;
+    int axis, flags;
+
+    lock();
+    for (;;) {
+        if (!tracePending_) {
+            unlock();
+            epicsEventMustWait(traceEvent_);
+            lock();
+            continue;
+        }
+        tracePending_ = false;
+        getIntegerParam(P_TraceAxis, &axis);
+        traceHead_ = traceCount_ = traceTotal_ = 0;
+        epicsTimeGetCurrent(&start);
+        startTime = 1e-9 * (double)epicsMonotonicGet();
+
+        /* Until done, trusted after the first few reads as in the poller; a
+         * move started meanwhile continues the same trace */
+        while (readPosition(axis, &position, &flags, &time) == asynSuccess) {
+            traceT_[traceHead_] = time - startTime;
+            traceP_[traceHead_] = position;
+            traceHead_ = (traceHead_ + 1) % TRACE_MAX_POINTS;
+            if (traceCount_ < TRACE_MAX_POINTS)
+                traceCount_++;
+            traceTotal_++;
+            if (!(flags & STEPPER_MOVING) && !tracePending_ &&
+                traceTotal_ > STEPPER_FORCED_POLLS)
+                break;
+            tracePending_ = false;
+            getDoubleParam(P_TracePeriod, &period);
+            unlock();
+            epicsThreadSleep(period);
+            lock();
+        }
+        publishTrace(&start);
+        callParamCallbacks();
+    }
+}
+
+asynStatus drvStepperController::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+
+    if (function == P_PcmpArm) {
+        setIntegerParam(P_PcmpArm, value ? 1 : 0);
+        if (value) {
+            armCompare();
+        } else if (compareArmed_) {
+            compareArmed_ = false;
+            setIntegerParam(P_PcmpState, PCMP_STATE_IDLE);
+            publishCompare();
+        }
+        callParamCallbacks();
+        return asynSuccess;
+    }
+    if ((function == P_PcmpAxis || function == P_TraceAxis) && (value < 0 || value >= numAxes_))
+        return asynError;
+    if (function == P_PcmpCount) {
+        if (value < 1)
+            value = 1;
+        if (value > PCMP_MAX_POINTS)
+            value = PCMP_MAX_POINTS;
+    }
+    return asynMotorController::writeInt32(pasynUser, value);
+}
+
+asynStatus drvStepperController::writeFloat64(asynUser *pasynUser, epicsFloat64 value)
+{
+    int function = pasynUser->reason;
+
+    if (function == P_PcmpFieldIn) {
+        size_t i = compareNext_ - 1;
+        double timeout, age;
+
+        setDoubleParam(P_PcmpFieldIn, value);
+        getDoubleParam(P_PcmpFieldTimeout, &timeout);
+        if (compareNext_ > 0 && compareNext_ <= field_.size() && isnan(field_[i])) {
+            age = 1e-9 * (double)epicsMonotonicGet() - crossTime_[i];
+            if (age >= 0.0 && age <= timeout) {
+                field_[i] = value;
+                doCallbacksFloat64Array(&field_[0], field_.size(), P_PcmpField, 0);
+            }
+        }
+        callParamCallbacks();
+        return asynSuccess;
+    }
+    if (function == P_PlanQuery) {
+        drvStepperAxis *pAxis = getAxis(pasynUser);
+        moveProfile profile;
+        int mode;
+
+        if (!pAxis)
+            return asynError;
+        pAxis->plan(&profile, value, pAxis->recordVelocity_, pAxis->recordAcceleration_,
+                    &mode);
+        pAxis->setDoubleParam(P_PlanQuery, value);
+        pAxis->setDoubleParam(P_PlanQueryTime, profile.duration);
+        pAxis->callParamCallbacks();
+        return asynSuccess;
+    }
+    if ((function == P_PlanVmax || function == P_PlanAmax || function == P_PlanJmax) &&
+        !(value > 0.0))
+        return asynError;
+    return asynMotorController::writeFloat64(pasynUser, value);
+}
+
+void drvStepperController::report(FILE *fp, int level)
+{
+    int state, nFired, axis, nPoints;
+    double rate;
+
+    getIntegerParam(P_PcmpState, &state);
+    getIntegerParam(P_PcmpNFired, &nFired);
+    getDoubleParam(P_PcmpRate, &rate);
+    fprintf(fp, "%s: %d axes, %s, boot id %s, poll %.3f s moving / %.3f s idle\n",
+            portName, numAxes_, idn_[0] ? idn_ : "no reply to *IDN?",
+            bootId_[0] ? bootId_ : "unknown", movingPollPeriod_, idlePollPeriod_);
+    fprintf(fp, "  compare: axis %d, state %d, %d/%u fired, %.0f reads/s\n",
+            compareAxis_, state, nFired, (unsigned)grid_.size(), rate);
+    getIntegerParam(P_TraceAxis, &axis);
+    getIntegerParam(P_TraceNPoints, &nPoints);
+    getDoubleParam(P_TraceRate, &rate);
+    fprintf(fp, "  trace: axis %d, last %d samples at %.0f/s\n", axis, nPoints, rate);
+    asynMotorController::report(fp, level);
+}
+
+drvStepperAxis::drvStepperAxis(drvStepperController *pC, int axisNo)
+    : asynMotorAxis(pC, axisNo), pC_(pC), flags_(0), position_(0.0),
+      recordVelocity_(0.0), recordAcceleration_(0.0), timing_(false), moveStart_(0),
+      moveCount_(0), errorSum_(0.0)
+{
+    moveProfilePlan(&profile_, 0.0, 0.0, 0.0, 0.0);
+    endTimer_ = epicsTimerQueueCreateTimer(pC->timerQueue_, endTimerC, pC);
+
+    setIntegerParam(pC->P_PlanMode, PROFILE_RECORD);
+    setDoubleParam(pC->P_PlanVmax, 2000.0);
+    setDoubleParam(pC->P_PlanAmax, 10000.0);
+    setDoubleParam(pC->P_PlanJmax, 200000.0);
+    setDoubleParam(pC->P_PlanVelocity, 0.0);
+    setDoubleParam(pC->P_PlanAccel, 0.0);
+    setDoubleParam(pC->P_PlanTime, 0.0);
+    setDoubleParam(pC->P_PlanActual, 0.0);
+    setDoubleParam(pC->P_PlanError, 0.0);
+    setDoubleParam(pC->P_PlanErrorMean, 0.0);
+    setIntegerParam(pC->P_PlanCount, 0);
+    setDoubleParam(pC->P_PlanQuery, 0.0);
+    setDoubleParam(pC->P_PlanQueryTime, 0.0);
+}
+
+void drvStepperAxis::report(FILE *fp, int details)
+{
+    if (details > 0) {
+        fprintf(fp, "  axis %d: position %.0f, flags 0x%02x\n", axisNo_, position_, flags_);
+        fprintf(fp, "    %d moves timed, last %.0f steps predicted %.3f s, "
+                "mean error %.3f s\n", moveCount_, profile_.distance, profile_.duration,
+                moveCount_ ? errorSum_ / moveCount_ : 0.0);
+    }
+    asynMotorAxis::report(fp, details);
+}
+
+/* Profile of a move over distance steps, VELO and acceleration of the motor record */
+void drvStepperAxis::plan(moveProfile *profile, double distance, double maxVelocity,
+                          double acceleration, int *mode)
+{
+    double vmax, amax, jmax;
+
+    pC_->getIntegerParam(axisNo_, pC_->P_PlanMode, mode);
+    pC_->getDoubleParam(axisNo_, pC_->P_PlanVmax, &vmax);
+    pC_->getDoubleParam(axisNo_, pC_->P_PlanAmax, &amax);
+    pC_->getDoubleParam(axisNo_, pC_->P_PlanJmax, &jmax);
+    if (maxVelocity > 0.0 && maxVelocity < vmax)
+        vmax = maxVelocity;
+    if (acceleration > 0.0 && acceleration < amax)
+        amax = acceleration;
+    switch (*mode) {
+    case PROFILE_TRAPEZOID:
+        moveProfilePlan(profile, distance, vmax, amax, 0.0);
+        break;
+    case PROFILE_SCURVE:
+        moveProfilePlan(profile, distance, vmax, amax, jmax);
+        break;
+    default:
+        *mode = PROFILE_RECORD;
+        moveProfilePlan(profile, distance, maxVelocity, acceleration, 0.0);
+        break;
+    }
+}
+
+asynStatus drvStepperAxis::move(double position, int relative, double minVelocity,
+                                double maxVelocity, double acceleration)
+{
+    int mode, n;
+    asynStatus status;
+
+    recordVelocity_ = maxVelocity;
+    recordAcceleration_ = acceleration;
+    plan(&profile_, relative ? position : position - position_, maxVelocity,
+         acceleration, &mode);
+    n = epicsSnprintf(pC_->outString_, sizeof pC_->outString_, "%s %d %.0f %.3f %.3f",
+                      relative ? "MOVR" : "MOVE", axisNo_, position,
+                      mode == PROFILE_RECORD ? maxVelocity : profile_.velocity,
+                      mode == PROFILE_RECORD ? acceleration : profile_.acceleration);
+    if (mode == PROFILE_SCURVE)
+        epicsSnprintf(pC_->outString_ + n, sizeof pC_->outString_ - n, " %.3f",
+                      profile_.jerk);
+    status = pC_->command();
+    if (status != asynSuccess) {
+        timing_ = false;
+        return status;
+    }
+
+    pC_->startTrace(axisNo_);
+    moveStart_ = epicsMonotonicGet();
+    timing_ = true;
+    epicsTimerStartDelay(endTimer_, profile_.duration);
+    setDoubleParam(pC_->P_PlanVelocity, profile_.velocity);
+    setDoubleParam(pC_->P_PlanAccel, profile_.acceleration);
+    setDoubleParam(pC_->P_PlanTime, profile_.duration);
+    callParamCallbacks();
+    return asynSuccess;
+}
+
+/* Records a timed move, actual s from the move command until done was seen */
+void drvStepperAxis::moveDone(double actual)
+{
+    double error = actual - profile_.duration;
+
+    timing_ = false;
+    epicsTimerCancel(endTimer_);
+    moveCount_++;
+    errorSum_ += error;
+    if (logDist_.size() >= PLAN_LOG_SIZE) {
+        logDist_.erase(logDist_.begin());
+        logTime_.erase(logTime_.begin());
+        logActual_.erase(logActual_.begin());
+    }
+    logDist_.push_back(profile_.distance);
+    logTime_.push_back(profile_.duration);
+    logActual_.push_back(actual);
+
+    asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW,
+              "%s: axis %d move %.0f steps at %.0f steps/s, predicted %.3f s, "
+              "actual %.3f s\n", driverName, axisNo_, profile_.distance,
+              profile_.velocity, profile_.duration, actual);
+    setDoubleParam(pC_->P_PlanActual, actual);
+    setDoubleParam(pC_->P_PlanError, error);
+    setDoubleParam(pC_->P_PlanErrorMean, errorSum_ / moveCount_);
+    setIntegerParam(pC_->P_PlanCount, moveCount_);
+    pC_->doCallbacksFloat64Array(&logDist_[0], logDist_.size(), pC_->P_PlanLogDist, axisNo_);
+    pC_->doCallbacksFloat64Array(&logTime_[0], logTime_.size(), pC_->P_PlanLogTime, axisNo_);
+    pC_->doCallbacksFloat64Array(&logActual_[0], logActual_.size(), pC_->P_PlanLogActual,
+                                 axisNo_);
+}
+
+asynStatus drvStepperAxis::moveVelocity(double minVelocity, double maxVelocity,
+                                        double acceleration)
+{
+    asynStatus status;
+
+    epicsSnprintf(pC_->outString_, sizeof pC_->outString_, "JOG %d %.3f %.3f",
+                  axisNo_, maxVelocity, acceleration);
+    status = pC_->command();
+    if (status == asynSuccess)
+        pC_->startTrace(axisNo_);
+    return status;
+}
+
+asynStatus drvStepperAxis::home(double minVelocity, double maxVelocity,
+                                double acceleration, int forwards)
+{
+    asynStatus status;
+
+    epicsSnprintf(pC_->outString_, sizeof pC_->outString_, "HOME %d %d %.3f %.3f",
+                  axisNo_, forwards ? 1 : 0, maxVelocity, acceleration);
+    status = pC_->command();
+    if (status == asynSuccess)
+        pC_->startTrace(axisNo_);
+    return status;
+}
+
+asynStatus drvStepperAxis::stop(double acceleration)
+{
+    epicsSnprintf(pC_->outString_, sizeof pC_->outString_, "STOP %d %.3f",
+                  axisNo_, acceleration);
+    return pC_->command();
+}
+
+asynStatus drvStepperAxis::setPosition(double position)
+{
+    epicsSnprintf(pC_->outString_, sizeof pC_->outString_, "SETPOS %d %.0f",
+                  axisNo_, position);
+    return pC_->command();
+}
+
+asynStatus drvStepperAxis::setClosedLoop(bool closedLoop)
+{
+    epicsSnprintf(pC_->outString_, sizeof pC_->outString_, "POWER %d %d",
+                  axisNo_, closedLoop ? 1 : 0);
+    return pC_->command();
+}
+
+/* Position, limits and done from one STAT? transaction */
+asynStatus drvStepperAxis::poll(bool *moving)
+{
+    int axis, flags;
+    double position, elapsed;
+    asynStatus status;
+
+    epicsSnprintf(pC_->outString_, sizeof pC_->outString_, "STAT? %d", axisNo_);
+    status = pC_->writeReadController();
+    elapsed = 1e-9 * (double)(epicsMonotonicGet() - moveStart_);
+    if (status == asynSuccess &&
+        (sscanf(pC_->inString_, "STAT %d %lf %d", &axis, &position, &flags) != 3 ||
+         axis != axisNo_))
+        status = asynError;
+    if (status != asynSuccess) {
+        setIntegerParam(pC_->motorStatusCommsError_, 1);
+        setIntegerParam(pC_->motorStatusProblem_, 1);
+        callParamCallbacks();
+        *moving = false;
+        return status;
+    }
+
+    flags_ = flags;
+    position_ = position;
+    *moving = (flags & STEPPER_MOVING) != 0;
+    setDoubleParam(pC_->motorPosition_, position);
+    setDoubleParam(pC_->motorEncoderPosition_, position);
+    setIntegerParam(pC_->motorStatusDone_, *moving ? 0 : 1);
+    setIntegerParam(pC_->motorStatusMoving_, *moving ? 1 : 0);
+    setIntegerParam(pC_->motorStatusHighLimit_, (flags & STEPPER_HIGH_LIMIT) ? 1 : 0);
+    setIntegerParam(pC_->motorStatusLowLimit_, (flags & STEPPER_LOW_LIMIT) ? 1 : 0);
+    setIntegerParam(pC_->motorStatusAtHome_, (flags & STEPPER_HOME) ? 1 : 0);
+    setIntegerParam(pC_->motorStatusPowerOn_, (flags & STEPPER_POWER) ? 1 : 0);
+    setIntegerParam(pC_->motorStatusProblem_, (flags & STEPPER_FAULT) ? 1 : 0);
+    setIntegerParam(pC_->motorStatusCommsError_, 0);
+    if (timing_ && !*moving)
+        moveDone(elapsed);
+    else if (timing_ && elapsed >= profile_.duration &&
+             elapsed < profile_.duration + PLAN_RECHECK_WINDOW)
+        epicsTimerStartDelay(endTimer_, PLAN_RECHECK);
+    callParamCallbacks();
+    return asynSuccess;
+}
+
+/* Configuration routine. Called directly, or from the iocsh function below */
+
+extern "C" {
+
+/*
+ * portName          asyn motor port for the motor records
+ * ioPortName        drvAsynIPPort of the stepper driver
+ * numAxes           number of axes
+ * movingPollPeriod  ms between polls while an axis moves
+ * idlePollPeriod    ms between polls otherwise
+ */
+int drvStepperConfigure(const char *portName, const char *ioPortName, int numAxes,
+                        int movingPollPeriod, int idlePollPeriod)
+{
+    if (!portName || !ioPortName || numAxes < 1 || numAxes > STEPPER_MAX_AXES) {
+        errlogPrintf("Usage: drvStepperConfigure portName ioPortName numAxes(1-%d) "
+                     "movingPollPeriod idlePollPeriod\n", STEPPER_MAX_AXES);
+        return -1;
+    }
+    new drvStepperController(portName, ioPortName, numAxes,
+                             movingPollPeriod > 0 ? movingPollPeriod : 100,
+                             idlePollPeriod > 0 ? idlePollPeriod : 1000);
+    return 0;
+}
+
+/* EPICS iocsh shell commands */
+
+static const iocshArg initArg0 = { "portName",         iocshArgString };
+static const iocshArg initArg1 = { "ioPortName",       iocshArgString };
+static const iocshArg initArg2 = { "numAxes",          iocshArgInt };
+static const iocshArg initArg3 = { "movingPollPeriod", iocshArgInt };
+static const iocshArg initArg4 = { "idlePollPeriod",   iocshArgInt };
+static const iocshArg * const initArgs[] = { &initArg0, &initArg1, &initArg2, &initArg3,
+                                             &initArg4 };
+static const iocshFuncDef initFuncDef = { "drvStepperConfigure", 5, initArgs };
+
+static void initCallFunc(const iocshArgBuf *args)
+{
+    drvStepperConfigure(args[0].sval, args[1].sval, args[2].ival, args[3].ival,
+                        args[4].ival);
+}
+
+static void drvStepperRegister(void)
+{
+    iocshRegister(&initFuncDef, initCallFunc);
+}
+
+epicsExportRegistrar(drvStepperRegister);
+
+}
@@ -0,0 +1,247 @@
+/* drvStepper.h */
+
+#ifndef DRVSTEPPER_H
+#define DRVSTEPPER_H
+
+#include <vector>
+
+#include <epicsEvent.h>
+#include <epicsTimer.h>
+
+#include "asynMotorController.h"
+#include "asynMotorAxis.h"
+#include "moveProfile.h"
+
+#define STEPPER_MAX_AXES        4
+
+/* Power-up id of the driver, changes at every power cycle */
+#define STEPPER_BOOT_ID_STRING  "STEPPER_BOOT_ID"
+
+#define PCMP_AXIS_STRING        "PCMP_AXIS"
+#define PCMP_SCALE_STRING       "PCMP_SCALE"
+#define PCMP_START_STRING       "PCMP_START"
+#define PCMP_STEP_STRING        "PCMP_STEP"
+#define PCMP_COUNT_STRING       "PCMP_COUNT"
+#define PCMP_PERIOD_STRING      "PCMP_PERIOD"
+#define PCMP_ARM_STRING         "PCMP_ARM"
+#define PCMP_STATE_STRING       "PCMP_STATE"
+#define PCMP_TRIGGER_STRING     "PCMP_TRIGGER"
+#define PCMP_INDEX_STRING       "PCMP_INDEX"
+#define PCMP_NFIRED_STRING      "PCMP_NFIRED"
+#define PCMP_LATENCY_STRING     "PCMP_LATENCY"
+#define PCMP_LATENCY_MEAN_STRING "PCMP_LATENCY_MEAN"
+#define PCMP_LATENCY_MAX_STRING "PCMP_LATENCY_MAX"
+#define PCMP_POS_ERROR_STRING   "PCMP_POS_ERROR"
+#define PCMP_RATE_STRING        "PCMP_RATE"
+#define PCMP_FIELD_IN_STRING    "PCMP_FIELD_IN"
+#define PCMP_FIELD_TIMEOUT_STRING "PCMP_FIELD_TIMEOUT"
+#define PCMP_GRID_STRING        "PCMP_GRID"
+#define PCMP_FIRE_POS_STRING    "PCMP_FIRE_POS"
+#define PCMP_LATENCIES_STRING   "PCMP_LATENCIES"
+#define PCMP_FIELD_STRING       "PCMP_FIELD"
+
+#define TRACE_AXIS_STRING       "TRACE_AXIS"
+#define TRACE_SCALE_STRING      "TRACE_SCALE"
+#define TRACE_PERIOD_STRING     "TRACE_PERIOD"
+#define TRACE_ENABLE_STRING     "TRACE_ENABLE"
+#define TRACE_NPOINTS_STRING    "TRACE_NPOINTS"
+#define TRACE_DROPPED_STRING    "TRACE_DROPPED"
+#define TRACE_RATE_STRING       "TRACE_RATE"
+#define TRACE_T0_STRING         "TRACE_T0"
+#define TRACE_DURATION_STRING   "TRACE_DURATION"
+#define TRACE_TIME_STRING       "TRACE_TIME"
+#define TRACE_STEPS_STRING      "TRACE_STEPS"
+#define TRACE_MM_STRING         "TRACE_MM"
+
+/* Move planner, per axis */
+#define PLAN_MODE_STRING        "PLAN_MODE"
+#define PLAN_VMAX_STRING        "PLAN_VMAX"
+#define PLAN_AMAX_STRING        "PLAN_AMAX"
+#define PLAN_JMAX_STRING        "PLAN_JMAX"
+#define PLAN_VELOCITY_STRING    "PLAN_VELOCITY"
+#define PLAN_ACCEL_STRING       "PLAN_ACCEL"
+#define PLAN_TIME_STRING        "PLAN_TIME"
+#define PLAN_ACTUAL_STRING      "PLAN_ACTUAL"
+#define PLAN_ERROR_STRING       "PLAN_ERROR"
+#define PLAN_ERROR_MEAN_STRING  "PLAN_ERROR_MEAN"
+#define PLAN_COUNT_STRING       "PLAN_COUNT"
+#define PLAN_QUERY_STRING       "PLAN_QUERY"
+#define PLAN_QUERY_TIME_STRING  "PLAN_QUERY_TIME"
+#define PLAN_LOG_DIST_STRING    "PLAN_LOG_DIST"
+#define PLAN_LOG_TIME_STRING    "PLAN_LOG_TIME"
+#define PLAN_LOG_ACTUAL_STRING  "PLAN_LOG_ACTUAL"
+
+/* PCMP_STATE */
+#define PCMP_STATE_IDLE         0
+#define PCMP_STATE_ARMED        1
+#define PCMP_STATE_DONE         2
+#define PCMP_STATE_ERROR        3
+
+#define PCMP_MAX_POINTS         10000
+
+/* Ring buffer of the trajectory trace, samples */
+#define TRACE_MAX_POINTS        20000
+
+/* Moves kept in the PLAN_LOG_ arrays */
+#define PLAN_LOG_SIZE           100
+
+/* STAT? flags */
+#define STEPPER_DONE            0x01
+#define STEPPER_MOVING          0x02
+#define STEPPER_HIGH_LIMIT      0x04
+#define STEPPER_LOW_LIMIT       0x08
+#define STEPPER_HOME            0x10
+#define STEPPER_FAULT           0x20
+#define STEPPER_POWER           0x40
+
+class drvStepperController;
+
+class drvStepperAxis : public asynMotorAxis {
+public:
+    drvStepperAxis(drvStepperController *pC, int axisNo);
+
+    asynStatus move(double position, int relative, double minVelocity,
+                    double maxVelocity, double acceleration);
+    asynStatus moveVelocity(double minVelocity, double maxVelocity, double acceleration);
+    asynStatus home(double minVelocity, double maxVelocity, double acceleration, int forwards);
+    asynStatus stop(double acceleration);
+    asynStatus poll(bool *moving);
+    asynStatus setPosition(double position);
+    asynStatus setClosedLoop(bool closedLoop);
+    void report(FILE *fp, int details);
+
+private:
+    void plan(moveProfile *profile, double distance, double maxVelocity,
+              double acceleration, int *mode);
+    void moveDone(double actual);
+
+    drvStepperController *pC_;
+    int flags_;                 /* last STAT? flags */
+    double position_;           /* last STAT? position, steps */
+
+    /* Move timing, under the port lock */
+    moveProfile profile_;       /* of the last move */
+    double recordVelocity_, recordAcceleration_;
+    bool timing_;               /* move running, not yet seen done */
+    epicsUInt64 moveStart_;     /* monotonic ns, when the move was accepted */
+    epicsTimerId endTimer_;     /* polls at the predicted end */
+    int moveCount_;
+    double errorSum_;
+    std::vector<epicsFloat64> logDist_, logTime_, logActual_;
+
+    friend class drvStepperController;
+};
+
+/*
+ * Controller of the stepper driver, on a line-oriented TCP protocol. One
+ * "STAT? n" per axis and poll returns position and status flags together.
+ */
+class drvStepperController : public asynMotorController {
+public:
+    drvStepperController(const char *portName, const char *ioPortName, int numAxes,
+                         double movingPollPeriod, double idlePollPeriod);
+
+    drvStepperAxis *getAxis(asynUser *pasynUser);
+    drvStepperAxis *getAxis(int axisNo);
+    asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+    asynStatus writeFloat64(asynUser *pasynUser, epicsFloat64 value);
+    asynStatus poll();
+    void report(FILE *fp, int level);
+
+    /* Not for public use, called from the C thread functions */
+    void compareTask();
+    void traceTask();
+
+protected:
+    asynStatus command();
+
+    int P_BootId;
+    int P_PcmpAxis;
+    int P_PcmpScale;
+    int P_PcmpStart;
+    int P_PcmpStep;
+    int P_PcmpCount;
+    int P_PcmpPeriod;
+    int P_PcmpArm;
+    int P_PcmpState;
+    int P_PcmpTrigger;
+    int P_PcmpIndex;
+    int P_PcmpNFired;
+    int P_PcmpLatency;
+    int P_PcmpLatencyMean;
+    int P_PcmpLatencyMax;
+    int P_PcmpPosError;
+    int P_PcmpRate;
+    int P_PcmpFieldIn;
+    int P_PcmpFieldTimeout;
+    int P_PcmpGrid;
+    int P_PcmpFirePos;
+    int P_PcmpLatencies;
+    int P_PcmpField;
+    int P_TraceAxis;
+    int P_TraceScale;
+    int P_TracePeriod;
+    int P_TraceEnable;
+    int P_TraceNPoints;
+    int P_TraceDropped;
+    int P_TraceRate;
+    int P_TraceT0;
+    int P_TraceDuration;
+    int P_TraceTime;
+    int P_TraceSteps;
+    int P_TraceMm;
+    int P_PlanMode;
+    int P_PlanVmax;
+    int P_PlanAmax;
+    int P_PlanJmax;
+    int P_PlanVelocity;
+    int P_PlanAccel;
+    int P_PlanTime;
+    int P_PlanActual;
+    int P_PlanError;
+    int P_PlanErrorMean;
+    int P_PlanCount;
+    int P_PlanQuery;
+    int P_PlanQueryTime;
+    int P_PlanLogDist;
+    int P_PlanLogTime;
+    int P_PlanLogActual;
+
+private:
+    asynStatus readPosition(int axis, double *position, int *flags, double *time);
+    asynStatus readBootId();
+    void armCompare();
+    void fire(double crossTime, double velocity);
+    void publishCompare();
+    void startTrace(int axis);
+    void publishTrace(const epicsTimeStamp *start);
+
+    char idn_[64];
+    char bootId_[32];
+    epicsUInt64 bootChecked_;       /* monotonic ns of the last BOOT? */
+    epicsTimerQueueId timerQueue_;
+
+    /* Position compare, under the port lock */
+    epicsEventId compareEvent_;
+    bool compareArmed_;
+    int compareAxis_;
+    double compareScale_;           /* steps per mm */
+    size_t compareNext_;            /* next grid point */
+    int compareTriggers_;           /* posted to PCMP_TRIGGER, never repeats */
+    double latencySum_, latencyMax_;
+    std::vector<double> grid_;      /* steps */
+    std::vector<double> crossTime_; /* monotonic s, per fired point */
+    std::vector<epicsFloat64> gridMm_, firePos_, latencies_, field_;
+
+    /* Trajectory trace, under the port lock */
+    epicsEventId traceEvent_;
+    bool tracePending_;             /* a move of the traced axis started */
+    std::vector<double> traceT_, traceP_;   /* ring, s and steps */
+    size_t traceHead_, traceCount_; /* next slot, samples kept */
+    size_t traceTotal_;             /* samples taken */
+    std::vector<epicsFloat64> traceTime_, traceSteps_, traceMm_;
+
+    friend class drvStepperAxis;
+};
+
+#endif /* DRVSTEPPER_H */
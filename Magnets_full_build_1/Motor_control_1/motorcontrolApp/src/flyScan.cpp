@@ -0,0 +1,535 @@
+/* flyScan.cpp */
+/*
+ * Fly scan of the probe axis with on-the-fly field sampling.
+ *
+ * FLY_RUN moves the motor to FLY_START less a run-up distance at its normal
+ * speed, sets VELO to FLY_VELO and moves past FLY_END by the same distance,
+ * so the motor is at constant velocity over the whole range. The run-up is
+ * cut at the soft limits (HLM/LLM) of the motor, so the ends of a range that
+ * reaches them are scanned while the motor accelerates or stops; a range
+ * past them is refused before moving. Meanwhile the RBV monitor records
+ * (time, position) and the <gaussmeter>bufField and bufTime monitors deliver
+ * blocks of field samples: the record time stamp is the capture time of the
+ * newest sample and bufTime the offsets of the others. After the move the
+ * thread waits until the samples cover the end of the range, then tags each
+ * sample with the RBV position linearly interpolated at its time. VELO is
+ * restored in every case.
+ *
+ * Positions are in mm, steps = mm * scale as in mmtostep.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <epicsThread.h>
+#include <epicsMath.h>
+#include <epicsStdio.h>
+#include <errlog.h>
+#include <iocsh.h>
+
+#include "asynDriver.h"
+#include "flyScan.h"
+
+#include <epicsExport.h>
+
+static const char *driverName = "flyScan";
+
+/* Constant velocity time before and after the range, on top of ACCL, s */
+#define FLY_SETTLE              0.2
+/* Wait for the gaussmeter blocks covering the end of the range, s */
+#define FLY_DATA_TIMEOUT        5.0
+/* Channel Access connection timeout for the gaussmeter waveforms, s */
+#define FLY_CONNECT_TIMEOUT     5.0
+
+static void flyTaskC(void *drvPvt)
+{
+    flyScan *pPvt = (flyScan *)drvPvt;
+    pPvt->flyTask();
+}
+
+flyScan::flyScan(const char *portName, const char *motor, const char *gaussmeter,
+                 double scale, int maxSamples)
+    : asynPortDriver(portName, 1,
+                     asynInt32Mask | asynFloat64Mask | asynOctetMask |
+                     asynFloat64ArrayMask | asynDrvUserMask,
+                     asynInt32Mask | asynFloat64Mask | asynOctetMask |
+                     asynFloat64ArrayMask,
+                     0, 1, 0, 0),
+      scale_(scale), linked_(false), eventCtx_(0), motorLinked_(false),
+      fieldChan_(0), timeChan_(0), fieldSub_(0), timeSub_(0),
+      collecting_(false), lastSampleT_(0.0)
+{
+    epicsSnprintf(motor_, sizeof motor_, "%s", motor);
+    epicsSnprintf(gaussmeter_, sizeof gaussmeter_, "%s", gaussmeter);
+    maxSamples_ = maxSamples > 0 ? maxSamples : 20000;
+    fieldBlock_.fresh = timeBlock_.fresh = false;
+    startEvent_ = epicsEventMustCreate(epicsEventEmpty);
+    dataLock_ = epicsMutexMustCreate();
+
+    createParam(FLY_START_STRING,       asynParamFloat64,      &P_Start);
+    createParam(FLY_END_STRING,         asynParamFloat64,      &P_End);
+    createParam(FLY_VELO_STRING,        asynParamFloat64,      &P_Velo);
+    createParam(FLY_NPTS_STRING,        asynParamInt32,        &P_NPts);
+    createParam(FLY_RUN_STRING,         asynParamInt32,        &P_Run);
+    createParam(FLY_ABORT_STRING,       asynParamInt32,        &P_Abort);
+    createParam(FLY_STATE_STRING,       asynParamInt32,        &P_State);
+    createParam(FLY_MESSAGE_STRING,     asynParamOctet,        &P_Message);
+    createParam(FLY_NSAMPLES_STRING,    asynParamInt32,        &P_NSamples);
+    createParam(FLY_DURATION_STRING,    asynParamFloat64,      &P_Duration);
+    createParam(FLY_ELAPSED_STRING,     asynParamFloat64,      &P_Elapsed);
+    createParam(FLY_VELO_RBV_STRING,    asynParamFloat64,      &P_VeloRbv);
+    createParam(FLY_POS_STRING,         asynParamFloat64Array, &P_Pos);
+    createParam(FLY_FIELD_STRING,       asynParamFloat64Array, &P_Field);
+    createParam(FLY_GRID_POS_STRING,    asynParamFloat64Array, &P_GridPos);
+    createParam(FLY_GRID_FIELD_STRING,  asynParamFloat64Array, &P_GridField);
+
+    setDoubleParam(P_Start, 0.0);
+    setDoubleParam(P_End, 20.0);
+    setDoubleParam(P_Velo, 2.0);
+    setIntegerParam(P_NPts, 21);
+    setIntegerParam(P_State, FLY_STATE_IDLE);
+    setStringParam(P_Message, "");
+    setIntegerParam(P_NSamples, 0);
+    setDoubleParam(P_Duration, 0.0);
+    setDoubleParam(P_Elapsed, 0.0);
+    setDoubleParam(P_VeloRbv, 0.0);
+
+    epicsThreadCreate(portName, epicsThreadPriorityMedium,
+                      epicsThreadGetStackSize(epicsThreadStackMedium),
+                      (EPICSTHREADFUNC)flyTaskC, this);
+}
+
+/*
+ * On the first run, when the database is up. Each step is done once, so a
+ * run after a failure picks up where the last one stopped.
+ */
+long flyScan::connectLinks()
+{
+    static const char *functionName = "connectLinks";
+    char name[MOTOR_LINK_NAME_SIZE];
+
+    if (!eventCtx_) {
+        eventCtx_ = db_init_events();
+        if (!eventCtx_ ||
+            db_start_events(eventCtx_, "flyScanEvent", NULL, NULL, epicsThreadPriorityMedium)) {
+            eventCtx_ = 0;
+            return -1;
+        }
+    }
+    if (!motorLinked_) {
+        if (mover_.connect(eventCtx_, motor_) || rbv_.connect(motor_, "RBV") ||
+            accl_.connect(motor_, "ACCL") || rbv_.monitor(eventCtx_, rbvCallback, this)) {
+            errlogPrintf("%s::%s: cannot link to %s\n", driverName, functionName, motor_);
+            return -1;
+        }
+        motorLinked_ = true;
+    }
+    if (!fieldChan_ || !timeChan_) {
+        ca_context_create(ca_enable_preemptive_callback);
+        epicsSnprintf(name, sizeof name, "%sbufField", gaussmeter_);
+        if (!fieldChan_ &&
+            ca_create_channel(name, NULL, this, CA_PRIORITY_DEFAULT, &fieldChan_) != ECA_NORMAL)
+            fieldChan_ = 0;
+        epicsSnprintf(name, sizeof name, "%sbufTime", gaussmeter_);
+        if (!timeChan_ &&
+            ca_create_channel(name, NULL, this, CA_PRIORITY_DEFAULT, &timeChan_) != ECA_NORMAL)
+            timeChan_ = 0;
+        if (!fieldChan_ || !timeChan_) {
+            errlogPrintf("%s::%s: cannot create channels to %s\n",
+                         driverName, functionName, gaussmeter_);
+            return -1;
+        }
+    }
+    if (ca_pend_io(FLY_CONNECT_TIMEOUT) != ECA_NORMAL) {
+        errlogPrintf("%s::%s: %sbufField/bufTime not connected\n",
+                     driverName, functionName, gaussmeter_);
+        return -1;
+    }
+    /* Count 0: each update has the current number of samples */
+    if (!fieldSub_ &&
+        ca_create_subscription(DBR_TIME_DOUBLE, 0, fieldChan_, DBE_VALUE,
+                               gaussmeterCallback, this, &fieldSub_) != ECA_NORMAL)
+        fieldSub_ = 0;
+    if (!timeSub_ &&
+        ca_create_subscription(DBR_TIME_DOUBLE, 0, timeChan_, DBE_VALUE,
+                               gaussmeterCallback, this, &timeSub_) != ECA_NORMAL)
+        timeSub_ = 0;
+    if (!fieldSub_ || !timeSub_)
+        return -1;
+    ca_flush_io();
+    linked_ = true;
+    return 0;
+}
+
+void flyScan::rbvCallback(void *arg, double value, const epicsTimeStamp *stamp)
+{
+    flyScan *pFly = (flyScan *)arg;
+
+    epicsMutexMustLock(pFly->dataLock_);
+    if (pFly->collecting_) {
+        pFly->trajT_.push_back(epicsTimeDiffInSeconds(stamp, &pFly->tRef_));
+        pFly->trajP_.push_back(value);
+    }
+    epicsMutexUnlock(pFly->dataLock_);
+}
+
+/*
+ * bufField and bufTime of one gaussmeter burst carry the same time stamp;
+ * the samples are taken when both halves have arrived.
+ */
+void flyScan::gaussmeterCallback(struct event_handler_args args)
+{
+    flyScan *pFly = (flyScan *)args.usr;
+    const struct dbr_time_double *pData = (const struct dbr_time_double *)args.dbr;
+    flyBlock *pBlock, *pOther;
+    double t0, t;
+    size_t i;
+
+    if (args.status != ECA_NORMAL || !pData)
+        return;
+    epicsMutexMustLock(pFly->dataLock_);
+    pBlock = args.chid == pFly->fieldChan_ ? &pFly->fieldBlock_ : &pFly->timeBlock_;
+    pOther = args.chid == pFly->fieldChan_ ? &pFly->timeBlock_ : &pFly->fieldBlock_;
+    pBlock->stamp = pData->stamp;
+    pBlock->values.assign(&pData->value, &pData->value + args.count);
+    pBlock->fresh = true;
+    if (pOther->fresh && epicsTimeEqual(&pBlock->stamp, &pOther->stamp) &&
+        pBlock->values.size() == pOther->values.size()) {
+        pBlock->fresh = pOther->fresh = false;
+        if (pFly->collecting_) {
+            const flyBlock &field = pFly->fieldBlock_, &time = pFly->timeBlock_;
+            t0 = epicsTimeDiffInSeconds(&field.stamp, &pFly->tRef_);
+            for (i = 0; i < field.values.size(); i++) {
+                t = t0 + time.values[i];
+                /* Blocks may overlap when a poll is repeated */
+                if (t <= pFly->lastSampleT_ || pFly->sampleT_.size() >= pFly->maxSamples_)
+                    continue;
+                pFly->sampleT_.push_back(t);
+                pFly->sampleB_.push_back(field.values[i]);
+                pFly->lastSampleT_ = t;
+            }
+        }
+    }
+    epicsMutexUnlock(pFly->dataLock_);
+}
+
+void flyScan::setState(int state, const char *message)
+{
+    epicsTimeStamp now;
+
+    epicsTimeGetCurrent(&now);
+    lock();
+    setIntegerParam(P_State, state);
+    if (message)
+        setStringParam(P_Message, message);
+    setDoubleParam(P_Elapsed, epicsTimeDiffInSeconds(&now, &tStart_));
+    callParamCallbacks();
+    unlock();
+}
+
+/* Time the recorded trajectory passes the given position, NaN if it does not */
+double flyScan::crossing(double steps)
+{
+    size_t j;
+
+    for (j = 0; j + 1 < trajP_.size(); j++) {
+        double d0 = trajP_[j] - steps, d1 = trajP_[j + 1] - steps;
+        if (d0 == 0.0)
+            return trajT_[j];
+        if ((d0 < 0.0) != (d1 < 0.0) || d1 == 0.0)
+            return trajT_[j] + (trajT_[j + 1] - trajT_[j]) * d0 / (d0 - d1);
+    }
+    return epicsNAN;
+}
+
+int flyScan::waitForData(double tEnd)
+{
+    epicsTimeStamp t0, now;
+    double last;
+
+    epicsTimeGetCurrent(&t0);
+    for (;;) {
+        epicsMutexMustLock(dataLock_);
+        last = sampleT_.empty() ? -1e30 : lastSampleT_;
+        epicsMutexUnlock(dataLock_);
+        if (last >= tEnd)
+            return 0;
+        if (mover_.aborted())
+            return -1;
+        epicsTimeGetCurrent(&now);
+        if (epicsTimeDiffInSeconds(&now, &t0) > FLY_DATA_TIMEOUT)
+            return -1;
+        epicsThreadSleep(0.1);
+    }
+}
+
+/*
+ * Tags the samples with positions and fills the waveforms. A grid point is
+ * the least-squares line through the samples within half a step of it,
+ * evaluated at the point, so the half-width end bins are not biased by the
+ * slope of the field.
+ */
+void flyScan::process(double start, double end, int nPoints)
+{
+    double lo = start < end ? start : end, hi = start < end ? end : start;
+    double step = (end - start) / (nPoints - 1);
+    std::vector<double> sx(nPoints, 0.0), sy(nPoints, 0.0), sxx(nPoints, 0.0), sxy(nPoints, 0.0);
+    std::vector<int> count(nPoints, 0);
+    size_t i, j = 0;
+    int k;
+
+    pos_.clear();
+    field_.clear();
+    for (i = 0; i < sampleT_.size() && !trajT_.empty(); i++) {
+        double t = sampleT_[i], p, mm;
+        if (t < trajT_.front() || t > trajT_.back())
+            continue;
+        while (j + 2 < trajT_.size() && t > trajT_[j + 1])
+            j++;
+        if (trajT_.size() == 1 || trajT_[j + 1] == trajT_[j])
+            p = trajP_[j];
+        else
+            p = trajP_[j] + (trajP_[j + 1] - trajP_[j]) * (t - trajT_[j]) /
+                (trajT_[j + 1] - trajT_[j]);
+        mm = p / scale_;
+        if (mm < lo || mm > hi)
+            continue;
+        pos_.push_back(mm);
+        field_.push_back(sampleB_[i]);
+        k = (int)floor((mm - start) / step + 0.5);
+        if (k >= 0 && k < nPoints) {
+            double x = mm - (start + k * step);
+            sx[k] += x;
+            sy[k] += sampleB_[i];
+            sxx[k] += x * x;
+            sxy[k] += x * sampleB_[i];
+            count[k]++;
+        }
+    }
+
+    gridPos_.resize(nPoints);
+    gridField_.resize(nPoints);
+    for (k = 0; k < nPoints; k++) {
+        double det = count[k] * sxx[k] - sx[k] * sx[k];
+        gridPos_[k] = start + k * step;
+        if (count[k] > 2 && det > 0.0)
+            gridField_[k] = (sy[k] * sxx[k] - sx[k] * sxy[k]) / det;
+        else
+            gridField_[k] = count[k] ? sy[k] / count[k] : epicsNAN;
+    }
+}
+
+int flyScan::sequence()
+{
+    double start, end, velo, veloSteps, normalVelo = 0.0, accl = 0.0;
+    double s0, s1, runUp, sign, tStart, tEnd, rbv = 0.0, llm = 0.0, hlm = 0.0;
+    double from, to;
+    bool cut = false;
+    int nPoints, result;
+    char message[80];
+
+    lock();
+    getDoubleParam(P_Start, &start);
+    getDoubleParam(P_End, &end);
+    getDoubleParam(P_Velo, &velo);
+    getIntegerParam(P_NPts, &nPoints);
+    unlock();
+    if (!(velo > 0.0) || start == end || scale_ == 0.0) {
+        setState(FLY_STATE_FAILED, "bad scan parameters");
+        return FLY_STATE_FAILED;
+    }
+
+    s0 = start * scale_;
+    s1 = end * scale_;
+    sign = s1 > s0 ? 1.0 : -1.0;
+    veloSteps = fabs(velo * scale_);
+    mover_.velocity(&normalVelo);
+    accl_.get(&accl);
+    runUp = veloSteps * (0.5 * accl + FLY_SETTLE);
+    from = s0 - sign * runUp;
+    to = s1 + sign * runUp;
+
+    /* The run-up is cut at the soft limits; the range itself must fit */
+    if (mover_.limits(&llm, &hlm) == 0 && hlm > llm) {
+        if (fmin(s0, s1) < llm || fmax(s0, s1) > hlm) {
+            setState(FLY_STATE_FAILED, "range outside soft limits");
+            return FLY_STATE_FAILED;
+        }
+        cut = fmin(from, to) < llm || fmax(from, to) > hlm;
+        from = fmin(fmax(from, llm), hlm);
+        to = fmin(fmax(to, llm), hlm);
+    }
+
+    setState(FLY_STATE_START, "moving to start");
+    result = mover_.moveTo(from);
+    if (result != MOVER_DONE) {
+        setState(result == MOVER_ABORTED ? FLY_STATE_ABORTED : FLY_STATE_FAILED,
+                 motorMover::resultName(result));
+        return result == MOVER_ABORTED ? FLY_STATE_ABORTED : FLY_STATE_FAILED;
+    }
+
+    mover_.position(&rbv);
+    epicsMutexMustLock(dataLock_);
+    epicsTimeGetCurrent(&tRef_);
+    trajT_.assign(1, 0.0);
+    trajP_.assign(1, rbv);
+    sampleT_.clear();
+    sampleB_.clear();
+    lastSampleT_ = -1e30;
+    collecting_ = true;
+    epicsMutexUnlock(dataLock_);
+
+    setState(FLY_STATE_SCAN, "scanning");
+    if (mover_.setVelocity(veloSteps) == 0)
+        result = mover_.moveTo(to);
+    else
+        result = MOVER_FAILED;
+    mover_.setVelocity(normalVelo);
+
+    /* The trajectory is complete; field samples still arrive */
+    epicsMutexMustLock(dataLock_);
+    tStart = crossing(s0);
+    tEnd = crossing(s1);
+    epicsMutexUnlock(dataLock_);
+    if (result == MOVER_DONE && (isnan(tStart) || isnan(tEnd)))
+        result = MOVER_FAILED;
+    if (result == MOVER_DONE) {
+        setState(FLY_STATE_DATA, "waiting for field data");
+        if (waitForData(tEnd))
+            result = mover_.aborted() ? MOVER_ABORTED : MOVER_TIMEOUT;
+    }
+
+    epicsMutexMustLock(dataLock_);
+    collecting_ = false;
+    epicsMutexUnlock(dataLock_);
+    if (result != MOVER_DONE) {
+        setState(result == MOVER_ABORTED ? FLY_STATE_ABORTED : FLY_STATE_FAILED,
+                 result == MOVER_TIMEOUT ? "no field data over the range" :
+                 motorMover::resultName(result));
+        return result == MOVER_ABORTED ? FLY_STATE_ABORTED : FLY_STATE_FAILED;
+    }
+
+    /* Only this thread touches the sample vectors now */
+    process(start, end, nPoints);
+
+    lock();
+    setIntegerParam(P_NSamples, (int)pos_.size());
+    setDoubleParam(P_Duration, tEnd - tStart);
+    setDoubleParam(P_VeloRbv, fabs(end - start) / (tEnd - tStart));
+    doCallbacksFloat64Array(pos_.empty() ? NULL : &pos_[0], pos_.size(), P_Pos, 0);
+    doCallbacksFloat64Array(field_.empty() ? NULL : &field_[0], field_.size(), P_Field, 0);
+    doCallbacksFloat64Array(&gridPos_[0], gridPos_.size(), P_GridPos, 0);
+    doCallbacksFloat64Array(&gridField_[0], gridField_.size(), P_GridField, 0);
+    unlock();
+
+    epicsSnprintf(message, sizeof message, "%u samples in %.2f s%s",
+                  (unsigned)pos_.size(), tEnd - tStart,
+                  cut ? ", run-up cut at soft limits" : "");
+    setState(FLY_STATE_DONE, message);
+    return FLY_STATE_DONE;
+}
+
+void flyScan::flyTask()
+{
+    for (;;) {
+        epicsEventMustWait(startEvent_);
+        epicsTimeGetCurrent(&tStart_);
+        if (!linked_ && connectLinks()) {
+            setState(FLY_STATE_FAILED, "links not available");
+            continue;
+        }
+        sequence();
+    }
+}
+
+asynStatus flyScan::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+    int state;
+
+    getIntegerParam(P_State, &state);
+
+    if (function == P_Run) {
+        if (!value)
+            return asynSuccess;
+        if (state == FLY_STATE_START || state == FLY_STATE_SCAN || state == FLY_STATE_DATA)
+            return asynError;
+        mover_.clearAbort();
+        setIntegerParam(P_State, FLY_STATE_START);
+        setStringParam(P_Message, "starting");
+        epicsEventSignal(startEvent_);
+    } else if (function == P_Abort) {
+        if (value)
+            mover_.abort();
+        return asynSuccess;
+    } else if (function == P_NPts) {
+        if (value < 2)
+            value = 2;
+        if ((size_t)value > maxSamples_)
+            value = (epicsInt32)maxSamples_;
+        setIntegerParam(function, value);
+    } else {
+        return asynPortDriver::writeInt32(pasynUser, value);
+    }
+    callParamCallbacks();
+    return asynSuccess;
+}
+
+void flyScan::report(FILE *fp, int details)
+{
+    int state, nSamples;
+
+    getIntegerParam(P_State, &state);
+    getIntegerParam(P_NSamples, &nSamples);
+    fprintf(fp, "%s: motor %s, gaussmeter %s, %g steps/mm, state %d, %d samples\n",
+            portName, motor_, gaussmeter_, scale_, state, nSamples);
+    asynPortDriver::report(fp, details);
+}
+
+/* Configuration routine. Called directly, or from the iocsh function below */
+
+extern "C" {
+
+/*
+ * portName    asyn port of the fly scan records
+ * motor       motor record, positions in steps
+ * gaussmeter  prefix of the gaussmeter bufField and bufTime records
+ * scale       steps per mm, signed as in mmtostep
+ * maxSamples  samples kept per scan
+ */
+int flyScanConfigure(const char *portName, const char *motor, const char *gaussmeter,
+                     double scale, int maxSamples)
+{
+    if (!portName || !motor || !gaussmeter) {
+        errlogPrintf("Usage: flyScanConfigure portName motor gaussmeter scale maxSamples\n");
+        return -1;
+    }
+    new flyScan(portName, motor, gaussmeter, scale, maxSamples);
+    return 0;
+}
+
+/* EPICS iocsh shell commands */
+
+static const iocshArg initArg0 = { "portName",   iocshArgString };
+static const iocshArg initArg1 = { "motor",      iocshArgString };
+static const iocshArg initArg2 = { "gaussmeter", iocshArgString };
+static const iocshArg initArg3 = { "scale",      iocshArgDouble };
+static const iocshArg initArg4 = { "maxSamples", iocshArgInt };
+static const iocshArg * const initArgs[] = { &initArg0, &initArg1, &initArg2, &initArg3,
+                                             &initArg4 };
+static const iocshFuncDef initFuncDef = { "flyScanConfigure", 5, initArgs };
+
+static void initCallFunc(const iocshArgBuf *args)
+{
+    flyScanConfigure(args[0].sval, args[1].sval, args[2].sval, args[3].dval, args[4].ival);
+}
+
+static void flyScanRegister(void)
+{
+    iocshRegister(&initFuncDef, initCallFunc);
+}
+
+epicsExportRegistrar(flyScanRegister);
+
+}
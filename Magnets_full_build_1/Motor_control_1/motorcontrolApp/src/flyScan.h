@@ -0,0 +1,124 @@
+/* flyScan.h */
+
+#ifndef FLYSCAN_H
+#define FLYSCAN_H
+
+#include <vector>
+
+#include <epicsTypes.h>
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+#include <dbEvent.h>
+#include <cadef.h>
+
+#include "asynPortDriver.h"
+#include "motorLink.h"
+#include "motorMover.h"
+
+#define FLY_START_STRING        "FLY_START"
+#define FLY_END_STRING          "FLY_END"
+#define FLY_VELO_STRING         "FLY_VELO"
+#define FLY_NPTS_STRING         "FLY_NPTS"
+#define FLY_RUN_STRING          "FLY_RUN"
+#define FLY_ABORT_STRING        "FLY_ABORT"
+#define FLY_STATE_STRING        "FLY_STATE"
+#define FLY_MESSAGE_STRING      "FLY_MESSAGE"
+#define FLY_NSAMPLES_STRING     "FLY_NSAMPLES"
+#define FLY_DURATION_STRING     "FLY_DURATION"
+#define FLY_ELAPSED_STRING      "FLY_ELAPSED"
+#define FLY_VELO_RBV_STRING     "FLY_VELO_RBV"
+#define FLY_POS_STRING          "FLY_POS"
+#define FLY_FIELD_STRING        "FLY_FIELD"
+#define FLY_GRID_POS_STRING     "FLY_GRID_POS"
+#define FLY_GRID_FIELD_STRING   "FLY_GRID_FIELD"
+
+/* FLY_STATE */
+#define FLY_STATE_IDLE          0
+#define FLY_STATE_START         1
+#define FLY_STATE_SCAN          2
+#define FLY_STATE_DATA          3
+#define FLY_STATE_DONE          4
+#define FLY_STATE_FAILED        5
+#define FLY_STATE_ABORTED       6
+
+/* Samples of one gaussmeter waveform monitor */
+struct flyBlock {
+    epicsTimeStamp stamp;
+    std::vector<double> values;
+    bool fresh;
+};
+
+/*
+ * Fly scan: the motor runs at constant velocity across FLY_START..FLY_END
+ * (mm) while the gaussmeter field blocks, monitored over CA, are collected.
+ * Each field sample gets the motor position interpolated at its capture
+ * time from the time-stamped RBV updates, so both IOC hosts must share a
+ * time base (NTP). The tagged samples are published as position and field
+ * waveforms and averaged onto a FLY_NPTS grid, like a step scan.
+ */
+class flyScan : public asynPortDriver {
+public:
+    flyScan(const char *portName, const char *motor, const char *gaussmeter,
+            double scale, int maxSamples);
+
+    virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+    virtual void report(FILE *fp, int details);
+
+    /* Not for public use, called from the C thread function */
+    void flyTask();
+
+private:
+    static void rbvCallback(void *arg, double value, const epicsTimeStamp *stamp);
+    static void gaussmeterCallback(struct event_handler_args args);
+    long connectLinks();
+    int sequence();
+    int waitForData(double tEnd);
+    void process(double start, double end, int nPoints);
+    double crossing(double steps);
+    void setState(int state, const char *message);
+
+    int P_Start;
+    int P_End;
+    int P_Velo;
+    int P_NPts;
+    int P_Run;
+    int P_Abort;
+    int P_State;
+    int P_Message;
+    int P_NSamples;
+    int P_Duration;
+    int P_Elapsed;
+    int P_VeloRbv;
+    int P_Pos;
+    int P_Field;
+    int P_GridPos;
+    int P_GridField;
+
+    char motor_[MOTOR_LINK_NAME_SIZE];
+    char gaussmeter_[MOTOR_LINK_NAME_SIZE];
+    double scale_;              /* steps per mm */
+    size_t maxSamples_;
+    bool linked_;               /* every step below done */
+    dbEventCtx eventCtx_;
+    bool motorLinked_;
+    motorMover mover_;
+    motorLink rbv_, accl_;
+    chid fieldChan_, timeChan_;
+    evid fieldSub_, timeSub_;
+    epicsEventId startEvent_;
+    epicsTimeStamp tStart_;
+
+    /* Filled by the monitors while collecting_ */
+    epicsMutexId dataLock_;
+    bool collecting_;
+    epicsTimeStamp tRef_;
+    flyBlock fieldBlock_, timeBlock_;
+    std::vector<double> trajT_, trajP_;     /* s from tRef_, steps */
+    std::vector<double> sampleT_, sampleB_; /* s from tRef_, gauss */
+    double lastSampleT_;
+
+    std::vector<epicsFloat64> pos_, field_, gridPos_, gridField_;
+};
+
+#endif /* FLYSCAN_H */
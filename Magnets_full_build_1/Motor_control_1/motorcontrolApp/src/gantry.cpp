@@ -0,0 +1,765 @@
+/* gantry.cpp */
+/*
+ * Coordinated moves of several motor records as one gantry.
+ *
+ * A straight move from A to B is planned once, for the path parameter
+ * s = 0..1: its velocity and acceleration limits are the tightest of
+ * GANTRY_VMAX / |B - A| and GANTRY_AMAX / |B - A| over the moving axes.
+ * Each axis then gets VELO = peak * |B - A| * |scale| and ACCL = the common
+ * ramp time, with VBAS = 0, so all profiles have the same shape and end
+ * together; the drvStepper planner keeps them as long as its mode is Record
+ * or Trapezoid and its limits are not tighter. VELO, ACCL and VBAS are
+ * restored at the end of each move or run.
+ *
+ * GANTRY_MOVE goes to the GANTRY_TARGET of every axis. GANTRY_RUN goes
+ * through the first GANTRY_NPOINTS points of the GANTRY_POINTS lists, one
+ * move per point; a NaN, or a list shorter than the run, leaves the axis
+ * where it is. GANTRY_PATH_BUILD fills the lists with the grid of
+ * GANTRY_PATH_NPTS points from GANTRY_PATH_START by GANTRY_PATH_STEP per
+ * axis, axis 0 fastest; in serpentine mode every sweep of an axis runs back
+ * over the previous one instead of returning to its start.
+ *
+ * At each point of a run the gantry waits GANTRY_DWELL (one value per
+ * point, the last one repeating for the rest) and then, with GANTRY_ACQUIRE
+ * set, posts GANTRY_TRIGGER, whose I/O Intr record fires the gaussmeter as
+ * in the position compare of drvStepper. The first GANTRY_FIELD_IN written
+ * after the trigger is the reading of that point; none within
+ * GANTRY_ACQ_TIMEOUT leaves a NaN and counts in GANTRY_MISSED. The RBV of
+ * every axis, the reading and its time from the start of the run go to
+ * GANTRY_RESULT_POS, GANTRY_RESULT_FIELD and GANTRY_RESULT_TIME, published
+ * after every point with GANTRY_NRESULTS elements, so a whole map runs
+ * without a client in the loop.
+ *
+ * Positions in mm, steps = (mm - GANTRY_OFFSET) * GANTRY_SCALE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <epicsThread.h>
+#include <epicsMath.h>
+#include <epicsStdio.h>
+#include <errlog.h>
+#include <iocsh.h>
+
+#include "asynDriver.h"
+#include "gantry.h"
+
+#include <epicsExport.h>
+
+static const char *driverName = "gantry";
+
+/* Abort check period of a dwell, s */
+#define GANTRY_DWELL_SLICE      0.05
+
+static void gantryTaskC(void *drvPvt)
+{
+    gantry *pPvt = (gantry *)drvPvt;
+    pPvt->gantryTask();
+}
+
+gantry::gantry(const char *portName, const char *motors, int maxPoints)
+    : asynPortDriver(portName, GANTRY_MAX_AXES,
+                     asynInt32Mask | asynFloat64Mask | asynOctetMask |
+                     asynFloat64ArrayMask | asynDrvUserMask,
+                     asynInt32Mask | asynFloat64Mask | asynOctetMask |
+                     asynFloat64ArrayMask,
+                     ASYN_MULTIDEVICE, 1, 0, 0),
+      nAxes_(0), linked_(false), eventCtx_(0), command_(0), nPoints_(0),
+      fieldWanted_(false), fieldValue_(0.0), triggers_(0)
+{
+    const char *p = motors;
+    size_t n;
+    int i;
+
+    maxPoints_ = maxPoints > 0 ? maxPoints : 10000;
+    startEvent_ = epicsEventMustCreate(epicsEventEmpty);
+    fieldEvent_ = epicsEventMustCreate(epicsEventEmpty);
+    while (*p && nAxes_ < GANTRY_MAX_AXES) {
+        p += strspn(p, " ,");
+        n = strcspn(p, " ,");
+        if (n == 0)
+            break;
+        gantryAxis &axis = axes_[nAxes_];
+        axis.owner = this;
+        axis.index = nAxes_;
+        epicsSnprintf(axis.motor, sizeof axis.motor, "%.*s", (int)n, p);
+        axis.velo = axis.accl = axis.vbas = 0.0;
+        axis.started = false;
+        nAxes_++;
+        p += n;
+    }
+
+    createParam(GANTRY_SCALE_STRING,        asynParamFloat64,      &P_Scale);
+    createParam(GANTRY_OFFSET_STRING,       asynParamFloat64,      &P_Offset);
+    createParam(GANTRY_VMAX_STRING,         asynParamFloat64,      &P_Vmax);
+    createParam(GANTRY_AMAX_STRING,         asynParamFloat64,      &P_Amax);
+    createParam(GANTRY_TARGET_STRING,       asynParamFloat64,      &P_Target);
+    createParam(GANTRY_POSITION_STRING,     asynParamFloat64,      &P_Position);
+    createParam(GANTRY_PATH_START_STRING,   asynParamFloat64,      &P_PathStart);
+    createParam(GANTRY_PATH_STEP_STRING,    asynParamFloat64,      &P_PathStep);
+    createParam(GANTRY_PATH_NPTS_STRING,    asynParamInt32,        &P_PathNPts);
+    createParam(GANTRY_POINTS_STRING,       asynParamFloat64Array, &P_Points);
+    createParam(GANTRY_RESULT_POS_STRING,   asynParamFloat64Array, &P_ResultPos);
+    createParam(GANTRY_MOVE_STRING,         asynParamInt32,        &P_Move);
+    createParam(GANTRY_PATH_MODE_STRING,    asynParamInt32,        &P_PathMode);
+    createParam(GANTRY_PATH_BUILD_STRING,   asynParamInt32,        &P_PathBuild);
+    createParam(GANTRY_NPOINTS_STRING,      asynParamInt32,        &P_NPoints);
+    createParam(GANTRY_RUN_STRING,          asynParamInt32,        &P_Run);
+    createParam(GANTRY_ABORT_STRING,        asynParamInt32,        &P_Abort);
+    createParam(GANTRY_STATE_STRING,        asynParamInt32,        &P_State);
+    createParam(GANTRY_MESSAGE_STRING,      asynParamOctet,        &P_Message);
+    createParam(GANTRY_INDEX_STRING,        asynParamInt32,        &P_Index);
+    createParam(GANTRY_ELAPSED_STRING,      asynParamFloat64,      &P_Elapsed);
+    createParam(GANTRY_MOVE_TIME_STRING,    asynParamFloat64,      &P_MoveTime);
+    createParam(GANTRY_PATH_LENGTH_STRING,  asynParamFloat64,      &P_PathLength);
+    createParam(GANTRY_PATH_TIME_STRING,    asynParamFloat64,      &P_PathTime);
+    createParam(GANTRY_DWELL_STRING,        asynParamFloat64Array, &P_Dwell);
+    createParam(GANTRY_ACQUIRE_STRING,      asynParamInt32,        &P_Acquire);
+    createParam(GANTRY_ACQ_TIMEOUT_STRING,  asynParamFloat64,      &P_AcqTimeout);
+    createParam(GANTRY_TRIGGER_STRING,      asynParamInt32,        &P_Trigger);
+    createParam(GANTRY_FIELD_IN_STRING,     asynParamFloat64,      &P_FieldIn);
+    createParam(GANTRY_NRESULTS_STRING,     asynParamInt32,        &P_NResults);
+    createParam(GANTRY_MISSED_STRING,       asynParamInt32,        &P_Missed);
+    createParam(GANTRY_RESULT_FIELD_STRING, asynParamFloat64Array, &P_ResultField);
+    createParam(GANTRY_RESULT_TIME_STRING,  asynParamFloat64Array, &P_ResultTime);
+
+    for (i = 0; i < GANTRY_MAX_AXES; i++) {
+        setDoubleParam(i, P_Scale, -200.0);
+        setDoubleParam(i, P_Offset, 0.0);
+        setDoubleParam(i, P_Vmax, 10.0);
+        setDoubleParam(i, P_Amax, 50.0);
+        setDoubleParam(i, P_Target, 0.0);
+        setDoubleParam(i, P_Position, 0.0);
+        setDoubleParam(i, P_PathStart, 0.0);
+        setDoubleParam(i, P_PathStep, 1.0);
+        setIntegerParam(i, P_PathNPts, 1);
+    }
+    setIntegerParam(P_PathMode, GANTRY_PATH_SERPENTINE);
+    setIntegerParam(P_NPoints, 0);
+    setIntegerParam(P_State, GANTRY_STATE_IDLE);
+    setStringParam(P_Message, nAxes_ ? "" : "no motors");
+    setIntegerParam(P_Index, 0);
+    setDoubleParam(P_Elapsed, 0.0);
+    setDoubleParam(P_MoveTime, 0.0);
+    setDoubleParam(P_PathLength, 0.0);
+    setDoubleParam(P_PathTime, 0.0);
+    setIntegerParam(P_Acquire, 0);
+    setDoubleParam(P_AcqTimeout, 2.0);
+    setIntegerParam(P_Trigger, 0);
+    setDoubleParam(P_FieldIn, 0.0);
+    setIntegerParam(P_NResults, 0);
+    setIntegerParam(P_Missed, 0);
+
+    epicsThreadCreate(portName, epicsThreadPriorityMedium,
+                      epicsThreadGetStackSize(epicsThreadStackMedium),
+                      (EPICSTHREADFUNC)gantryTaskC, this);
+}
+
+/* On the first command, when the database is up */
+long gantry::connectLinks()
+{
+    static const char *functionName = "connectLinks";
+    int i;
+
+    eventCtx_ = db_init_events();
+    if (!eventCtx_ ||
+        db_start_events(eventCtx_, "gantryEvent", NULL, NULL, epicsThreadPriorityMedium)) {
+        eventCtx_ = 0;
+        return -1;
+    }
+    for (i = 0; i < nAxes_; i++) {
+        gantryAxis &axis = axes_[i];
+        if (axis.mover.connect(eventCtx_, axis.motor) || axis.rbv.connect(axis.motor, "RBV") ||
+            axis.rbv.monitor(eventCtx_, rbvCallback, &axis)) {
+            errlogPrintf("%s::%s: cannot link to %s\n", driverName, functionName, axis.motor);
+            return -1;
+        }
+    }
+    linked_ = true;
+    return 0;
+}
+
+void gantry::rbvCallback(void *arg, double value, const epicsTimeStamp *stamp)
+{
+    gantryAxis *pAxis = (gantryAxis *)arg;
+    gantry *pGantry = pAxis->owner;
+    double scale, offset;
+
+    pGantry->lock();
+    pGantry->getDoubleParam(pAxis->index, pGantry->P_Scale, &scale);
+    pGantry->getDoubleParam(pAxis->index, pGantry->P_Offset, &offset);
+    if (scale != 0.0) {
+        pGantry->setDoubleParam(pAxis->index, pGantry->P_Position, value / scale + offset);
+        pGantry->callParamCallbacks(pAxis->index, pAxis->index);
+    }
+    pGantry->unlock();
+}
+
+/* Under the port lock */
+void gantry::kinematics(gantryKinematics *kin)
+{
+    int i;
+
+    for (i = 0; i < nAxes_; i++) {
+        getDoubleParam(i, P_Scale, &kin->scale[i]);
+        getDoubleParam(i, P_Offset, &kin->offset[i]);
+        getDoubleParam(i, P_Vmax, &kin->vmax[i]);
+        getDoubleParam(i, P_Amax, &kin->amax[i]);
+    }
+}
+
+/*
+ * Profile of the path parameter for a straight move; duration 0 if no axis
+ * moves by a step or more.
+ */
+void gantry::plan(const gantryKinematics &kin, const double *from, const double *to,
+                  moveProfile *profile)
+{
+    double velocity = 0.0, acceleration = 0.0, d;
+    bool moving = false;
+    int i;
+
+    for (i = 0; i < nAxes_; i++) {
+        d = fabs(to[i] - from[i]);
+        if (isnan(d) || d * fabs(kin.scale[i]) < 0.5)
+            continue;
+        if (!moving || kin.vmax[i] / d < velocity)
+            velocity = kin.vmax[i] / d;
+        if (!moving || kin.amax[i] / d < acceleration)
+            acceleration = kin.amax[i] / d;
+        moving = true;
+    }
+    moveProfilePlan(profile, moving ? 1.0 : 0.0, velocity, acceleration, 0.0);
+}
+
+/* Straight move to target (mm, NaN = stay), the motors at their current positions */
+int gantry::moveTo(const gantryKinematics &kin, const double *target)
+{
+    double from[GANTRY_MAX_AXES], steps, d;
+    moveProfile profile;
+    int i, result = MOVER_DONE, r;
+
+    for (i = 0; i < nAxes_; i++) {
+        axes_[i].mover.position(&steps);
+        from[i] = steps / kin.scale[i] + kin.offset[i];
+    }
+    plan(kin, from, target, &profile);
+    lock();
+    setDoubleParam(P_MoveTime, profile.duration);
+    callParamCallbacks();
+    unlock();
+    if (profile.duration == 0.0)
+        return MOVER_DONE;
+
+    for (i = 0; i < nAxes_; i++) {
+        gantryAxis &axis = axes_[i];
+        axis.started = false;
+        d = fabs(target[i] - from[i]);
+        if (result != MOVER_DONE || isnan(d) || d * fabs(kin.scale[i]) < 0.5)
+            continue;
+        if (axis.mover.setVelocity(profile.velocity * d * fabs(kin.scale[i])) ||
+            axis.mover.setAcceleration(profile.rampTime)) {
+            result = MOVER_FAILED;
+            continue;
+        }
+        result = axis.mover.start((target[i] - kin.offset[i]) * kin.scale[i]);
+        axis.started = result == MOVER_DONE;
+    }
+    /* One axis failing stops the others */
+    if (result != MOVER_DONE)
+        for (i = 0; i < nAxes_; i++)
+            axes_[i].mover.abort();
+    for (i = 0; i < nAxes_; i++) {
+        if (!axes_[i].started)
+            continue;
+        r = axes_[i].mover.wait();
+        if (r != MOVER_DONE && result == MOVER_DONE) {
+            result = r;
+            for (int j = 0; j < nAxes_; j++)
+                axes_[j].mover.abort();
+        }
+    }
+    return result;
+}
+
+void gantry::saveSpeeds()
+{
+    int i;
+
+    for (i = 0; i < nAxes_; i++) {
+        gantryAxis &axis = axes_[i];
+        axis.mover.velocity(&axis.velo);
+        axis.mover.acceleration(&axis.accl);
+        axis.mover.baseVelocity(&axis.vbas);
+        axis.mover.setBaseVelocity(0.0);
+    }
+}
+
+void gantry::restoreSpeeds()
+{
+    int i;
+
+    for (i = 0; i < nAxes_; i++) {
+        gantryAxis &axis = axes_[i];
+        axis.mover.setVelocity(axis.velo);
+        axis.mover.setAcceleration(axis.accl);
+        axis.mover.setBaseVelocity(axis.vbas);
+    }
+}
+
+void gantry::setState(int state, const char *message)
+{
+    epicsTimeStamp now;
+
+    epicsTimeGetCurrent(&now);
+    lock();
+    setIntegerParam(P_State, state);
+    if (message)
+        setStringParam(P_Message, message);
+    setDoubleParam(P_Elapsed, epicsTimeDiffInSeconds(&now, &tStart_));
+    callParamCallbacks();
+    unlock();
+}
+
+int gantry::finish(int result, const char *what)
+{
+    char message[80];
+
+    if (result == MOVER_DONE) {
+        setState(GANTRY_STATE_DONE, what);
+        return GANTRY_STATE_DONE;
+    }
+    epicsSnprintf(message, sizeof message, "%s", motorMover::resultName(result));
+    setState(result == MOVER_ABORTED ? GANTRY_STATE_ABORTED : GANTRY_STATE_FAILED, message);
+    return result == MOVER_ABORTED ? GANTRY_STATE_ABORTED : GANTRY_STATE_FAILED;
+}
+
+int gantry::runMove()
+{
+    gantryKinematics kin;
+    double target[GANTRY_MAX_AXES];
+    int i, result;
+
+    lock();
+    kinematics(&kin);
+    for (i = 0; i < nAxes_; i++)
+        getDoubleParam(i, P_Target, &target[i]);
+    unlock();
+
+    setState(GANTRY_STATE_MOVING, "moving");
+    saveSpeeds();
+    result = moveTo(kin, target);
+    restoreSpeeds();
+    return finish(result, "at target");
+}
+
+/* Waits, or returns MOVER_ABORTED as soon as the gantry is aborted */
+int gantry::dwell(double seconds)
+{
+    epicsTimeStamp t0, now;
+    double left;
+
+    epicsTimeGetCurrent(&t0);
+    for (;;) {
+        if (nAxes_ && axes_[0].mover.aborted())
+            return MOVER_ABORTED;
+        epicsTimeGetCurrent(&now);
+        left = seconds - epicsTimeDiffInSeconds(&now, &t0);
+        if (left <= 0.0)
+            return MOVER_DONE;
+        epicsThreadSleep(left < GANTRY_DWELL_SLICE ? left : GANTRY_DWELL_SLICE);
+    }
+}
+
+/* One field reading: posts GANTRY_TRIGGER, NaN if no GANTRY_FIELD_IN follows */
+double gantry::acquire(double timeout)
+{
+    double value = epicsNAN;
+
+    epicsEventTryWait(fieldEvent_);
+    lock();
+    fieldWanted_ = true;
+    setIntegerParam(P_Trigger, ++triggers_);
+    callParamCallbacks();
+    unlock();
+    epicsEventWaitWithTimeout(fieldEvent_, timeout);
+    lock();
+    if (!fieldWanted_)
+        value = fieldValue_;
+    fieldWanted_ = false;
+    unlock();
+    return value;
+}
+
+/* The first n results, under the port lock */
+void gantry::publishResults(size_t n)
+{
+    int i;
+
+    setIntegerParam(P_NResults, (int)n);
+    doCallbacksFloat64Array(&resultField_[0], n, P_ResultField, 0);
+    doCallbacksFloat64Array(&resultTime_[0], n, P_ResultTime, 0);
+    for (i = 0; i < nAxes_; i++)
+        doCallbacksFloat64Array(&resultPos_[i][0], n, P_ResultPos, i);
+    callParamCallbacks();
+}
+
+int gantry::runList()
+{
+    std::vector<epicsFloat64> points[GANTRY_MAX_AXES], dwellList;
+    gantryKinematics kin;
+    double target[GANTRY_MAX_AXES], position[GANTRY_MAX_AXES], steps, timeout, field, wait;
+    epicsTimeStamp now;
+    size_t k, nPoints;
+    int i, acquireOn, missed = 0, result = MOVER_DONE;
+    char message[80];
+
+    lock();
+    kinematics(&kin);
+    nPoints = nPoints_;
+    for (i = 0; i < nAxes_; i++)
+        points[i] = points_[i];
+    dwellList = dwell_;
+    getIntegerParam(P_Acquire, &acquireOn);
+    getDoubleParam(P_AcqTimeout, &timeout);
+    setIntegerParam(P_Index, 0);
+    setIntegerParam(P_Missed, 0);
+    if (nPoints > 0) {
+        resultField_.assign(nPoints, epicsNAN);
+        resultTime_.assign(nPoints, epicsNAN);
+        for (i = 0; i < nAxes_; i++)
+            resultPos_[i].assign(nPoints, epicsNAN);
+        publishResults(0);
+    }
+    unlock();
+    if (nPoints == 0) {
+        setState(GANTRY_STATE_FAILED, "no points");
+        return GANTRY_STATE_FAILED;
+    }
+
+    setState(GANTRY_STATE_RUNNING, "running");
+    saveSpeeds();
+    for (k = 0; k < nPoints && result == MOVER_DONE; k++) {
+        for (i = 0; i < nAxes_; i++)
+            target[i] = k < points[i].size() ? points[i][k] : epicsNAN;
+        result = moveTo(kin, target);
+        if (result != MOVER_DONE)
+            break;
+        wait = dwellList.empty() ? 0.0 : dwellList[k < dwellList.size() ? k : dwellList.size() - 1];
+        if ((result = dwell(wait)) != MOVER_DONE)
+            break;
+        field = acquireOn ? acquire(timeout) : epicsNAN;
+        if (acquireOn && isnan(field))
+            missed++;
+        epicsTimeGetCurrent(&now);
+        for (i = 0; i < nAxes_; i++)
+            position[i] = axes_[i].mover.position(&steps) ? epicsNAN :
+                          steps / kin.scale[i] + kin.offset[i];
+
+        lock();
+        resultField_[k] = field;
+        resultTime_[k] = epicsTimeDiffInSeconds(&now, &tStart_);
+        for (i = 0; i < nAxes_; i++)
+            resultPos_[i][k] = position[i];
+        setIntegerParam(P_Index, (int)k + 1);
+        setIntegerParam(P_Missed, missed);
+        publishResults(k + 1);
+        unlock();
+        setState(GANTRY_STATE_RUNNING, NULL);
+    }
+    restoreSpeeds();
+    if (missed)
+        epicsSnprintf(message, sizeof message, "%u points, %d readings missed",
+                      (unsigned)nPoints, missed);
+    else
+        epicsSnprintf(message, sizeof message, "%u points", (unsigned)nPoints);
+    return finish(result, message);
+}
+
+void gantry::gantryTask()
+{
+    int command;
+
+    for (;;) {
+        epicsEventMustWait(startEvent_);
+        epicsTimeGetCurrent(&tStart_);
+        lock();
+        command = command_;
+        unlock();
+        if (!linked_ && connectLinks()) {
+            setState(GANTRY_STATE_FAILED, "links not available");
+            continue;
+        }
+        if (command == P_Run)
+            runList();
+        else
+            runMove();
+    }
+}
+
+/* Length and predicted duration, motion and dwells, of the point list, under the port lock */
+void gantry::pathStats()
+{
+    gantryKinematics kin;
+    moveProfile profile;
+    double from[GANTRY_MAX_AXES], to[GANTRY_MAX_AXES], length = 0.0, time = 0.0, d2, d;
+    size_t nDwell = dwell_.size();
+    size_t k;
+    int i;
+
+    kinematics(&kin);
+    for (i = 0; i < GANTRY_MAX_AXES; i++)
+        from[i] = epicsNAN;
+    for (k = 0; k < nPoints_; k++) {
+        d2 = 0.0;
+        for (i = 0; i < nAxes_; i++) {
+            to[i] = k < points_[i].size() && !isnan(points_[i][k]) ? points_[i][k] :
+                    from[i];
+            d = to[i] - from[i];
+            if (!isnan(d))
+                d2 += d * d;
+        }
+        if (k > 0) {
+            plan(kin, from, to, &profile);
+            length += sqrt(d2);
+            time += profile.duration;
+        }
+        if (nDwell)
+            time += dwell_[k < nDwell ? k : nDwell - 1];
+        memcpy(from, to, sizeof from);
+    }
+    setIntegerParam(P_NPoints, (int)nPoints_);
+    setDoubleParam(P_PathLength, length);
+    setDoubleParam(P_PathTime, time);
+}
+
+/* Grid of the GANTRY_PATH_ parameters into the point lists, under the port lock */
+asynStatus gantry::buildPath()
+{
+    double start[GANTRY_MAX_AXES], step[GANTRY_MAX_AXES];
+    int n[GANTRY_MAX_AXES], mode, i, idx;
+    size_t total = 1, k, sweep;
+
+    getIntegerParam(P_PathMode, &mode);
+    for (i = 0; i < nAxes_; i++) {
+        getDoubleParam(i, P_PathStart, &start[i]);
+        getDoubleParam(i, P_PathStep, &step[i]);
+        getIntegerParam(i, P_PathNPts, &n[i]);
+        if (n[i] < 1)
+            n[i] = 1;
+        total *= n[i];
+        if (total > maxPoints_) {
+            setStringParam(P_Message, "path longer than the point lists");
+            return asynError;
+        }
+    }
+
+    for (i = 0; i < nAxes_; i++)
+        points_[i].resize(total);
+    for (k = 0; k < total; k++) {
+        sweep = k;
+        for (i = 0; i < nAxes_; i++) {
+            idx = (int)(sweep % n[i]);
+            sweep /= n[i];
+            /* sweep now counts the completed sweeps of axis i */
+            if (mode == GANTRY_PATH_SERPENTINE && (sweep & 1))
+                idx = n[i] - 1 - idx;
+            points_[i][k] = start[i] + idx * step[i];
+        }
+    }
+    nPoints_ = total;
+    for (i = 0; i < nAxes_; i++)
+        doCallbacksFloat64Array(&points_[i][0], total, P_Points, i);
+    pathStats();
+    return asynSuccess;
+}
+
+asynStatus gantry::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+    int state, i;
+    asynStatus status = asynSuccess;
+
+    getIntegerParam(P_State, &state);
+
+    if (function == P_Move || function == P_Run) {
+        if (!value)
+            return asynSuccess;
+        if (state == GANTRY_STATE_MOVING || state == GANTRY_STATE_RUNNING || nAxes_ == 0)
+            return asynError;
+        for (i = 0; i < nAxes_; i++)
+            axes_[i].mover.clearAbort();
+        command_ = function;
+        setIntegerParam(P_State, function == P_Run ? GANTRY_STATE_RUNNING :
+                                                     GANTRY_STATE_MOVING);
+        setStringParam(P_Message, "starting");
+        epicsEventSignal(startEvent_);
+    } else if (function == P_Abort) {
+        if (value)
+            for (i = 0; i < nAxes_; i++)
+                axes_[i].mover.abort();
+        return asynSuccess;
+    } else if (function == P_PathBuild) {
+        if (!value)
+            return asynSuccess;
+        if (state == GANTRY_STATE_RUNNING)
+            return asynError;
+        status = buildPath();
+    } else if (function == P_NPoints) {
+        if (state == GANTRY_STATE_RUNNING)
+            return asynError;
+        if (value < 0)
+            value = 0;
+        nPoints_ = (size_t)value > maxPoints_ ? maxPoints_ : (size_t)value;
+        pathStats();
+    } else {
+        return asynPortDriver::writeInt32(pasynUser, value);
+    }
+    callParamCallbacks();
+    return status;
+}
+
+asynStatus gantry::writeFloat64(asynUser *pasynUser, epicsFloat64 value)
+{
+    int function = pasynUser->reason;
+
+    if (function == P_Scale && value == 0.0)
+        return asynError;
+    if ((function == P_Vmax || function == P_Amax) && !(value > 0.0))
+        return asynError;
+    if (function == P_FieldIn) {
+        /* Readings that do not follow a trigger are dropped */
+        setDoubleParam(P_FieldIn, value);
+        if (fieldWanted_) {
+            fieldValue_ = value;
+            fieldWanted_ = false;
+            epicsEventSignal(fieldEvent_);
+        }
+        callParamCallbacks();
+        return asynSuccess;
+    }
+    return asynPortDriver::writeFloat64(pasynUser, value);
+}
+
+/*
+ * A point list for one axis, the run length following the list written
+ * last, or the dwell list
+ */
+asynStatus gantry::writeFloat64Array(asynUser *pasynUser, epicsFloat64 *value,
+                                     size_t nElements)
+{
+    int function = pasynUser->reason;
+    int addr, state;
+
+    if (function != P_Points && function != P_Dwell)
+        return asynPortDriver::writeFloat64Array(pasynUser, value, nElements);
+    getAddress(pasynUser, &addr);
+    getIntegerParam(P_State, &state);
+    if (state == GANTRY_STATE_RUNNING)
+        return asynError;
+    if (nElements > maxPoints_)
+        nElements = maxPoints_;
+    if (function == P_Dwell) {
+        dwell_.assign(value, value + nElements);
+        doCallbacksFloat64Array(value, nElements, P_Dwell, 0);
+        pathStats();
+        callParamCallbacks();
+        return asynSuccess;
+    }
+    if (addr < 0 || addr >= nAxes_)
+        return asynError;
+    points_[addr].assign(value, value + nElements);
+    nPoints_ = nElements;
+    doCallbacksFloat64Array(value, nElements, P_Points, addr);
+    pathStats();
+    callParamCallbacks();
+    return asynSuccess;
+}
+
+asynStatus gantry::readFloat64Array(asynUser *pasynUser, epicsFloat64 *value,
+                                    size_t nElements, size_t *nIn)
+{
+    int function = pasynUser->reason;
+    const std::vector<epicsFloat64> *list;
+    size_t n;
+    int addr, nResults;
+
+    getAddress(pasynUser, &addr);
+    getIntegerParam(P_NResults, &nResults);
+    if (function == P_Dwell)
+        list = &dwell_;
+    else if (function == P_Points && addr >= 0 && addr < nAxes_)
+        list = &points_[addr];
+    else if (function == P_ResultField)
+        list = &resultField_;
+    else if (function == P_ResultTime)
+        list = &resultTime_;
+    else if (function == P_ResultPos && addr >= 0 && addr < nAxes_)
+        list = &resultPos_[addr];
+    else
+        return asynPortDriver::readFloat64Array(pasynUser, value, nElements, nIn);
+    n = list->size();
+    /* Results of the points reached so far */
+    if (function != P_Dwell && function != P_Points && n > (size_t)nResults)
+        n = nResults;
+    *nIn = n < nElements ? n : nElements;
+    if (*nIn)
+        memcpy(value, &(*list)[0], *nIn * sizeof *value);
+    return asynSuccess;
+}
+
+void gantry::report(FILE *fp, int details)
+{
+    int state, nResults, i;
+
+    getIntegerParam(P_State, &state);
+    getIntegerParam(P_NResults, &nResults);
+    fprintf(fp, "%s: %d axes, state %d, %u points, %d results, %d triggers\n", portName,
+            nAxes_, state, (unsigned)nPoints_, nResults, triggers_);
+    for (i = 0; i < nAxes_; i++)
+        fprintf(fp, "  axis %d: %s\n", i, axes_[i].motor);
+    asynPortDriver::report(fp, details);
+}
+
+/* Configuration routine. Called directly, or from the iocsh function below */
+
+extern "C" {
+
+/*
+ * portName   asyn port of the gantry records
+ * motors     motor records of axes 0, 1, 2, separated by spaces or commas
+ * maxPoints  length of the point lists
+ */
+int gantryConfigure(const char *portName, const char *motors, int maxPoints)
+{
+    if (!portName || !motors) {
+        errlogPrintf("Usage: gantryConfigure portName \"motor0 motor1 motor2\" maxPoints\n");
+        return -1;
+    }
+    new gantry(portName, motors, maxPoints);
+    return 0;
+}
+
+/* EPICS iocsh shell commands */
+
+static const iocshArg initArg0 = { "portName",  iocshArgString };
+static const iocshArg initArg1 = { "motors",    iocshArgString };
+static const iocshArg initArg2 = { "maxPoints", iocshArgInt };
+static const iocshArg * const initArgs[] = { &initArg0, &initArg1, &initArg2 };
+static const iocshFuncDef initFuncDef = { "gantryConfigure", 3, initArgs };
+
+static void initCallFunc(const iocshArgBuf *args)
+{
+    gantryConfigure(args[0].sval, args[1].sval, args[2].ival);
+}
+
+static void gantryRegister(void)
+{
+    iocshRegister(&initFuncDef, initCallFunc);
+}
+
+epicsExportRegistrar(gantryRegister);
+
+}
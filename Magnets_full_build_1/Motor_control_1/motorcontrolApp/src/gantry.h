@@ -0,0 +1,190 @@
+/* gantry.h */
+
+#ifndef GANTRY_H
+#define GANTRY_H
+
+#include <vector>
+
+#include <epicsTypes.h>
+#include <epicsEvent.h>
+#include <epicsTime.h>
+#include <dbEvent.h>
+
+#include "asynPortDriver.h"
+#include "motorLink.h"
+#include "motorMover.h"
+#include "moveProfile.h"
+
+#define GANTRY_MAX_AXES         3
+
+/* Per axis, asyn address = axis */
+#define GANTRY_SCALE_STRING         "GANTRY_SCALE"
+#define GANTRY_OFFSET_STRING        "GANTRY_OFFSET"
+#define GANTRY_VMAX_STRING          "GANTRY_VMAX"
+#define GANTRY_AMAX_STRING          "GANTRY_AMAX"
+#define GANTRY_TARGET_STRING        "GANTRY_TARGET"
+#define GANTRY_POSITION_STRING      "GANTRY_POSITION"
+#define GANTRY_PATH_START_STRING    "GANTRY_PATH_START"
+#define GANTRY_PATH_STEP_STRING     "GANTRY_PATH_STEP"
+#define GANTRY_PATH_NPTS_STRING     "GANTRY_PATH_NPTS"
+#define GANTRY_POINTS_STRING        "GANTRY_POINTS"
+#define GANTRY_RESULT_POS_STRING    "GANTRY_RESULT_POS"
+/* Address 0 */
+#define GANTRY_MOVE_STRING          "GANTRY_MOVE"
+#define GANTRY_PATH_MODE_STRING     "GANTRY_PATH_MODE"
+#define GANTRY_PATH_BUILD_STRING    "GANTRY_PATH_BUILD"
+#define GANTRY_NPOINTS_STRING       "GANTRY_NPOINTS"
+#define GANTRY_RUN_STRING           "GANTRY_RUN"
+#define GANTRY_ABORT_STRING         "GANTRY_ABORT"
+#define GANTRY_STATE_STRING         "GANTRY_STATE"
+#define GANTRY_MESSAGE_STRING       "GANTRY_MESSAGE"
+#define GANTRY_INDEX_STRING         "GANTRY_INDEX"
+#define GANTRY_ELAPSED_STRING       "GANTRY_ELAPSED"
+#define GANTRY_MOVE_TIME_STRING     "GANTRY_MOVE_TIME"
+#define GANTRY_PATH_LENGTH_STRING   "GANTRY_PATH_LENGTH"
+#define GANTRY_PATH_TIME_STRING     "GANTRY_PATH_TIME"
+#define GANTRY_DWELL_STRING         "GANTRY_DWELL"
+#define GANTRY_ACQUIRE_STRING       "GANTRY_ACQUIRE"
+#define GANTRY_ACQ_TIMEOUT_STRING   "GANTRY_ACQ_TIMEOUT"
+#define GANTRY_TRIGGER_STRING       "GANTRY_TRIGGER"
+#define GANTRY_FIELD_IN_STRING      "GANTRY_FIELD_IN"
+#define GANTRY_NRESULTS_STRING      "GANTRY_NRESULTS"
+#define GANTRY_MISSED_STRING        "GANTRY_MISSED"
+#define GANTRY_RESULT_FIELD_STRING  "GANTRY_RESULT_FIELD"
+#define GANTRY_RESULT_TIME_STRING   "GANTRY_RESULT_TIME"
+
+/* GANTRY_PATH_MODE */
+#define GANTRY_PATH_RASTER      0
+#define GANTRY_PATH_SERPENTINE  1
+
+/* GANTRY_STATE */
+#define GANTRY_STATE_IDLE       0
+#define GANTRY_STATE_MOVING     1
+#define GANTRY_STATE_RUNNING    2
+#define GANTRY_STATE_DONE       3
+#define GANTRY_STATE_FAILED     4
+#define GANTRY_STATE_ABORTED    5
+
+class gantry;
+
+/* One motor record of the gantry */
+struct gantryAxis {
+    gantry *owner;
+    int index;
+    char motor[MOTOR_LINK_NAME_SIZE];
+    motorMover mover;
+    motorLink rbv;
+    double velo, accl, vbas;    /* of the motor record, restored after a run */
+    bool started;
+};
+
+/* Kinematics of all axes, read at the start of a run */
+struct gantryKinematics {
+    double scale[GANTRY_MAX_AXES];      /* steps per mm, signed */
+    double offset[GANTRY_MAX_AXES];     /* mm at step 0 */
+    double vmax[GANTRY_MAX_AXES];       /* mm/s */
+    double amax[GANTRY_MAX_AXES];       /* mm/s^2 */
+};
+
+/*
+ * X/Y/Z gantry on up to GANTRY_MAX_AXES motor records of this IOC. Each
+ * axis has its own kinematics, mm = steps / GANTRY_SCALE + GANTRY_OFFSET,
+ * and limits. A move is a straight line: every axis runs the same
+ * trapezoid scaled to its share of the distance, so all arrive together.
+ * A point list, written or built as a raster or serpentine grid, runs
+ * point to point inside the IOC, with a dwell and optionally a field
+ * reading at each point; the positions reached, the readings and their
+ * times are published as arrays while the list runs.
+ */
+class gantry : public asynPortDriver {
+public:
+    gantry(const char *portName, const char *motors, int maxPoints);
+
+    virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+    virtual asynStatus writeFloat64(asynUser *pasynUser, epicsFloat64 value);
+    virtual asynStatus writeFloat64Array(asynUser *pasynUser, epicsFloat64 *value,
+                                         size_t nElements);
+    virtual asynStatus readFloat64Array(asynUser *pasynUser, epicsFloat64 *value,
+                                        size_t nElements, size_t *nIn);
+    virtual void report(FILE *fp, int details);
+
+    /* Not for public use, called from the C thread function */
+    void gantryTask();
+
+private:
+    static void rbvCallback(void *arg, double value, const epicsTimeStamp *stamp);
+    long connectLinks();
+    void kinematics(gantryKinematics *kin);
+    void plan(const gantryKinematics &kin, const double *from, const double *to,
+              moveProfile *profile);
+    int moveTo(const gantryKinematics &kin, const double *target);
+    int runMove();
+    int runList();
+    int dwell(double seconds);
+    double acquire(double timeout);
+    void publishResults(size_t n);
+    void saveSpeeds();
+    void restoreSpeeds();
+    asynStatus buildPath();
+    void pathStats();
+    void setState(int state, const char *message);
+    int finish(int result, const char *what);
+
+    int P_Scale;
+    int P_Offset;
+    int P_Vmax;
+    int P_Amax;
+    int P_Target;
+    int P_Position;
+    int P_PathStart;
+    int P_PathStep;
+    int P_PathNPts;
+    int P_Points;
+    int P_ResultPos;
+    int P_Move;
+    int P_PathMode;
+    int P_PathBuild;
+    int P_NPoints;
+    int P_Run;
+    int P_Abort;
+    int P_State;
+    int P_Message;
+    int P_Index;
+    int P_Elapsed;
+    int P_MoveTime;
+    int P_PathLength;
+    int P_PathTime;
+    int P_Dwell;
+    int P_Acquire;
+    int P_AcqTimeout;
+    int P_Trigger;
+    int P_FieldIn;
+    int P_NResults;
+    int P_Missed;
+    int P_ResultField;
+    int P_ResultTime;
+
+    int nAxes_;
+    gantryAxis axes_[GANTRY_MAX_AXES];
+    size_t maxPoints_;
+    bool linked_;
+    dbEventCtx eventCtx_;
+    epicsEventId startEvent_;
+    int command_;                       /* P_Move or P_Run */
+    epicsTimeStamp tStart_;
+
+    /* Point list, mm, NaN = axis stays; under the port lock */
+    std::vector<epicsFloat64> points_[GANTRY_MAX_AXES];
+    size_t nPoints_;
+    std::vector<epicsFloat64> dwell_;   /* s per point, the last repeats */
+
+    /* Results of the last run, under the port lock */
+    std::vector<epicsFloat64> resultPos_[GANTRY_MAX_AXES];
+    std::vector<epicsFloat64> resultField_, resultTime_;
+    epicsEventId fieldEvent_;
+    bool fieldWanted_;                  /* a trigger waits for its reading */
+    double fieldValue_;
+    int triggers_;                      /* posted to GANTRY_TRIGGER, never repeats */
+};
+
+#endif /* GANTRY_H */
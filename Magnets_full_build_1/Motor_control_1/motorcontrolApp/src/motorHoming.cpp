@@ -0,0 +1,759 @@
+/* motorHoming.cpp */
+/*
+ * Homing of the stepper axis without leaving the IOC. The sub record
+ * <prefix>RunCalibration starts the sequence and goes active (PACT) until
+ * it ends, so a caput -c or a forward link waits for the result; the
+ * record is in alarm if homing failed or was aborted.
+ *
+ * The switch is found twice: a fast approach stops on it some way past the
+ * trip point, depending on the speed and the latency of the switch input;
+ * the axis then backs off <prefix>homeProbe steps and seeks it again at the
+ * slow velocity, where the overshoot is small and steady. The slow pass is
+ * zeroed. When the axis was already homed, the slow pass finds the switch
+ * where the last homing left it, +-backOff, and the difference is the
+ * repeatability: it is published per homing as <prefix>homeRepeat and as
+ * the rms of the last HOME_REPEAT_SIZE homings in <prefix>homeRepeatRms.
+ *
+ * Every motor move is a put to VAL followed by the DMOV 0 -> 1 transition
+ * seen by a monitor. Phase, message, progress, elapsed time and the time
+ * spent in each phase are written to the <prefix>home* records, and a
+ * put to <prefix>homeAbort stops the motor and ends the sequence.
+ *
+ * State file: a few "key value" lines closed by the CRC-32 of everything
+ * before it, written to <file>.tmp and renamed over the file, so a crash
+ * leaves either the old or the new state. The validity token is cleared
+ * while the motor moves (DMOV 0) and set with RBV when it stops; a file
+ * saved mid-move, or whose position differs from RBV by more than
+ * HOME_POSITION_TOLERANCE at iocInit, is not trusted. The boot record
+ * holds the power-up id of the driver (STEPPER_BOOT_ID of drvStepper); a
+ * new id means the driver counter restarted. It is also checked every
+ * HOME_BOOT_CHECK while the IOC runs, and a change drops the calibration.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <epicsThread.h>
+#include <epicsStdio.h>
+#include <errlog.h>
+#include <initHooks.h>
+#include <iocsh.h>
+#include <registryFunction.h>
+
+#include "motorHoming.h"
+
+#include <epicsExport.h>
+
+static const char *driverName = "motorHoming";
+
+/* Soft limits while the switch is searched, steps */
+#define HOME_OPEN_LIMIT     1e9
+/* RBV at iocInit may differ this much from the saved position, steps */
+#define HOME_POSITION_TOLERANCE 1.0
+/* Period of the boot id check, and how long to wait for it at iocInit, s */
+#define HOME_BOOT_CHECK     1.0
+#define HOME_BOOT_WAIT      5.0
+
+static const char *phaseNames[HOME_N_PHASES] = {
+    "open limits", "fast approach", "clear switch", "slow seek", "zero at switch",
+    "back off", "set limits"
+};
+
+static const char *restoreNames[HOME_N_RESTORE] = {
+    "no state file", "restored", "no valid state", "saved while moving",
+    "driver power cycled", "position mismatch"
+};
+
+static motorHoming *homingList = NULL;
+
+motorHoming::motorHoming(const char *prefix, const char *motor, double seek,
+                         double backOff, double travel, const char *stateFile,
+                         const char *boot, int autoHome)
+    : next_(homingList), seek_(seek), backOff_(fabs(backOff)), travel_(fabs(travel)),
+      autoHome_(autoHome != 0), linked_(false), eventCtx_(0), busy_(false),
+      restorePending_(false), homed_(false), phase_(HOME_IDLE), result_(HOME_IDLE),
+      nRepeat_(0), prec_(NULL)
+{
+    epicsSnprintf(prefix_, sizeof prefix_, "%s", prefix);
+    epicsSnprintf(motor_, sizeof motor_, "%s", motor);
+    epicsSnprintf(stateFile_, sizeof stateFile_, "%s", stateFile ? stateFile : "");
+    epicsSnprintf(boot_, sizeof boot_, "%s", boot ? boot : "");
+    memset(times_, 0, sizeof times_);
+    memset(repeat_, 0, sizeof repeat_);
+    memset(&state_, 0, sizeof state_);
+    lock_ = epicsMutexMustCreate();
+    startEvent_ = epicsEventMustCreate(epicsEventEmpty);
+    homingList = this;
+
+    epicsThreadCreate("motorHoming", epicsThreadPriorityMedium,
+                      epicsThreadGetStackSize(epicsThreadStackMedium),
+                      threadFunc, this);
+}
+
+/* Engine of the sub record <prefix>RunCalibration */
+motorHoming *motorHoming::find(const char *recordName)
+{
+    motorHoming *p;
+
+    for (p = homingList; p; p = p->next_) {
+        size_t n = strlen(p->prefix_);
+        if (strncmp(recordName, p->prefix_, n) == 0 &&
+            strcmp(recordName + n, "RunCalibration") == 0)
+            return p;
+    }
+    return NULL;
+}
+
+long motorHoming::start(subRecord *prec)
+{
+    epicsMutexMustLock(lock_);
+    if (busy_) {
+        epicsMutexUnlock(lock_);
+        return -1;
+    }
+    busy_ = true;
+    mover_.clearAbort();
+    prec_ = prec;
+    epicsMutexUnlock(lock_);
+
+    prec->pact = TRUE;
+    epicsEventSignal(startEvent_);
+    return 0;
+}
+
+/* From the iocInit hook: restore, or home, every axis with a state file */
+void motorHoming::restoreAll()
+{
+    motorHoming *p;
+
+    for (p = homingList; p; p = p->next_) {
+        if (!p->stateFile_[0])
+            continue;
+        epicsMutexMustLock(p->lock_);
+        if (!p->busy_) {
+            p->busy_ = true;
+            p->restorePending_ = true;
+            p->prec_ = NULL;
+        }
+        epicsMutexUnlock(p->lock_);
+        epicsEventSignal(p->startEvent_);
+    }
+}
+
+/* Second pass of the sub record, after the sequence ended */
+long motorHoming::finish(subRecord *prec)
+{
+    int result;
+
+    epicsMutexMustLock(lock_);
+    result = result_;
+    epicsMutexUnlock(lock_);
+    prec->val = result;
+    return result == HOME_DONE ? 0 : -1;
+}
+
+static long linkTo(motorLink &link, const char *record, const char *suffix, const char *field)
+{
+    char name[MOTOR_LINK_NAME_SIZE];
+
+    epicsSnprintf(name, sizeof name, "%s%s", record, suffix);
+    if (link.connect(name, field)) {
+        errlogPrintf("%s: cannot link to %s%s%s\n", driverName, name,
+                     field[0] ? "." : "", field);
+        return -1;
+    }
+    return 0;
+}
+
+/* On the first run, when the database is up */
+long motorHoming::connectLinks()
+{
+    long status = 0;
+
+    status |= linkTo(val_, motor_, "", "VAL");
+    status |= linkTo(set_, motor_, "", "SET");
+    status |= linkTo(hls_, motor_, "", "HLS");
+    status |= linkTo(lls_, motor_, "", "LLS");
+    status |= linkTo(llm_, motor_, "", "LLM");
+    status |= linkTo(hlm_, motor_, "", "HLM");
+    status |= linkTo(dmov_, motor_, "", "DMOV");
+    if (boot_[0])
+        status |= linkTo(bootIn_, boot_, "", "");
+    status |= linkTo(phaseOut_, prefix_, "homePhase", "");
+    status |= linkTo(messageOut_, prefix_, "homeMessage", "");
+    status |= linkTo(elapsedOut_, prefix_, "homeElapsed", "");
+    status |= linkTo(timesOut_, prefix_, "homePhaseTime", "");
+    status |= linkTo(progressOut_, prefix_, "homeProgress", "");
+    status |= linkTo(abortIn_, prefix_, "homeAbort", "");
+    status |= linkTo(restoreOut_, prefix_, "homeRestore", "");
+    status |= linkTo(fastIn_, prefix_, "homeFastVelo", "");
+    status |= linkTo(slowIn_, prefix_, "homeSlowVelo", "");
+    status |= linkTo(probeIn_, prefix_, "homeProbe", "");
+    status |= linkTo(repeatOut_, prefix_, "homeRepeat", "");
+    status |= linkTo(repeatRmsOut_, prefix_, "homeRepeatRms", "");
+    status |= linkTo(repeatCountOut_, prefix_, "homeRepeatCount", "");
+    if (status)
+        return -1;
+
+    eventCtx_ = db_init_events();
+    if (!eventCtx_ ||
+        db_start_events(eventCtx_, "motorHomingEvent", NULL, NULL, epicsThreadPriorityMedium))
+        return -1;
+    if (mover_.connect(eventCtx_, motor_) ||
+        abortIn_.monitor(eventCtx_, abortCallback, this) ||
+        dmov_.monitor(eventCtx_, dmovCallback, this))
+        return -1;
+    linked_ = true;
+    return 0;
+}
+
+void motorHoming::abortCallback(void *arg, double value, const epicsTimeStamp *stamp)
+{
+    motorHoming *pHoming = (motorHoming *)arg;
+    bool busy;
+
+    if (value == 0.0)
+        return;
+    epicsMutexMustLock(pHoming->lock_);
+    busy = pHoming->busy_;
+    epicsMutexUnlock(pHoming->lock_);
+    if (busy)
+        pHoming->mover_.abort();
+}
+
+void motorHoming::threadFunc(void *arg)
+{
+    ((motorHoming *)arg)->run();
+}
+
+void motorHoming::run()
+{
+    subRecord *prec;
+    bool restoring;
+    int result;
+
+    for (;;) {
+        if (epicsEventWaitWithTimeout(startEvent_, HOME_BOOT_CHECK) != epicsEventOK) {
+            checkBoot();
+            continue;
+        }
+        epicsMutexMustLock(lock_);
+        restoring = restorePending_;
+        restorePending_ = false;
+        epicsMutexUnlock(lock_);
+
+        if (!linked_ && connectLinks()) {
+            errlogPrintf("%s: %s: links not available, homing not started\n",
+                         driverName, prefix_);
+            result = HOME_FAILED;
+        } else if (restoring && restore() == HOME_RESTORE_OK) {
+            result = HOME_DONE;
+        } else if (restoring && !autoHome_) {
+            result = HOME_IDLE;
+        } else {
+            result = sequence();
+        }
+
+        epicsMutexMustLock(lock_);
+        result_ = result;
+        busy_ = false;
+        prec = prec_;
+        prec_ = NULL;
+        epicsMutexUnlock(lock_);
+        if (prec)
+            callbackRequestProcessCallback(&callback_, priorityLow, prec);
+    }
+}
+
+void motorHoming::publishTimes()
+{
+    epicsTimeStamp now;
+
+    epicsTimeGetCurrent(&now);
+    if (phase_ >= HOME_OPEN_LIMITS && phase_ <= HOME_SET_LIMITS)
+        times_[phase_ - HOME_OPEN_LIMITS] = epicsTimeDiffInSeconds(&now, &tPhase_);
+    timesOut_.put(times_, HOME_N_PHASES);
+    elapsedOut_.put(epicsTimeDiffInSeconds(&now, &tStart_));
+}
+
+void motorHoming::setPhase(int phase, const char *message)
+{
+    publishTimes();
+    epicsTimeGetCurrent(&tPhase_);
+    phase_ = phase;
+    phaseOut_.put((double)phase);
+    messageOut_.put(message);
+    if (phase <= HOME_DONE)
+        progressOut_.put(100.0 * (phase - HOME_OPEN_LIMITS) / HOME_N_PHASES);
+}
+
+void motorHoming::fail(const char *message)
+{
+    errlogPrintf("%s: %s: %s\n", driverName, prefix_, message);
+    messageOut_.put(message);
+}
+
+void motorHoming::tickCallback(void *arg)
+{
+    ((motorHoming *)arg)->publishTimes();
+}
+
+/* 0 when the move ended, HOME_FAILED or HOME_ABORTED otherwise */
+int motorHoming::moveTo(double target)
+{
+    int result = mover_.moveTo(target, tickCallback, this);
+
+    if (result == MOVER_DONE)
+        return 0;
+    fail(motorMover::resultName(result));
+    return result == MOVER_ABORTED ? HOME_ABORTED : HOME_FAILED;
+}
+
+/* Runs towards target at velocity until it stops, which must be on the switch */
+int motorHoming::seekSwitch(double velocity, double target)
+{
+    double onSwitch = 0.0;
+    int status;
+
+    if (mover_.setVelocity(velocity)) {
+        fail("cannot set velocity");
+        return HOME_FAILED;
+    }
+    if ((status = moveTo(target)) != 0)
+        return status;
+    (seek_ > 0.0 ? hls_ : lls_).get(&onSwitch);
+    if (onSwitch == 0.0) {
+        fail("limit switch not reached");
+        return HOME_FAILED;
+    }
+    return 0;
+}
+
+/* Deviation of the slow pass from where the last homing put the switch */
+void motorHoming::publishRepeat(double deviation)
+{
+    double sum = 0.0;
+    int i, n;
+
+    repeat_[nRepeat_ % HOME_REPEAT_SIZE] = deviation;
+    nRepeat_++;
+    n = nRepeat_ < HOME_REPEAT_SIZE ? nRepeat_ : HOME_REPEAT_SIZE;
+    for (i = 0; i < n; i++)
+        sum += repeat_[i] * repeat_[i];
+    repeatOut_.put(deviation);
+    repeatRmsOut_.put(sqrt(sum / n));
+    repeatCountOut_.put((double)nRepeat_);
+}
+
+/* Redefine the current position as 0 */
+int motorHoming::setZero()
+{
+    if (set_.put(1.0) || val_.put(0.0) || set_.put(0.0)) {
+        fail("cannot set position");
+        return HOME_FAILED;
+    }
+    return 0;
+}
+
+int motorHoming::sequence()
+{
+    double dir = seek_ > 0.0 ? 1.0 : -1.0;
+    double velo = 0.0, fast = 0.0, slow = 0.0, probe = 0.0;
+    double onSwitch = 0.0, offset = 0.0, position = 0.0;
+    bool wasHomed, veloSaved;
+    int status, i;
+
+    epicsMutexMustLock(lock_);
+    wasHomed = homed_;
+    homed_ = false;
+    if (state_.valid) {
+        state_.valid = 0;
+        saveState();
+    }
+    epicsMutexUnlock(lock_);
+
+    epicsTimeGetCurrent(&tStart_);
+    tPhase_ = tStart_;
+    phase_ = HOME_IDLE;
+    memset(times_, 0, sizeof times_);
+
+    veloSaved = mover_.velocity(&velo) == 0;
+    fastIn_.get(&fast);
+    slowIn_.get(&slow);
+    probeIn_.get(&probe);
+    if (!(fast > 0.0))
+        fast = velo;
+    if (!(slow > 0.0))
+        slow = velo;
+    probe = fabs(probe) > 0.0 ? fabs(probe) : backOff_;
+
+    setPhase(HOME_OPEN_LIMITS, "opening soft limits");
+    if (llm_.put(-HOME_OPEN_LIMIT) || hlm_.put(HOME_OPEN_LIMIT)) {
+        fail("cannot write limits");
+        status = HOME_FAILED;
+        goto end;
+    }
+
+    setPhase(HOME_APPROACH, "fast approach to switch");
+    if ((status = seekSwitch(fast, seek_)) != 0)
+        goto end;
+
+    setPhase(HOME_CLEAR, "clearing switch");
+    mover_.position(&position);
+    if ((status = moveTo(position - dir * probe)) != 0)
+        goto end;
+    (seek_ > 0.0 ? hls_ : lls_).get(&onSwitch);
+    if (onSwitch != 0.0) {
+        fail("switch still active, raise homeProbe");
+        status = HOME_FAILED;
+        goto end;
+    }
+
+    /* Up to probe past the first stop */
+    setPhase(HOME_SLOW_SEEK, "slow seek to switch");
+    if ((status = seekSwitch(slow, position + dir * probe)) != 0)
+        goto end;
+
+    setPhase(HOME_ZERO, "zeroing at switch");
+    mover_.position(&offset);
+    if (wasHomed)
+        publishRepeat(offset - dir * backOff_);
+    if ((status = setZero()) != 0)
+        goto end;
+
+    setPhase(HOME_BACK_OFF, "backing off switch");
+    if (mover_.setVelocity(fast)) {
+        fail("cannot set velocity");
+        status = HOME_FAILED;
+        goto end;
+    }
+    if ((status = moveTo(-dir * backOff_)) != 0)
+        goto end;
+
+    setPhase(HOME_SET_LIMITS, "setting travel limits");
+    if ((status = setZero()) != 0)
+        goto end;
+    if (llm_.put(seek_ > 0.0 ? -travel_ : 0.0) || hlm_.put(seek_ > 0.0 ? 0.0 : travel_)) {
+        fail("cannot write limits");
+        status = HOME_FAILED;
+        goto end;
+    }
+    status = HOME_DONE;
+
+    epicsMutexMustLock(lock_);
+    homed_ = true;
+    if (stateFile_[0]) {
+        epicsSnprintf(state_.motor, sizeof state_.motor, "%s", motor_);
+        state_.boot[0] = '\0';
+        if (bootIn_.connected())
+            bootIn_.get(state_.boot, sizeof state_.boot);
+        mover_.position(&position);
+        state_.offset = offset;
+        state_.llm = seek_ > 0.0 ? -travel_ : 0.0;
+        state_.hlm = seek_ > 0.0 ? 0.0 : travel_;
+        state_.position = position;
+        state_.valid = 1;
+        saveState();
+    }
+    epicsMutexUnlock(lock_);
+
+end:
+    if (veloSaved)
+        mover_.setVelocity(velo);
+    publishTimes();
+    phase_ = status;
+    phaseOut_.put((double)status);
+    if (status == HOME_DONE) {
+        progressOut_.put(100.0);
+        messageOut_.put("homed");
+    }
+    for (i = 0; i < HOME_N_PHASES; i++)
+        errlogPrintf("%s: %s: %-15s %7.3f s\n", driverName, prefix_, phaseNames[i], times_[i]);
+    return status;
+}
+
+static epicsUInt32 crc32(const char *data, size_t n)
+{
+    epicsUInt32 crc = 0xFFFFFFFFu;
+    size_t i;
+    int bit;
+
+    for (i = 0; i < n; i++) {
+        crc ^= (unsigned char)data[i];
+        for (bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+    }
+    return ~crc;
+}
+
+/* state_ to the state file, with lock_ held */
+void motorHoming::saveState()
+{
+    char text[512], tmpName[sizeof stateFile_ + 4];
+    FILE *fp;
+    int n;
+
+    if (!stateFile_[0])
+        return;
+    n = epicsSnprintf(text, sizeof text,
+                      "# motorHoming state of %s\n"
+                      "motor %s\nboot %s\noffset %.17g\nllm %.17g\nhlm %.17g\n"
+                      "position %.17g\nvalid %d\n",
+                      prefix_, state_.motor, state_.boot[0] ? state_.boot : "-",
+                      state_.offset, state_.llm, state_.hlm, state_.position, state_.valid);
+    if (n < 0 || n >= (int)sizeof text)
+        return;
+    epicsSnprintf(tmpName, sizeof tmpName, "%s.tmp", stateFile_);
+    fp = fopen(tmpName, "w");
+    if (!fp) {
+        fail("cannot write state file");
+        return;
+    }
+    fprintf(fp, "%scrc %08X\n", text, (unsigned)crc32(text, n));
+    if (fclose(fp) != 0 || rename(tmpName, stateFile_) != 0)
+        fail("cannot write state file");
+}
+
+/* The state file, if intact and of this motor */
+long motorHoming::readState(homingState *state)
+{
+    char text[512], line[160], *p, *end, key[16];
+    unsigned crc;
+    size_t n;
+    FILE *fp;
+
+    fp = fopen(stateFile_, "r");
+    if (!fp)
+        return -1;
+    n = fread(text, 1, sizeof text - 1, fp);
+    fclose(fp);
+    text[n] = '\0';
+
+    p = strstr(text, "\ncrc ");
+    if (!p || sscanf(p + 5, "%x", &crc) != 1 || crc != crc32(text, p + 1 - text))
+        return -1;
+    p[1] = '\0';
+
+    memset(state, 0, sizeof *state);
+    state->valid = -1;
+    for (p = text; *p; p = end) {
+        end = strchr(p, '\n');
+        end = end ? end + 1 : p + strlen(p);
+        n = end - p < (long)sizeof line ? end - p : sizeof line - 1;
+        memcpy(line, p, n);
+        line[n] = '\0';
+        if (sscanf(line, "%15s", key) != 1 || key[0] == '#')
+            continue;
+        if (strcmp(key, "motor") == 0)
+            sscanf(line, "%*s %79s", state->motor);
+        else if (strcmp(key, "boot") == 0)
+            sscanf(line, "%*s %39s", state->boot);
+        else if (strcmp(key, "offset") == 0)
+            sscanf(line, "%*s %lf", &state->offset);
+        else if (strcmp(key, "llm") == 0)
+            sscanf(line, "%*s %lf", &state->llm);
+        else if (strcmp(key, "hlm") == 0)
+            sscanf(line, "%*s %lf", &state->hlm);
+        else if (strcmp(key, "position") == 0)
+            sscanf(line, "%*s %lf", &state->position);
+        else if (strcmp(key, "valid") == 0)
+            sscanf(line, "%*s %d", &state->valid);
+    }
+    if (strcmp(state->boot, "-") == 0)
+        state->boot[0] = '\0';
+    if (strcmp(state->motor, motor_) != 0 || state->valid < 0)
+        return -1;
+    return 0;
+}
+
+/* At iocInit: the saved calibration, if it still holds */
+int motorHoming::restore()
+{
+    homingState saved;
+    char boot[sizeof saved.boot], message[MOTOR_LINK_NAME_SIZE];
+    double rbv = 0.0, waited;
+    int outcome;
+
+    boot[0] = '\0';
+    for (waited = 0.0; bootIn_.connected() && waited < HOME_BOOT_WAIT; waited += 0.1) {
+        if (bootIn_.get(boot, sizeof boot) == 0 && boot[0])
+            break;
+        epicsThreadSleep(0.1);
+    }
+    mover_.position(&rbv);
+
+    if (readState(&saved))
+        outcome = HOME_RESTORE_NO_STATE;
+    else if (!saved.valid)
+        outcome = HOME_RESTORE_MOVING;
+    else if (bootIn_.connected() && strcmp(boot, saved.boot) != 0)
+        outcome = HOME_RESTORE_POWER;
+    else if (fabs(rbv - saved.position) > HOME_POSITION_TOLERANCE)
+        outcome = HOME_RESTORE_MISMATCH;
+    else if (llm_.put(saved.llm) || hlm_.put(saved.hlm))
+        outcome = HOME_RESTORE_NO_STATE;
+    else
+        outcome = HOME_RESTORE_OK;
+    restoreOut_.put((double)outcome);
+
+    if (outcome == HOME_RESTORE_OK) {
+        epicsMutexMustLock(lock_);
+        state_ = saved;
+        homed_ = true;
+        epicsMutexUnlock(lock_);
+        phase_ = HOME_DONE;
+        phaseOut_.put((double)HOME_DONE);
+        progressOut_.put(100.0);
+        messageOut_.put("homing restored");
+        errlogPrintf("%s: %s: restored from %s, limits %g..%g, at %g\n", driverName,
+                     prefix_, stateFile_, saved.llm, saved.hlm, rbv);
+        return outcome;
+    }
+    epicsSnprintf(message, sizeof message, "%s, %s", restoreNames[outcome],
+                  autoHome_ ? "homing" : "homing needed");
+    fail(message);
+    return outcome;
+}
+
+/* A new boot id while homed: the driver lost the calibrated position */
+void motorHoming::checkBoot()
+{
+    char boot[sizeof state_.boot];
+    bool lost = false;
+
+    if (!linked_ || !bootIn_.connected() || bootIn_.get(boot, sizeof boot) || !boot[0])
+        return;
+    epicsMutexMustLock(lock_);
+    if (homed_ && !busy_ && strcmp(boot, state_.boot) != 0) {
+        homed_ = false;
+        state_.valid = 0;
+        saveState();
+        lost = true;
+    }
+    epicsMutexUnlock(lock_);
+    if (!lost)
+        return;
+    restoreOut_.put((double)HOME_RESTORE_POWER);
+    phase_ = HOME_IDLE;
+    phaseOut_.put((double)HOME_IDLE);
+    progressOut_.put(0.0);
+    fail("driver power cycled, homing needed");
+}
+
+/* Validity token: cleared when a move starts, set with RBV when it ends */
+void motorHoming::dmovCallback(void *arg, double value, const epicsTimeStamp *stamp)
+{
+    motorHoming *pHoming = (motorHoming *)arg;
+    double rbv;
+
+    epicsMutexMustLock(pHoming->lock_);
+    if (pHoming->homed_ && !pHoming->busy_) {
+        if (value == 0.0 && pHoming->state_.valid) {
+            pHoming->state_.valid = 0;
+            pHoming->saveState();
+        } else if (value != 0.0 && pHoming->mover_.position(&rbv) == 0 &&
+                   (!pHoming->state_.valid || rbv != pHoming->state_.position)) {
+            pHoming->state_.position = rbv;
+            pHoming->state_.valid = 1;
+            pHoming->saveState();
+        }
+    }
+    epicsMutexUnlock(pHoming->lock_);
+}
+
+/* Sub record routines of <prefix>RunCalibration */
+
+extern "C" {
+
+static void motorHomingInitHook(initHookState state)
+{
+    if (state == initHookAfterIocRunning)
+        motorHoming::restoreAll();
+}
+
+static long initCalibrate(subRecord *prec)
+{
+    prec->dpvt = motorHoming::find(prec->name);
+    if (!prec->dpvt)
+        errlogPrintf("%s: %s: no motorHomingConfigure for this record\n",
+                     driverName, prec->name);
+    return 0;
+}
+
+static long runCalibrate(subRecord *prec)
+{
+    motorHoming *pHoming = (motorHoming *)prec->dpvt;
+
+    if (!pHoming)
+        return -1;
+    if (prec->pact)
+        return pHoming->finish(prec);
+    return pHoming->start(prec);
+}
+
+epicsRegisterFunction(initCalibrate);
+epicsRegisterFunction(runCalibrate);
+
+/* Configuration routine. Called directly, or from the iocsh function below */
+
+/*
+ * prefix   prefix of RunCalibration and the home* records, e.g. GR1:Ax1:
+ * motor    motor record
+ * seek     target that runs onto the switch, steps; the sign picks the switch
+ * backOff  distance from the switch to the new zero, steps
+ * travel   travel from zero, steps
+ * stateFile file keeping the calibration across restarts, empty for none
+ * boot     record with the power-up id of the driver, empty if it has none
+ * autoHome 1 to home at iocInit when the calibration cannot be restored
+ */
+int motorHomingConfigure(const char *prefix, const char *motor, double seek,
+                         double backOff, double travel, const char *stateFile,
+                         const char *boot, int autoHome)
+{
+    static bool hooked = false;
+
+    if (!prefix || !motor) {
+        errlogPrintf("Usage: motorHomingConfigure prefix motor seek backOff travel "
+                     "[stateFile boot autoHome]\n");
+        return -1;
+    }
+    new motorHoming(prefix, motor, seek != 0.0 ? seek : 10000.0,
+                    backOff != 0.0 ? backOff : 400.0, travel != 0.0 ? travel : 4000.0,
+                    stateFile, boot, autoHome);
+    if (!hooked) {
+        initHookRegister(motorHomingInitHook);
+        hooked = true;
+    }
+    return 0;
+}
+
+/* EPICS iocsh shell commands */
+
+static const iocshArg initArg0 = { "prefix",  iocshArgString };
+static const iocshArg initArg1 = { "motor",   iocshArgString };
+static const iocshArg initArg2 = { "seek",    iocshArgDouble };
+static const iocshArg initArg3 = { "backOff", iocshArgDouble };
+static const iocshArg initArg4 = { "travel",  iocshArgDouble };
+static const iocshArg initArg5 = { "stateFile", iocshArgString };
+static const iocshArg initArg6 = { "boot",    iocshArgString };
+static const iocshArg initArg7 = { "autoHome", iocshArgInt };
+static const iocshArg * const initArgs[] = { &initArg0, &initArg1, &initArg2, &initArg3,
+                                             &initArg4, &initArg5, &initArg6, &initArg7 };
+static const iocshFuncDef initFuncDef = { "motorHomingConfigure", 8, initArgs };
+
+static void initCallFunc(const iocshArgBuf *args)
+{
+    motorHomingConfigure(args[0].sval, args[1].sval, args[2].dval, args[3].dval,
+                         args[4].dval, args[5].sval, args[6].sval, args[7].ival);
+}
+
+static void motorHomingRegister(void)
+{
+    iocshRegister(&initFuncDef, initCallFunc);
+}
+
+epicsExportRegistrar(motorHomingRegister);
+
+}
@@ -0,0 +1,127 @@
+/* motorHoming.h */
+
+#ifndef MOTORHOMING_H
+#define MOTORHOMING_H
+
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+#include <callback.h>
+#include <dbEvent.h>
+#include <subRecord.h>
+
+#include "motorLink.h"
+#include "motorMover.h"
+
+/* Phases, as published in <prefix>homePhase */
+#define HOME_IDLE               0
+#define HOME_OPEN_LIMITS        1
+#define HOME_APPROACH           2
+#define HOME_CLEAR              3
+#define HOME_SLOW_SEEK          4
+#define HOME_ZERO               5
+#define HOME_BACK_OFF           6
+#define HOME_SET_LIMITS         7
+#define HOME_DONE               8
+#define HOME_FAILED             9
+#define HOME_ABORTED            10
+#define HOME_N_PHASES           7
+
+/* Switch positions kept for the repeatability */
+#define HOME_REPEAT_SIZE        20
+
+/* Outcome of the restore at iocInit, as published in <prefix>homeRestore */
+#define HOME_RESTORE_NONE       0       /* no state file configured */
+#define HOME_RESTORE_OK         1
+#define HOME_RESTORE_NO_STATE   2       /* missing, for another motor or failed the CRC */
+#define HOME_RESTORE_MOVING     3       /* saved while the motor moved */
+#define HOME_RESTORE_POWER      4       /* the driver was power cycled */
+#define HOME_RESTORE_MISMATCH   5       /* position differs from the saved one */
+#define HOME_N_RESTORE          6
+
+/* Calibration kept in the state file */
+struct homingState {
+    char motor[MOTOR_LINK_NAME_SIZE];
+    char boot[40];          /* boot id of the driver when homed */
+    double offset;          /* switch position before zeroing, steps */
+    double llm, hlm;        /* travel limits */
+    double position;        /* RBV when the last move ended */
+    int valid;              /* 0 while a move runs: position is not known */
+};
+
+/*
+ * Homing of one motor record: open the soft limits, run onto the limit
+ * switch at <prefix>homeFastVelo, clear it by <prefix>homeProbe, seek it
+ * again at <prefix>homeSlowVelo, zero there, back off, zero again and set
+ * the travel limits. Only the slow pass sets the zero, so the approach
+ * can be fast without hurting repeatability. It runs in its own thread
+ * and is paced by monitors on DMOV, so it takes as long as the motion.
+ * The sub record <prefix>RunCalibration starts it and completes
+ * asynchronously when it ends.
+ *
+ * With a state file the calibration survives IOC restarts: it is saved
+ * when homing ends and at the start and end of every move, and restored
+ * at iocInit unless the driver was power cycled since or the motor is not
+ * where it was left, in which case the axis is homed again.
+ */
+class motorHoming {
+public:
+    motorHoming(const char *prefix, const char *motor, double seek, double backOff,
+                double travel, const char *stateFile, const char *boot, int autoHome);
+
+    static motorHoming *find(const char *recordName);
+    static void restoreAll();
+    long start(subRecord *prec);
+    long finish(subRecord *prec);
+
+private:
+    static void threadFunc(void *arg);
+    static void abortCallback(void *arg, double value, const epicsTimeStamp *stamp);
+    static void tickCallback(void *arg);
+    static void dmovCallback(void *arg, double value, const epicsTimeStamp *stamp);
+    void run();
+    long connectLinks();
+    int sequence();
+    int moveTo(double target);
+    int seekSwitch(double velocity, double target);
+    void publishRepeat(double deviation);
+    int setZero();
+    void setPhase(int phase, const char *message);
+    void publishTimes();
+    void fail(const char *message);
+    int restore();
+    void checkBoot();
+    void saveState();
+    long readState(homingState *state);
+
+    motorHoming *next_;
+    char prefix_[MOTOR_LINK_NAME_SIZE];
+    char motor_[MOTOR_LINK_NAME_SIZE];
+    double seek_, backOff_, travel_;
+    char stateFile_[256];
+    char boot_[MOTOR_LINK_NAME_SIZE];
+    bool autoHome_;
+
+    motorLink val_, set_, hls_, lls_, llm_, hlm_, dmov_, bootIn_;
+    motorLink phaseOut_, messageOut_, elapsedOut_, timesOut_, progressOut_, abortIn_;
+    motorLink restoreOut_, fastIn_, slowIn_, probeIn_;
+    motorLink repeatOut_, repeatRmsOut_, repeatCountOut_;
+    motorMover mover_;
+    bool linked_;
+    dbEventCtx eventCtx_;
+
+    epicsMutexId lock_;
+    epicsEventId startEvent_;
+    bool busy_, restorePending_;
+    bool homed_;                /* state_ describes the current position */
+    homingState state_;         /* as last saved, under lock_ */
+    int phase_, result_;
+    epicsTimeStamp tStart_, tPhase_;
+    double times_[HOME_N_PHASES];
+    double repeat_[HOME_REPEAT_SIZE];   /* switch deviations, ring */
+    int nRepeat_;
+    subRecord *prec_;
+    epicsCallback callback_;
+};
+
+#endif /* MOTORHOMING_H */
@@ -0,0 +1,129 @@
+/* motorLink.cpp */
+
+#include <string.h>
+
+#include <epicsStdio.h>
+#include <dbAccess.h>
+#include <dbChannel.h>
+#include <dbEvent.h>
+
+#include "motorLink.h"
+
+motorLink::motorLink()
+    : chan_(0), sub_(0), callback_(0), arg_(0)
+{
+    name_[0] = '\0';
+}
+
+motorLink::~motorLink()
+{
+    if (sub_)
+        db_cancel_event(sub_);
+    if (chan_)
+        dbChannelDelete(chan_);
+}
+
+/* record.field, field may be empty for VAL */
+long motorLink::connect(const char *record, const char *field)
+{
+    dbChannel *chan;
+
+    epicsSnprintf(name_, sizeof name_, field && field[0] ? "%s.%s" : "%s", record, field);
+    chan = dbChannelCreate(name_);
+    if (!chan)
+        return -1;
+    if (dbChannelOpen(chan)) {
+        dbChannelDelete(chan);
+        return -1;
+    }
+    chan_ = chan;
+    return 0;
+}
+
+long motorLink::put(double value)
+{
+    if (!chan_)
+        return -1;
+    return dbChannelPutField(chan_, DBR_DOUBLE, &value, 1);
+}
+
+long motorLink::put(const char *value)
+{
+    char buffer[40];
+
+    if (!chan_)
+        return -1;
+    strncpy(buffer, value, sizeof buffer - 1);
+    buffer[sizeof buffer - 1] = '\0';
+    return dbChannelPutField(chan_, DBR_STRING, buffer, 1);
+}
+
+long motorLink::put(const double *values, long n)
+{
+    if (!chan_)
+        return -1;
+    return dbChannelPutField(chan_, DBR_DOUBLE, values, n);
+}
+
+long motorLink::get(double *value)
+{
+    long status;
+
+    if (!chan_)
+        return -1;
+    dbScanLock(dbChannelRecord(chan_));
+    status = dbChannelGet(chan_, DBR_DOUBLE, value, NULL, NULL, NULL);
+    dbScanUnlock(dbChannelRecord(chan_));
+    return status;
+}
+
+/* As a string, truncated to size - 1 characters */
+long motorLink::get(char *value, size_t size)
+{
+    char buffer[MAX_STRING_SIZE];
+    long status;
+
+    if (!chan_ || size == 0)
+        return -1;
+    dbScanLock(dbChannelRecord(chan_));
+    status = dbChannelGet(chan_, DBR_STRING, buffer, NULL, NULL, NULL);
+    dbScanUnlock(dbChannelRecord(chan_));
+    if (status)
+        return status;
+    strncpy(value, buffer, size - 1);
+    value[size - 1] = '\0';
+    return 0;
+}
+
+/* The current value is delivered first, then every value change */
+long motorLink::monitor(dbEventCtx ctx, motorLinkCallback callback, void *arg)
+{
+    if (!chan_ || sub_)
+        return -1;
+    callback_ = callback;
+    arg_ = arg;
+    sub_ = db_add_event(ctx, chan_, eventCallback, this, DBE_VALUE);
+    if (!sub_)
+        return -1;
+    db_event_enable(sub_);
+    db_post_single_event(sub_);
+    return 0;
+}
+
+void motorLink::eventCallback(void *arg, struct dbChannel *chan, int eventsRemaining,
+                              struct db_field_log *pfl)
+{
+    motorLink *pLink = (motorLink *)arg;
+    struct {
+        DBRtime
+        epicsFloat64 value;
+    } buffer;
+    long options = DBR_TIME, nRequest = 1;
+    long status;
+
+    dbScanLock(dbChannelRecord(chan));
+    status = dbChannelGet(chan, DBR_DOUBLE, &buffer, &options, &nRequest, pfl);
+    dbScanUnlock(dbChannelRecord(chan));
+    if (status == 0)
+        pLink->callback_(pLink->arg_, buffer.value, &buffer.time);
+}
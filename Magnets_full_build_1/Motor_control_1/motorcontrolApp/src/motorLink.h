@@ -0,0 +1,48 @@
+/* motorLink.h */
+
+#ifndef MOTORLINK_H
+#define MOTORLINK_H
+
+#include <stddef.h>
+
+#include <epicsTime.h>
+#include <dbEvent.h>
+
+#define MOTOR_LINK_NAME_SIZE    80
+
+/* stamp is the time stamp of the record when the value was posted */
+typedef void (*motorLinkCallback)(void *arg, double value, const epicsTimeStamp *stamp);
+
+/*
+ * One field of a record in this IOC, usually of the motor record: puts go
+ * through dbPutField rules (processing the record as a CA put would), and
+ * a monitor delivers every posted value to a callback on the event task.
+ */
+class motorLink {
+public:
+    motorLink();
+    ~motorLink();
+
+    long connect(const char *record, const char *field);
+    bool connected() const { return chan_ != 0; }
+    const char *name() const { return name_; }
+
+    long put(double value);
+    long put(const char *value);
+    long put(const double *values, long n);
+    long get(double *value);
+    long get(char *value, size_t size);
+    long monitor(dbEventCtx ctx, motorLinkCallback callback, void *arg);
+
+private:
+    static void eventCallback(void *arg, struct dbChannel *chan, int eventsRemaining,
+                              struct db_field_log *pfl);
+
+    struct dbChannel *chan_;
+    dbEventSubscription sub_;
+    motorLinkCallback callback_;
+    void *arg_;
+    char name_[MOTOR_LINK_NAME_SIZE];
+};
+
+#endif /* MOTORLINK_H */
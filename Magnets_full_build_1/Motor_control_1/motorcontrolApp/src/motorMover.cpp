@@ -0,0 +1,154 @@
+/* motorMover.cpp */
+
+#include <math.h>
+
+#include <epicsTime.h>
+#include <epicsStdio.h>
+#include <errlog.h>
+
+#include "motorMover.h"
+
+/* Allowance on top of distance/VELO before a move is declared stuck, s */
+#define MOVER_MARGIN        10.0
+/* A put that does not clear DMOV within this time was a null move, s */
+#define MOVER_NULL_MOVE     0.5
+/* Tick period while a move is running, s */
+#define MOVER_TICK          0.2
+
+motorMover::motorMover()
+    : dmovValue_(true), moveSeen_(false), abort_(false), target_(0.0), timeout_(0.0)
+{
+    lock_ = epicsMutexMustCreate();
+    wakeup_ = epicsEventMustCreate(epicsEventEmpty);
+}
+
+/* When the database is up */
+long motorMover::connect(dbEventCtx ctx, const char *motor)
+{
+    if (val_.connect(motor, "VAL") || stop_.connect(motor, "STOP") ||
+        dmov_.connect(motor, "DMOV") || rbv_.connect(motor, "RBV") ||
+        velo_.connect(motor, "VELO") || accl_.connect(motor, "ACCL") ||
+        vbas_.connect(motor, "VBAS") || lvio_.connect(motor, "LVIO") ||
+        llm_.connect(motor, "LLM") || hlm_.connect(motor, "HLM")) {
+        errlogPrintf("motorMover: cannot link to %s\n", motor);
+        return -1;
+    }
+    return dmov_.monitor(ctx, dmovCallback, this);
+}
+
+void motorMover::dmovCallback(void *arg, double value, const epicsTimeStamp *stamp)
+{
+    motorMover *pMover = (motorMover *)arg;
+
+    epicsMutexMustLock(pMover->lock_);
+    pMover->dmovValue_ = value != 0.0;
+    if (value == 0.0)
+        pMover->moveSeen_ = true;
+    epicsMutexUnlock(pMover->lock_);
+    epicsEventSignal(pMover->wakeup_);
+}
+
+void motorMover::abort()
+{
+    epicsMutexMustLock(lock_);
+    abort_ = true;
+    epicsMutexUnlock(lock_);
+    epicsEventSignal(wakeup_);
+}
+
+void motorMover::clearAbort()
+{
+    epicsMutexMustLock(lock_);
+    abort_ = false;
+    epicsMutexUnlock(lock_);
+}
+
+bool motorMover::aborted()
+{
+    bool abort;
+
+    epicsMutexMustLock(lock_);
+    abort = abort_;
+    epicsMutexUnlock(lock_);
+    return abort;
+}
+
+int motorMover::moveTo(double target, motorMoverTick tick, void *arg)
+{
+    int result = start(target);
+
+    return result == MOVER_DONE ? wait(tick, arg) : result;
+}
+
+/* Puts the target, MOVER_DONE once the move is under way */
+int motorMover::start(double target)
+{
+    double rbv = 0.0, velo = 0.0, lvio = 0.0;
+    bool abort;
+
+    rbv_.get(&rbv);
+    velo_.get(&velo);
+    timeout_ = (velo > 0.0 ? fabs(target - rbv) / velo : 0.0) + MOVER_MARGIN;
+    target_ = target;
+
+    epicsMutexMustLock(lock_);
+    moveSeen_ = false;
+    abort = abort_;
+    epicsMutexUnlock(lock_);
+    if (abort)
+        return MOVER_ABORTED;
+    if (val_.put(target))
+        return MOVER_FAILED;
+    /* The put processed the record: a target past the soft limits is refused */
+    if (lvio_.get(&lvio) == 0 && lvio != 0.0)
+        return MOVER_LIMIT;
+    epicsTimeGetCurrent(&t0_);
+    return MOVER_DONE;
+}
+
+/* Until the move started last is done */
+int motorMover::wait(motorMoverTick tick, void *arg)
+{
+    epicsTimeStamp now;
+    double rbv = 0.0, elapsed;
+    bool seen, done, abort;
+
+    for (;;) {
+        epicsMutexMustLock(lock_);
+        seen = moveSeen_;
+        done = dmovValue_;
+        abort = abort_;
+        epicsMutexUnlock(lock_);
+        if (abort) {
+            stop_.put(1.0);
+            return MOVER_ABORTED;
+        }
+        if (seen && done)
+            return MOVER_DONE;
+
+        epicsTimeGetCurrent(&now);
+        elapsed = epicsTimeDiffInSeconds(&now, &t0_);
+        if (!seen && done && elapsed > MOVER_NULL_MOVE &&
+            rbv_.get(&rbv) == 0 && fabs(rbv - target_) < 1.0)
+            return MOVER_DONE;
+        if (elapsed > timeout_) {
+            stop_.put(1.0);
+            return MOVER_TIMEOUT;
+        }
+        epicsEventWaitWithTimeout(wakeup_, MOVER_TICK);
+        if (tick)
+            tick(arg);
+    }
+}
+
+const char *motorMover::resultName(int result)
+{
+    switch (result) {
+    case MOVER_DONE:    return "done";
+    case MOVER_FAILED:  return "cannot write VAL";
+    case MOVER_ABORTED: return "aborted";
+    case MOVER_TIMEOUT: return "move timed out";
+    case MOVER_LIMIT:   return "target outside soft limits";
+    }
+    return "unknown";
+}
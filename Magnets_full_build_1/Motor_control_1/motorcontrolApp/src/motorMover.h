@@ -0,0 +1,63 @@
+/* motorMover.h */
+
+#ifndef MOTORMOVER_H
+#define MOTORMOVER_H
+
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+#include <dbEvent.h>
+
+#include "motorLink.h"
+
+/* moveTo() results */
+#define MOVER_DONE              0
+#define MOVER_FAILED            1
+#define MOVER_ABORTED           2
+#define MOVER_TIMEOUT           3
+#define MOVER_LIMIT             4
+
+/* Called every MOVER_TICK seconds while a move runs */
+typedef void (*motorMoverTick)(void *arg);
+
+/*
+ * Absolute moves of a motor record in this IOC. A move is a put to VAL
+ * followed by the DMOV 0 -> 1 transition seen by a monitor; a put that
+ * does not clear DMOV is a null move once RBV is at the target, and one
+ * the record refuses with LVIO fails at once. start() and wait() split
+ * moveTo() so that several motors can run together.
+ */
+class motorMover {
+public:
+    motorMover();
+
+    long connect(dbEventCtx ctx, const char *motor);
+    int moveTo(double target, motorMoverTick tick = 0, void *arg = 0);
+    int start(double target);
+    int wait(motorMoverTick tick = 0, void *arg = 0);
+    /* Stops the motor; moveTo() returns MOVER_ABORTED until clearAbort() */
+    void abort();
+    void clearAbort();
+    bool aborted();
+    long position(double *rbv) { return rbv_.get(rbv); }
+    long velocity(double *velo) { return velo_.get(velo); }
+    long setVelocity(double velo) { return velo_.put(velo); }
+    long acceleration(double *accl) { return accl_.get(accl); }
+    long setAcceleration(double accl) { return accl_.put(accl); }
+    long baseVelocity(double *vbas) { return vbas_.get(vbas); }
+    long setBaseVelocity(double vbas) { return vbas_.put(vbas); }
+    long limits(double *llm, double *hlm) { return llm_.get(llm) || hlm_.get(hlm) ? -1 : 0; }
+    static const char *resultName(int result);
+
+private:
+    static void dmovCallback(void *arg, double value, const epicsTimeStamp *stamp);
+
+    motorLink val_, stop_, dmov_, rbv_, velo_, accl_, vbas_, lvio_, llm_, hlm_;
+    epicsMutexId lock_;
+    epicsEventId wakeup_;
+    bool dmovValue_, moveSeen_, abort_;
+    double target_, timeout_;
+    epicsTimeStamp t0_;
+};
+
+#endif /* MOTORMOVER_H */
@@ -0,0 +1,67 @@
+/* moveProfile.cpp */
+/*
+ * Rest to rest profiles. The ramp from rest to v at acceleration limit a
+ * and jerk limit j takes
+ *
+ *     v / a                  trapezoid (no jerk limit)
+ *     v / a + a / j          S-curve reaching a, v >= a^2 / j
+ *     2 sqrt(v / j)          S-curve peaking below a
+ *
+ * and covers v t / 2 either way, by symmetry. A move cruises at the
+ * velocity limit between two ramps if it is long enough, otherwise it
+ * peaks at the velocity for which the two ramps cover the distance.
+ */
+
+#include <math.h>
+
+#include "moveProfile.h"
+
+static double rampTime(double velocity, double acceleration, double jerk)
+{
+    if (jerk <= 0.0)
+        return velocity / acceleration;
+    if (velocity * jerk >= acceleration * acceleration)
+        return velocity / acceleration + acceleration / jerk;
+    return 2.0 * sqrt(velocity / jerk);
+}
+
+/* Peak velocity of a move made of two ramps only */
+static double peakVelocity(double distance, double acceleration, double jerk)
+{
+    double a = acceleration, v;
+
+    if (jerk <= 0.0)
+        return sqrt(distance * a);
+    /* distance = v (v / a + a / j) */
+    v = 0.5 * a * (sqrt(a * a / (jerk * jerk) + 4.0 * distance / a) - a / jerk);
+    if (v * jerk >= a * a)
+        return v;
+    /* distance = 2 v sqrt(v / j) */
+    return cbrt(0.25 * distance * distance * jerk);
+}
+
+void moveProfilePlan(moveProfile *profile, double distance, double velocity,
+                     double acceleration, double jerk)
+{
+    double rampDistance;
+
+    profile->distance = fabs(distance);
+    profile->velocity = velocity;
+    profile->acceleration = acceleration;
+    profile->jerk = jerk > 0.0 ? jerk : 0.0;
+    profile->rampTime = 0.0;
+    profile->cruiseTime = 0.0;
+    profile->duration = 0.0;
+    if (profile->distance == 0.0 || velocity <= 0.0 || acceleration <= 0.0)
+        return;
+
+    profile->rampTime = rampTime(velocity, acceleration, profile->jerk);
+    rampDistance = 0.5 * velocity * profile->rampTime;
+    if (2.0 * rampDistance <= profile->distance) {
+        profile->cruiseTime = (profile->distance - 2.0 * rampDistance) / velocity;
+    } else {
+        profile->velocity = peakVelocity(profile->distance, acceleration, profile->jerk);
+        profile->rampTime = rampTime(profile->velocity, acceleration, profile->jerk);
+    }
+    profile->duration = 2.0 * profile->rampTime + profile->cruiseTime;
+}
@@ -0,0 +1,32 @@
+/* moveProfile.h */
+
+#ifndef MOVEPROFILE_H
+#define MOVEPROFILE_H
+
+/* Profile shapes, as in PLAN_MODE */
+#define PROFILE_RECORD          0       /* velocity and acceleration of the motor record */
+#define PROFILE_TRAPEZOID       1
+#define PROFILE_SCURVE          2
+
+/*
+ * Time-optimal point-to-point move from rest to rest within the limits of
+ * the mechanics. Distances in steps, velocities in steps/s, accelerations
+ * in steps/s^2 and jerk in steps/s^3; jerk <= 0 gives a trapezoid, jerk > 0
+ * an S-curve with the acceleration ramped at that rate. Moves too short to
+ * reach the velocity limit peak at the highest velocity they can reach, so
+ * velocity is what the controller should be sent.
+ */
+struct moveProfile {
+    double distance;        /* absolute */
+    double velocity;        /* peak */
+    double acceleration;    /* limit */
+    double jerk;            /* limit, 0 for a trapezoid */
+    double rampTime;        /* from rest to the peak velocity */
+    double cruiseTime;      /* at the peak velocity */
+    double duration;
+};
+
+void moveProfilePlan(moveProfile *profile, double distance, double velocity,
+                     double acceleration, double jerk);
+
+#endif /* MOVEPROFILE_H */
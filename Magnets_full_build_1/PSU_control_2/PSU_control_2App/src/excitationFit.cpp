@@ -0,0 +1,365 @@
+/* excitationFit.cpp */
+/*
+ * Online fit of the excitation curve during current scans.
+ *
+ * FIT_CURRENT is fed from PWRSPL:readI and FIT_FIELD from the gaussmeter
+ * IOC. Every field sample is paired with the latest current, provided that
+ * current is younger than FIT_MAX_AGE and moved less than FIT_SETTLE since
+ * the reading before it (the supply is not ramping).
+ *
+ * The model B = c0 + c1 x + c3 x^3 + c5 x^5, x = I / FIT_ISCALE, is linear
+ * in the coefficients, so only the 4x4 normal equations and the field sums
+ * are kept; each new pair updates them and the system is re-solved by
+ * Cholesky. The fit is checked only when a pair arrives at a new settled
+ * current, so long dwells at one setpoint cannot make it look stable. It is
+ * flagged converged when the fitted curve over |I| <= FIT_ISCALE moves by
+ * less than FIT_TOL for FIT_NSTABLE new currents in a row, and the points
+ * cover at least FIT_MIN_LEVELS distinct currents spread over FIT_MIN_SPAN
+ * of FIT_ISCALE.
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include <epicsTime.h>
+#include <epicsStdio.h>
+#include <errlog.h>
+#include <iocsh.h>
+
+#include "asynDriver.h"
+#include "excitationFit.h"
+
+#include <epicsExport.h>
+
+static const char *driverName = "excitationFit";
+
+/* Points across |x| <= 1 used to compare successive fits */
+#define FIT_NCHECK      21
+
+/* Currents closer than this fraction of FIT_ISCALE count as one level */
+#define FIT_LEVEL_FRAC  0.01
+
+excitationFit::excitationFit(const char *portName, int maxPoints)
+    : asynPortDriver(portName, 1,
+                     asynInt32Mask | asynFloat64Mask | asynFloat64ArrayMask | asynDrvUserMask,
+                     asynInt32Mask | asynFloat64Mask | asynFloat64ArrayMask,
+                     0, 1, 0, 0),
+      lastCurrent_(0.0), prevCurrent_(0.0), lastCurrentTime_(0),
+      maxPoints_(maxPoints > 0 ? maxPoints : 1000)
+{
+    createParam(FIT_ENABLE_STRING,    asynParamInt32,        &P_Enable);
+    createParam(FIT_RESET_STRING,     asynParamInt32,        &P_Reset);
+    createParam(FIT_CURRENT_STRING,   asynParamFloat64,      &P_Current);
+    createParam(FIT_FIELD_STRING,     asynParamFloat64,      &P_Field);
+    createParam(FIT_ISCALE_STRING,    asynParamFloat64,      &P_IScale);
+    createParam(FIT_SETTLE_STRING,    asynParamFloat64,      &P_Settle);
+    createParam(FIT_MAX_AGE_STRING,   asynParamFloat64,      &P_MaxAge);
+    createParam(FIT_TOL_STRING,       asynParamFloat64,      &P_Tol);
+    createParam(FIT_NSTABLE_STRING,   asynParamInt32,        &P_NStable);
+    createParam(FIT_MIN_LEVELS_STRING, asynParamInt32,       &P_MinLevels);
+    createParam(FIT_MIN_SPAN_STRING,  asynParamFloat64,      &P_MinSpan);
+    createParam(FIT_NLEVELS_STRING,   asynParamInt32,        &P_NLevels);
+    createParam(FIT_NPOINTS_STRING,   asynParamInt32,        &P_NPoints);
+    createParam(FIT_C0_STRING,        asynParamFloat64,      &P_Coef[0]);
+    createParam(FIT_C1_STRING,        asynParamFloat64,      &P_Coef[1]);
+    createParam(FIT_C3_STRING,        asynParamFloat64,      &P_Coef[2]);
+    createParam(FIT_C5_STRING,        asynParamFloat64,      &P_Coef[3]);
+    createParam(FIT_RMS_STRING,       asynParamFloat64,      &P_Rms);
+    createParam(FIT_R2_STRING,        asynParamFloat64,      &P_R2);
+    createParam(FIT_RESIDUAL_STRING,  asynParamFloat64,      &P_Residual);
+    createParam(FIT_CHANGE_STRING,    asynParamFloat64,      &P_Change);
+    createParam(FIT_CONVERGED_STRING, asynParamInt32,        &P_Converged);
+    createParam(FIT_POINTS_I_STRING,  asynParamFloat64Array, &P_PointsI);
+    createParam(FIT_POINTS_B_STRING,  asynParamFloat64Array, &P_PointsB);
+
+    setIntegerParam(P_Enable, 0);
+    setDoubleParam(P_IScale, 20.0);     /* PSU full scale, A */
+    setDoubleParam(P_Settle, 0.01);
+    setDoubleParam(P_MaxAge, 2.0);
+    setDoubleParam(P_Tol, 0.5);
+    setIntegerParam(P_NStable, 3);
+    setIntegerParam(P_MinLevels, 6);
+    setDoubleParam(P_MinSpan, 0.5);
+    clear();
+}
+
+void excitationFit::basis(double x, double phi[FIT_NTERMS])
+{
+    double x2 = x * x;
+
+    phi[0] = 1.0;
+    phi[1] = x;
+    phi[2] = x * x2;
+    phi[3] = x * x2 * x2;
+}
+
+double excitationFit::evaluate(const double c[FIT_NTERMS], double x) const
+{
+    double phi[FIT_NTERMS];
+    double b = 0.0;
+    int i;
+
+    basis(x, phi);
+    for (i = 0; i < FIT_NTERMS; i++)
+        b += c[i] * phi[i];
+    return b;
+}
+
+void excitationFit::clear()
+{
+    int i;
+
+    memset(ata_, 0, sizeof ata_);
+    memset(atb_, 0, sizeof atb_);
+    memset(coef_, 0, sizeof coef_);
+    sumB_ = sumB2_ = 0.0;
+    n_ = 0;
+    haveFit_ = false;
+    stableCount_ = 0;
+    haveRef_ = false;
+    levels_.clear();
+    levelMin_ = levelMax_ = 0.0;
+    pointsI_.clear();
+    pointsB_.clear();
+
+    setIntegerParam(P_NPoints, 0);
+    setIntegerParam(P_NLevels, 0);
+    for (i = 0; i < FIT_NTERMS; i++)
+        setDoubleParam(P_Coef[i], 0.0);
+    setDoubleParam(P_Rms, 0.0);
+    setDoubleParam(P_R2, 0.0);
+    setDoubleParam(P_Residual, 0.0);
+    setDoubleParam(P_Change, 0.0);
+    setIntegerParam(P_Converged, 0);
+}
+
+/*
+ * Cholesky solve of the normal equations. A tiny ridge keeps the factor
+ * defined while the points still span less than the full model.
+ */
+bool excitationFit::solve(double c[FIT_NTERMS]) const
+{
+    double l[FIT_NTERMS][FIT_NTERMS];
+    double y[FIT_NTERMS];
+    double ridge = 0.0;
+    int i, j, k;
+
+    if (n_ < FIT_NTERMS)
+        return false;
+    for (i = 0; i < FIT_NTERMS; i++)
+        ridge += ata_[i][i];
+    ridge *= 1e-12;
+
+    for (i = 0; i < FIT_NTERMS; i++) {
+        for (j = 0; j <= i; j++) {
+            double s = ata_[i][j] + (i == j ? ridge : 0.0);
+            for (k = 0; k < j; k++)
+                s -= l[i][k] * l[j][k];
+            if (i == j) {
+                if (s <= 0.0)
+                    return false;
+                l[i][i] = sqrt(s);
+            } else {
+                l[i][j] = s / l[j][j];
+            }
+        }
+    }
+    for (i = 0; i < FIT_NTERMS; i++) {
+        double s = atb_[i];
+        for (k = 0; k < i; k++)
+            s -= l[i][k] * y[k];
+        y[i] = s / l[i][i];
+    }
+    for (i = FIT_NTERMS - 1; i >= 0; i--) {
+        double s = y[i];
+        for (k = i + 1; k < FIT_NTERMS; k++)
+            s -= l[k][i] * c[k];
+        c[i] = s / l[i][i];
+    }
+    return true;
+}
+
+/*
+ * Record the current as a new level unless a known one is within
+ * FIT_LEVEL_FRAC of FIT_ISCALE. Returns true for a new level.
+ */
+bool excitationFit::newLevel(double current, double iScale)
+{
+    size_t k;
+
+    for (k = 0; k < levels_.size(); k++) {
+        if (fabs(current - levels_[k]) <= FIT_LEVEL_FRAC * iScale)
+            return false;
+    }
+    if (levels_.empty())
+        levelMin_ = levelMax_ = current;
+    levels_.push_back(current);
+    levelMin_ = fmin(levelMin_, current);
+    levelMax_ = fmax(levelMax_, current);
+    setIntegerParam(P_NLevels, (int)levels_.size());
+    return true;
+}
+
+void excitationFit::addPoint(double current, double field)
+{
+    double iScale, tol, minSpan, phi[FIT_NTERMS], c[FIT_NTERMS];
+    int nStable, minLevels, i, j;
+    bool isNew;
+
+    getDoubleParam(P_IScale, &iScale);
+    getDoubleParam(P_Tol, &tol);
+    getIntegerParam(P_NStable, &nStable);
+    getIntegerParam(P_MinLevels, &minLevels);
+    getDoubleParam(P_MinSpan, &minSpan);
+
+    isNew = newLevel(current, iScale);
+
+    basis(current / iScale, phi);
+    if (haveFit_)
+        setDoubleParam(P_Residual, field - evaluate(coef_, current / iScale));
+
+    for (i = 0; i < FIT_NTERMS; i++) {
+        for (j = 0; j < FIT_NTERMS; j++)
+            ata_[i][j] += phi[i] * phi[j];
+        atb_[i] += phi[i] * field;
+    }
+    sumB_ += field;
+    sumB2_ += field * field;
+    n_++;
+    setIntegerParam(P_NPoints, n_);
+
+    if (pointsI_.size() < maxPoints_) {
+        pointsI_.push_back(current);
+        pointsB_.push_back(field);
+        doCallbacksFloat64Array(&pointsI_[0], pointsI_.size(), P_PointsI, 0);
+        doCallbacksFloat64Array(&pointsB_[0], pointsB_.size(), P_PointsB, 0);
+    }
+
+    if (!solve(c))
+        return;
+
+    /* Repeated samples at one current only refine the fit there */
+    if (isNew) {
+        if (haveRef_) {
+            double change = 0.0;
+            for (i = 0; i < FIT_NCHECK; i++) {
+                double x = -1.0 + 2.0 * i / (FIT_NCHECK - 1);
+                change = fmax(change, fabs(evaluate(c, x) - evaluate(refCoef_, x)));
+            }
+            setDoubleParam(P_Change, change);
+            stableCount_ = change < tol ? stableCount_ + 1 : 0;
+        }
+        memcpy(refCoef_, c, sizeof refCoef_);
+        haveRef_ = true;
+    }
+    memcpy(coef_, c, sizeof coef_);
+    haveFit_ = true;
+    for (i = 0; i < FIT_NTERMS; i++)
+        setDoubleParam(P_Coef[i], coef_[i]);
+
+    /* At the LS solution SSres = y'y - c'A'y */
+    {
+        double ssRes = sumB2_, ssTot = sumB2_ - sumB_ * sumB_ / n_;
+        for (i = 0; i < FIT_NTERMS; i++)
+            ssRes -= coef_[i] * atb_[i];
+        ssRes = fmax(ssRes, 0.0);
+        setDoubleParam(P_Rms, n_ > FIT_NTERMS ? sqrt(ssRes / (n_ - FIT_NTERMS)) : 0.0);
+        setDoubleParam(P_R2, ssTot > 0.0 ? 1.0 - ssRes / ssTot : 1.0);
+    }
+    setIntegerParam(P_Converged, stableCount_ >= nStable &&
+                                 (int)levels_.size() >= minLevels &&
+                                 levelMax_ - levelMin_ >= minSpan * iScale);
+}
+
+asynStatus excitationFit::writeFloat64(asynUser *pasynUser, epicsFloat64 value)
+{
+    int function = pasynUser->reason;
+    double settle, maxAge, age;
+    int enable;
+
+    if (function == P_Current) {
+        prevCurrent_ = lastCurrent_;
+        lastCurrent_ = value;
+        lastCurrentTime_ = epicsMonotonicGet();
+        setDoubleParam(P_Current, value);
+    } else if (function == P_Field) {
+        setDoubleParam(P_Field, value);
+        getIntegerParam(P_Enable, &enable);
+        getDoubleParam(P_Settle, &settle);
+        getDoubleParam(P_MaxAge, &maxAge);
+        age = (epicsMonotonicGet() - lastCurrentTime_) * 1e-9;
+        if (enable && lastCurrentTime_ && age <= maxAge &&
+            fabs(lastCurrent_ - prevCurrent_) <= settle)
+            addPoint(lastCurrent_, value);
+    } else if (function == P_IScale) {
+        if (value <= 0.0) {
+            epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                          "%s: current scale must be positive", driverName);
+            return asynError;
+        }
+        /* The basis changes with the scale, so start over */
+        setDoubleParam(P_IScale, value);
+        clear();
+    } else {
+        return asynPortDriver::writeFloat64(pasynUser, value);
+    }
+    callParamCallbacks();
+    return asynSuccess;
+}
+
+asynStatus excitationFit::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+
+    if (function == P_Reset) {
+        clear();
+        callParamCallbacks();
+        return asynSuccess;
+    }
+    return asynPortDriver::writeInt32(pasynUser, value);
+}
+
+void excitationFit::report(FILE *fp, int details)
+{
+    double iScale;
+
+    getDoubleParam(P_IScale, &iScale);
+    fprintf(fp, "%s: %d points, Iscale %g A, B = %g %+g x %+g x^3 %+g x^5\n",
+            portName, n_, iScale, coef_[0], coef_[1], coef_[2], coef_[3]);
+    asynPortDriver::report(fp, details);
+}
+
+/* Configuration routine. Called directly, or from the iocsh function below */
+
+extern "C" {
+
+int excitationFitConfigure(const char *portName, int maxPoints)
+{
+    if (!portName) {
+        errlogPrintf("Usage: excitationFitConfigure portName maxPoints\n");
+        return -1;
+    }
+    new excitationFit(portName, maxPoints);
+    return 0;
+}
+
+/* EPICS iocsh shell commands */
+
+static const iocshArg initArg0 = { "portName",  iocshArgString };
+static const iocshArg initArg1 = { "maxPoints", iocshArgInt };
+static const iocshArg * const initArgs[] = { &initArg0, &initArg1 };
+static const iocshFuncDef initFuncDef = { "excitationFitConfigure", 2, initArgs };
+
+static void initCallFunc(const iocshArgBuf *args)
+{
+    excitationFitConfigure(args[0].sval, args[1].ival);
+}
+
+static void excitationFitRegister(void)
+{
+    iocshRegister(&initFuncDef, initCallFunc);
+}
+
+epicsExportRegistrar(excitationFitRegister);
+
+}
@@ -0,0 +1,101 @@
+/* excitationFit.h */
+
+#ifndef EXCITATIONFIT_H
+#define EXCITATIONFIT_H
+
+#include <vector>
+
+#include <epicsTypes.h>
+
+#include "asynPortDriver.h"
+
+#define FIT_ENABLE_STRING       "FIT_ENABLE"
+#define FIT_RESET_STRING        "FIT_RESET"
+#define FIT_CURRENT_STRING      "FIT_CURRENT"
+#define FIT_FIELD_STRING        "FIT_FIELD"
+#define FIT_ISCALE_STRING       "FIT_ISCALE"
+#define FIT_SETTLE_STRING       "FIT_SETTLE"
+#define FIT_MAX_AGE_STRING      "FIT_MAX_AGE"
+#define FIT_TOL_STRING          "FIT_TOL"
+#define FIT_NSTABLE_STRING      "FIT_NSTABLE"
+#define FIT_MIN_LEVELS_STRING   "FIT_MIN_LEVELS"
+#define FIT_MIN_SPAN_STRING     "FIT_MIN_SPAN"
+#define FIT_NLEVELS_STRING      "FIT_NLEVELS"
+#define FIT_NPOINTS_STRING      "FIT_NPOINTS"
+#define FIT_C0_STRING           "FIT_C0"
+#define FIT_C1_STRING           "FIT_C1"
+#define FIT_C3_STRING           "FIT_C3"
+#define FIT_C5_STRING           "FIT_C5"
+#define FIT_RMS_STRING          "FIT_RMS"
+#define FIT_R2_STRING           "FIT_R2"
+#define FIT_RESIDUAL_STRING     "FIT_RESIDUAL"
+#define FIT_CHANGE_STRING       "FIT_CHANGE"
+#define FIT_CONVERGED_STRING    "FIT_CONVERGED"
+#define FIT_POINTS_I_STRING     "FIT_POINTS_I"
+#define FIT_POINTS_B_STRING     "FIT_POINTS_B"
+
+/* Model B = c0 + c1 x + c3 x^3 + c5 x^5 with x = I / FIT_ISCALE */
+#define FIT_NTERMS              4
+
+/*
+ * Running least-squares fit of the excitation curve. The normal equations
+ * are accumulated point by point and re-solved on every accepted pair.
+ */
+class excitationFit : public asynPortDriver {
+public:
+    excitationFit(const char *portName, int maxPoints);
+
+    virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+    virtual asynStatus writeFloat64(asynUser *pasynUser, epicsFloat64 value);
+    virtual void report(FILE *fp, int details);
+
+protected:
+    int P_Enable;
+    int P_Reset;
+    int P_Current;
+    int P_Field;
+    int P_IScale;
+    int P_Settle;
+    int P_MaxAge;
+    int P_Tol;
+    int P_NStable;
+    int P_MinLevels;
+    int P_MinSpan;
+    int P_NLevels;
+    int P_NPoints;
+    int P_Coef[FIT_NTERMS];     /* c0, c1, c3, c5 */
+    int P_Rms;
+    int P_R2;
+    int P_Residual;
+    int P_Change;
+    int P_Converged;
+    int P_PointsI;
+    int P_PointsB;
+
+private:
+    static void basis(double x, double phi[FIT_NTERMS]);
+    double evaluate(const double c[FIT_NTERMS], double x) const;
+    void clear();
+    bool newLevel(double current, double iScale);
+    void addPoint(double current, double field);
+    bool solve(double c[FIT_NTERMS]) const;
+
+    double ata_[FIT_NTERMS][FIT_NTERMS];
+    double atb_[FIT_NTERMS];
+    double sumB_, sumB2_;
+    int n_;
+    double coef_[FIT_NTERMS];
+    bool haveFit_;
+    int stableCount_;
+    double refCoef_[FIT_NTERMS];
+    bool haveRef_;
+    std::vector<double> levels_;
+    double levelMin_, levelMax_;
+
+    double lastCurrent_, prevCurrent_;
+    epicsUInt64 lastCurrentTime_;
+    size_t maxPoints_;
+    std::vector<epicsFloat64> pointsI_, pointsB_;
+};
+
+#endif /* EXCITATIONFIT_H */
@@ -0,0 +1,404 @@
+/* fieldPositioner.cpp */
+/*
+ * Virtual field positioner for the steerer PSU.
+ *
+ * The excitation table is loaded from a text file, one point per line:
+ *     <current A>  <field ascending>  [<field descending>]
+ * ('#' starts a comment), or from the FP_TABLE_I/BUP/BDOWN waveforms
+ * followed by FP_APPLY. Both branches must be strictly monotonic. A new
+ * table is built aside and swapped in, so it can be reloaded while the
+ * IOC runs.
+ *
+ * In FP_BRANCH_AUTO a rising request uses the ascending branch and a
+ * falling one the descending branch; repeating the same field keeps the
+ * previous branch.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+
+#include <epicsMath.h>
+#include <epicsTime.h>
+#include <epicsStdio.h>
+#include <errlog.h>
+#include <iocsh.h>
+
+#include "asynDriver.h"
+#include "fieldPositioner.h"
+
+#include <epicsExport.h>
+
+static const char *driverName = "fieldPositioner";
+
+#define FP_GRID_SIZE    4096
+#define FP_MAX_POINTS   1024
+
+double excitationBranch::lerp(const std::vector<double> &y, double x0, double invStep, double x)
+{
+    double u = (x - x0) * invStep;
+    double last = (double)(y.size() - 1);
+    int k;
+
+    /* Clamp without branching on the table contents */
+    u = std::min(std::max(u, 0.0), last);
+    k = std::min((int)u, (int)y.size() - 2);
+    return y[k] + (u - k) * (y[k + 1] - y[k]);
+}
+
+/*
+ * Linear interpolation in a sorted abscissa, used only while building.
+ */
+static double interpSorted(const std::vector<double> &x, const std::vector<double> &y, double xi)
+{
+    size_t k = std::upper_bound(x.begin(), x.end(), xi) - x.begin();
+
+    if (k == 0)
+        return y[0];
+    if (k >= x.size())
+        return y[x.size() - 1];
+    return y[k - 1] + (xi - x[k - 1]) * (y[k] - y[k - 1]) / (x[k] - x[k - 1]);
+}
+
+int excitationBranch::build(const std::vector<double> &current, const std::vector<double> &field,
+                            int gridSize, char *errMsg, size_t errSize)
+{
+    size_t n = current.size();
+    std::vector<double> bSorted, iSorted;
+    bool rising;
+    size_t k;
+    int j;
+
+    if (n < 2 || field.size() != n) {
+        epicsSnprintf(errMsg, errSize, "need at least 2 points");
+        return -1;
+    }
+    for (k = 1; k < n; k++) {
+        if (!(current[k] > current[k - 1])) {
+            epicsSnprintf(errMsg, errSize, "current not increasing at point %u", (unsigned)k);
+            return -1;
+        }
+    }
+    rising = field[n - 1] > field[0];
+    for (k = 1; k < n; k++) {
+        if (rising ? !(field[k] > field[k - 1]) : !(field[k] < field[k - 1])) {
+            epicsSnprintf(errMsg, errSize, "field not monotonic at point %u", (unsigned)k);
+            return -1;
+        }
+    }
+
+    iMin_ = current[0];
+    iMax_ = current[n - 1];
+    iInvStep_ = (gridSize - 1) / (iMax_ - iMin_);
+    bOfI_.resize(gridSize);
+    for (j = 0; j < gridSize; j++)
+        bOfI_[j] = interpSorted(current, field, iMin_ + j / iInvStep_);
+
+    bSorted = field;
+    iSorted = current;
+    if (!rising) {
+        std::reverse(bSorted.begin(), bSorted.end());
+        std::reverse(iSorted.begin(), iSorted.end());
+    }
+    bMin_ = bSorted[0];
+    bMax_ = bSorted[n - 1];
+    bInvStep_ = (gridSize - 1) / (bMax_ - bMin_);
+    iOfB_.resize(gridSize);
+    for (j = 0; j < gridSize; j++)
+        iOfB_[j] = interpSorted(bSorted, iSorted, bMin_ + j / bInvStep_);
+    return 0;
+}
+
+fieldPositioner::fieldPositioner(const char *portName, const char *tableFile)
+    : asynPortDriver(portName, 1,
+                     asynInt32Mask | asynFloat64Mask | asynOctetMask |
+                     asynFloat64ArrayMask | asynDrvUserMask,
+                     asynInt32Mask | asynFloat64Mask | asynOctetMask |
+                     asynFloat64ArrayMask,
+                     0, 1, 0, 0),
+      table_(NULL), lastField_(0.0), lastBranch_(FP_BRANCH_UP)
+{
+    static const char *functionName = "fieldPositioner";
+    char errMsg[128];
+
+    createParam(FP_FIELD_SP_STRING,    asynParamFloat64,      &P_FieldSp);
+    createParam(FP_CURRENT_STRING,     asynParamFloat64,      &P_Current);
+    createParam(FP_EXPECTED_STRING,    asynParamFloat64,      &P_Expected);
+    createParam(FP_BRANCH_MODE_STRING, asynParamInt32,        &P_BranchMode);
+    createParam(FP_BRANCH_STRING,      asynParamInt32,        &P_Branch);
+    createParam(FP_CLAMPED_STRING,     asynParamInt32,        &P_Clamped);
+    createParam(FP_CONV_TIME_STRING,   asynParamFloat64,      &P_ConvTime);
+    createParam(FP_LOAD_FILE_STRING,   asynParamOctet,        &P_LoadFile);
+    createParam(FP_TABLE_NAME_STRING,  asynParamOctet,        &P_TableName);
+    createParam(FP_TABLE_NPTS_STRING,  asynParamInt32,        &P_TableNpts);
+    createParam(FP_TABLE_I_STRING,     asynParamFloat64Array, &P_TableI);
+    createParam(FP_TABLE_BUP_STRING,   asynParamFloat64Array, &P_TableBup);
+    createParam(FP_TABLE_BDOWN_STRING, asynParamFloat64Array, &P_TableBdown);
+    createParam(FP_APPLY_STRING,       asynParamInt32,        &P_Apply);
+
+    setIntegerParam(P_BranchMode, FP_BRANCH_AUTO);
+    setIntegerParam(P_Branch, lastBranch_);
+    setIntegerParam(P_Clamped, 0);
+    setDoubleParam(P_ConvTime, 0.0);
+    setStringParam(P_LoadFile, "");
+    setStringParam(P_TableName, "");
+    setIntegerParam(P_TableNpts, 0);
+
+    if (tableFile && tableFile[0]) {
+        if (loadFile(tableFile, errMsg, sizeof errMsg) != asynSuccess)
+            errlogPrintf("%s::%s: %s: %s\n", driverName, functionName, tableFile, errMsg);
+    }
+}
+
+asynStatus fieldPositioner::loadFile(const char *fileName, char *errMsg, size_t errSize)
+{
+    std::vector<double> current, bUp, bDown;
+    char line[256];
+    FILE *fp;
+    int lineNo = 0;
+
+    fp = fopen(fileName, "r");
+    if (!fp) {
+        epicsSnprintf(errMsg, errSize, "cannot open file");
+        return asynError;
+    }
+    while (fgets(line, sizeof line, fp)) {
+        double v[3];
+        char *hash = strchr(line, '#');
+        int n;
+
+        lineNo++;
+        if (hash)
+            *hash = '\0';
+        n = sscanf(line, "%lf %lf %lf", &v[0], &v[1], &v[2]);
+        if (n <= 0)
+            continue;
+        if (n < 2 || current.size() >= FP_MAX_POINTS) {
+            fclose(fp);
+            epicsSnprintf(errMsg, errSize, "bad line %d", lineNo);
+            return asynError;
+        }
+        current.push_back(v[0]);
+        bUp.push_back(v[1]);
+        bDown.push_back(n == 3 ? v[2] : v[1]);
+    }
+    fclose(fp);
+    return install(current, bUp, bDown, fileName, errMsg, errSize);
+}
+
+/*
+ * Build a new table and swap it in. Called with the driver locked.
+ */
+asynStatus fieldPositioner::install(const std::vector<double> &current,
+                                    const std::vector<double> &bUp,
+                                    const std::vector<double> &bDown,
+                                    const char *name, char *errMsg, size_t errSize)
+{
+    excitationTable *pNew = new excitationTable;
+
+    if (pNew->up.build(current, bUp, FP_GRID_SIZE, errMsg, errSize) ||
+        pNew->down.build(current, bDown, FP_GRID_SIZE, errMsg, errSize)) {
+        delete pNew;
+        return asynError;
+    }
+    pNew->nPoints = (int)current.size();
+
+    delete table_;
+    table_ = pNew;
+    stageI_ = current;
+    stageBup_ = bUp;
+    stageBdown_ = bDown;
+
+    setStringParam(P_TableName, name);
+    setIntegerParam(P_TableNpts, pNew->nPoints);
+    callParamCallbacks();
+    return asynSuccess;
+}
+
+asynStatus fieldPositioner::writeFloat64(asynUser *pasynUser, epicsFloat64 value)
+{
+    int function = pasynUser->reason;
+    const excitationBranch *pBranch;
+    epicsUInt64 t0;
+    double current, expected;
+    int mode, branch;
+
+    if (function != P_FieldSp)
+        return asynPortDriver::writeFloat64(pasynUser, value);
+
+    if (!table_) {
+        epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                      "%s: no excitation table loaded", driverName);
+        return asynError;
+    }
+    if (!isfinite(value)) {
+        epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                      "%s: field setpoint is not finite", driverName);
+        return asynError;
+    }
+
+    getIntegerParam(P_BranchMode, &mode);
+    if (mode != FP_BRANCH_AUTO)
+        branch = mode;
+    else if (value > lastField_)
+        branch = FP_BRANCH_UP;
+    else if (value < lastField_)
+        branch = FP_BRANCH_DOWN;
+    else
+        branch = lastBranch_;
+
+    t0 = epicsMonotonicGet();
+    pBranch = (branch == FP_BRANCH_DOWN) ? &table_->down : &table_->up;
+    current = pBranch->currentFor(value);
+    expected = pBranch->fieldFor(current);
+    setDoubleParam(P_ConvTime, (epicsMonotonicGet() - t0) * 1e-3);   /* us */
+
+    lastField_ = value;
+    lastBranch_ = branch;
+    setDoubleParam(P_FieldSp, value);
+    /* Every setpoint write must drive the PSU, even when the current is
+     * unchanged (e.g. re-asserting a field after a manual putI), so mark
+     * FP_CURRENT changed to force its callback. */
+    setDoubleParam(P_Current, epicsNAN);
+    setDoubleParam(P_Current, current);
+    setDoubleParam(P_Expected, expected);
+    setIntegerParam(P_Branch, branch);
+    setIntegerParam(P_Clamped, value < pBranch->fieldMin() || value > pBranch->fieldMax());
+    callParamCallbacks();
+    return asynSuccess;
+}
+
+asynStatus fieldPositioner::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+    char errMsg[128];
+
+    if (function == P_Apply) {
+        if (stageBdown_.size() != stageI_.size())
+            stageBdown_ = stageBup_;
+        if (install(stageI_, stageBup_, stageBdown_, "(waveform)", errMsg, sizeof errMsg)) {
+            epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                          "%s: %s", driverName, errMsg);
+            return asynError;
+        }
+        return asynSuccess;
+    }
+    return asynPortDriver::writeInt32(pasynUser, value);
+}
+
+asynStatus fieldPositioner::writeOctet(asynUser *pasynUser, const char *value,
+                                       size_t maxChars, size_t *nActual)
+{
+    int function = pasynUser->reason;
+    char fileName[256], errMsg[128];
+
+    if (function == P_LoadFile) {
+        if (maxChars >= sizeof fileName)
+            maxChars = sizeof fileName - 1;
+        memcpy(fileName, value, maxChars);
+        fileName[maxChars] = '\0';
+        *nActual = maxChars;
+        setStringParam(P_LoadFile, fileName);
+        if (loadFile(fileName, errMsg, sizeof errMsg)) {
+            epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                          "%s: %s: %s", driverName, fileName, errMsg);
+            return asynError;
+        }
+        return asynSuccess;
+    }
+    return asynPortDriver::writeOctet(pasynUser, value, maxChars, nActual);
+}
+
+/*
+ * Waveform writes only stage the columns; FP_APPLY builds the table.
+ */
+asynStatus fieldPositioner::writeFloat64Array(asynUser *pasynUser, epicsFloat64 *value,
+                                              size_t nElements)
+{
+    int function = pasynUser->reason;
+
+    if (nElements > FP_MAX_POINTS)
+        nElements = FP_MAX_POINTS;
+    if (function == P_TableI)
+        stageI_.assign(value, value + nElements);
+    else if (function == P_TableBup)
+        stageBup_.assign(value, value + nElements);
+    else if (function == P_TableBdown)
+        stageBdown_.assign(value, value + nElements);
+    else
+        return asynPortDriver::writeFloat64Array(pasynUser, value, nElements);
+    return asynSuccess;
+}
+
+asynStatus fieldPositioner::readFloat64Array(asynUser *pasynUser, epicsFloat64 *value,
+                                             size_t nElements, size_t *nIn)
+{
+    int function = pasynUser->reason;
+    const std::vector<double> *pCol;
+
+    if (function == P_TableI)
+        pCol = &stageI_;
+    else if (function == P_TableBup)
+        pCol = &stageBup_;
+    else if (function == P_TableBdown)
+        pCol = &stageBdown_;
+    else
+        return asynPortDriver::readFloat64Array(pasynUser, value, nElements, nIn);
+
+    *nIn = std::min(nElements, pCol->size());
+    if (*nIn)
+        memcpy(value, &(*pCol)[0], *nIn * sizeof(epicsFloat64));
+    return asynSuccess;
+}
+
+void fieldPositioner::report(FILE *fp, int details)
+{
+    char name[256];
+
+    getStringParam(P_TableName, sizeof name, name);
+    if (table_)
+        fprintf(fp, "%s: table %s, %d points, field %g..%g (up) %g..%g (down)\n",
+                portName, name, table_->nPoints,
+                table_->up.fieldMin(), table_->up.fieldMax(),
+                table_->down.fieldMin(), table_->down.fieldMax());
+    else
+        fprintf(fp, "%s: no table loaded\n", portName);
+    asynPortDriver::report(fp, details);
+}
+
+/* Configuration routine. Called directly, or from the iocsh function below */
+
+extern "C" {
+
+int fieldPositionerConfigure(const char *portName, const char *tableFile)
+{
+    if (!portName) {
+        errlogPrintf("Usage: fieldPositionerConfigure portName [tableFile]\n");
+        return -1;
+    }
+    new fieldPositioner(portName, tableFile);
+    return 0;
+}
+
+/* EPICS iocsh shell commands */
+
+static const iocshArg initArg0 = { "portName",  iocshArgString };
+static const iocshArg initArg1 = { "tableFile", iocshArgString };
+static const iocshArg * const initArgs[] = { &initArg0, &initArg1 };
+static const iocshFuncDef initFuncDef = { "fieldPositionerConfigure", 2, initArgs };
+
+static void initCallFunc(const iocshArgBuf *args)
+{
+    fieldPositionerConfigure(args[0].sval, args[1].sval);
+}
+
+static void fieldPositionerRegister(void)
+{
+    iocshRegister(&initFuncDef, initCallFunc);
+}
+
+epicsExportRegistrar(fieldPositionerRegister);
+
+}
@@ -0,0 +1,106 @@
+/* fieldPositioner.h */
+
+#ifndef FIELDPOSITIONER_H
+#define FIELDPOSITIONER_H
+
+#include <vector>
+
+#include <epicsTypes.h>
+
+#include "asynPortDriver.h"
+
+#define FP_FIELD_SP_STRING      "FP_FIELD_SP"
+#define FP_CURRENT_STRING       "FP_CURRENT"
+#define FP_EXPECTED_STRING      "FP_EXPECTED"
+#define FP_BRANCH_MODE_STRING   "FP_BRANCH_MODE"
+#define FP_BRANCH_STRING        "FP_BRANCH"
+#define FP_CLAMPED_STRING       "FP_CLAMPED"
+#define FP_CONV_TIME_STRING     "FP_CONV_TIME"
+#define FP_LOAD_FILE_STRING     "FP_LOAD_FILE"
+#define FP_TABLE_NAME_STRING    "FP_TABLE_NAME"
+#define FP_TABLE_NPTS_STRING    "FP_TABLE_NPTS"
+#define FP_TABLE_I_STRING       "FP_TABLE_I"
+#define FP_TABLE_BUP_STRING     "FP_TABLE_BUP"
+#define FP_TABLE_BDOWN_STRING   "FP_TABLE_BDOWN"
+#define FP_APPLY_STRING         "FP_APPLY"
+
+/* FP_BRANCH_MODE / FP_BRANCH */
+#define FP_BRANCH_AUTO          0
+#define FP_BRANCH_UP            1
+#define FP_BRANCH_DOWN          2
+
+/*
+ * Excitation curve of one branch, resampled onto uniform grids in both
+ * directions so a conversion is an index computation and one lerp.
+ */
+class excitationBranch {
+public:
+    int build(const std::vector<double> &current, const std::vector<double> &field,
+              int gridSize, char *errMsg, size_t errSize);
+    double currentFor(double field) const  { return lerp(iOfB_, bMin_, bInvStep_, field); }
+    double fieldFor(double current) const  { return lerp(bOfI_, iMin_, iInvStep_, current); }
+    double fieldMin() const { return bMin_; }
+    double fieldMax() const { return bMax_; }
+
+private:
+    static double lerp(const std::vector<double> &y, double x0, double invStep, double x);
+
+    std::vector<double> iOfB_;
+    std::vector<double> bOfI_;
+    double bMin_, bMax_, bInvStep_;
+    double iMin_, iMax_, iInvStep_;
+};
+
+struct excitationTable {
+    excitationBranch up;
+    excitationBranch down;
+    int nPoints;
+};
+
+/*
+ * Field positioner: converts a requested field to a PSU current using the
+ * ascending or descending branch of the excitation curve.
+ */
+class fieldPositioner : public asynPortDriver {
+public:
+    fieldPositioner(const char *portName, const char *tableFile);
+
+    virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+    virtual asynStatus writeFloat64(asynUser *pasynUser, epicsFloat64 value);
+    virtual asynStatus writeOctet(asynUser *pasynUser, const char *value,
+                                  size_t maxChars, size_t *nActual);
+    virtual asynStatus writeFloat64Array(asynUser *pasynUser, epicsFloat64 *value,
+                                         size_t nElements);
+    virtual asynStatus readFloat64Array(asynUser *pasynUser, epicsFloat64 *value,
+                                        size_t nElements, size_t *nIn);
+    virtual void report(FILE *fp, int details);
+
+protected:
+    int P_FieldSp;
+    int P_Current;
+    int P_Expected;
+    int P_BranchMode;
+    int P_Branch;
+    int P_Clamped;
+    int P_ConvTime;
+    int P_LoadFile;
+    int P_TableName;
+    int P_TableNpts;
+    int P_TableI;
+    int P_TableBup;
+    int P_TableBdown;
+    int P_Apply;
+
+private:
+    asynStatus loadFile(const char *fileName, char *errMsg, size_t errSize);
+    asynStatus install(const std::vector<double> &current, const std::vector<double> &bUp,
+                       const std::vector<double> &bDown, const char *name,
+                       char *errMsg, size_t errSize);
+
+    excitationTable *table_;
+    double lastField_;
+    int lastBranch_;
+    std::vector<double> stageI_, stageBup_, stageBdown_;
+};
+
+#endif /* FIELDPOSITIONER_H */
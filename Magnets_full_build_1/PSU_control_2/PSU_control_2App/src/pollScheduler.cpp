@@ -0,0 +1,377 @@
+/* pollScheduler.cpp */
+/*
+ * Poll-phase scheduler for StreamDevice records sharing one asyn port.
+ *
+ * Records opt in with
+ *     info(pollScheduler, "PWRSPL_SCHED")
+ *     info(pollPhase, "0.5")          (optional, fraction of the period)
+ * and should be SCAN "Passive". Records without a pollPhase are spread
+ * evenly over the slots the fixed ones leave free. Before each dispatch a
+ * no-op request is queued on the I/O port at high priority, as setpoints
+ * are; the time it waits for the port is what a setpoint written at that
+ * moment would wait.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+#include <epicsThread.h>
+#include <epicsTime.h>
+#include <epicsString.h>
+#include <epicsStdio.h>
+#include <errlog.h>
+#include <iocsh.h>
+#include <initHooks.h>
+#include <dbAccess.h>
+#include <dbStaticLib.h>
+
+#include "asynDriver.h"
+#include "pollScheduler.h"
+
+#include <epicsExport.h>
+
+static const char *driverName = "pollScheduler";
+
+static std::vector<pollScheduler *> schedulers;
+
+static void schedulerTaskC(void *drvPvt)
+{
+    pollScheduler *pPvt = (pollScheduler *)drvPvt;
+    pPvt->schedulerTask();
+}
+
+static void probeCallback(asynUser *pasynUser)
+{
+    pollScheduler *pPvt = (pollScheduler *)pasynUser->userPvt;
+    pPvt->probeDone();
+}
+
+static void pollSchedulerInitHook(initHookState state)
+{
+    if (state != initHookAfterIocRunning)
+        return;
+    for (size_t i = 0; i < schedulers.size(); i++)
+        schedulers[i]->start();
+}
+
+static bool slotPhaseLess(const pollScheduler::slot &a, const pollScheduler::slot &b)
+{
+    return a.phase < b.phase;
+}
+
+pollScheduler::pollScheduler(const char *portName, const char *ioPortName, double period)
+    : asynPortDriver(portName, 1,
+                     asynInt32Mask | asynFloat64Mask | asynDrvUserMask,
+                     asynInt32Mask | asynFloat64Mask,
+                     0, 1, 0, 0),
+      pasynUserProbe_(NULL), ioPortName_(epicsStrDup(ioPortName)),
+      probePending_(false), probeQueued_(0)
+{
+    static const char *functionName = "pollScheduler";
+    asynStatus status;
+
+    createParam(SCHED_PERIOD_STRING,    asynParamFloat64, &P_Period);
+    createParam(SCHED_NRECORDS_STRING,  asynParamInt32,   &P_NRecords);
+    createParam(SCHED_WAIT_LAST_STRING, asynParamFloat64, &P_WaitLast);
+    createParam(SCHED_WAIT_MAX_STRING,  asynParamFloat64, &P_WaitMax);
+    createParam(SCHED_WAIT_AVG_STRING,  asynParamFloat64, &P_WaitAvg);
+    createParam(SCHED_OVERRUNS_STRING,  asynParamInt32,   &P_Overruns);
+    createParam(SCHED_RESET_STRING,     asynParamInt32,   &P_Reset);
+
+    setDoubleParam(P_Period, period > 0 ? period : 1.0);
+    setIntegerParam(P_NRecords, 0);
+    setDoubleParam(P_WaitLast, 0.0);
+    setDoubleParam(P_WaitMax, 0.0);
+    setDoubleParam(P_WaitAvg, 0.0);
+    setIntegerParam(P_Overruns, 0);
+
+    pasynUserProbe_ = pasynManager->createAsynUser(probeCallback, 0);
+    pasynUserProbe_->userPvt = this;
+    status = pasynManager->connectDevice(pasynUserProbe_, ioPortName_, 0);
+    if (status != asynSuccess) {
+        errlogPrintf("%s::%s: cannot connect to port %s: %s\n",
+                     driverName, functionName, ioPortName_,
+                     pasynUserProbe_->errorMessage);
+        pasynManager->freeAsynUser(pasynUserProbe_);
+        pasynUserProbe_ = NULL;
+    }
+
+    if (schedulers.empty())
+        initHookRegister(pollSchedulerInitHook);
+    schedulers.push_back(this);
+}
+
+/*
+ * Called once the database is running: pick up the tagged records,
+ * lay them out over the period and start the dispatch thread.
+ */
+void pollScheduler::start()
+{
+    collectRecords();
+    assignPhases();
+
+    lock();
+    setIntegerParam(P_NRecords, (int)slots_.size());
+    callParamCallbacks();
+    unlock();
+
+    epicsThreadCreate(portName, epicsThreadPriorityScanHigh,
+                      epicsThreadGetStackSize(epicsThreadStackMedium),
+                      (EPICSTHREADFUNC)schedulerTaskC, this);
+}
+
+void pollScheduler::collectRecords()
+{
+    DBENTRY dbentry;
+    long typeStatus, recStatus;
+
+    dbInitEntry(pdbbase, &dbentry);
+    for (typeStatus = dbFirstRecordType(&dbentry); !typeStatus;
+         typeStatus = dbNextRecordType(&dbentry)) {
+        for (recStatus = dbFirstRecord(&dbentry); !recStatus;
+             recStatus = dbNextRecord(&dbentry)) {
+            slot s;
+
+            if (dbIsAlias(&dbentry))
+                continue;
+            if (dbFindInfo(&dbentry, "pollScheduler") ||
+                strcmp(dbGetInfoString(&dbentry), portName) != 0)
+                continue;
+
+            s.prec = (dbCommon *)dbentry.precnode->precord;
+            s.phase = 0.0;
+            s.fixed = false;
+            if (!dbFindInfo(&dbentry, "pollPhase")) {
+                double phase = atof(dbGetInfoString(&dbentry));
+                s.phase = phase - floor(phase);
+                s.fixed = true;
+            }
+            slots_.push_back(s);
+        }
+    }
+    dbFinishEntry(&dbentry);
+}
+
+/*
+ * Divide the period into one slot per record. Each fixed phase claims the
+ * free slot closest to it; the remaining records take the free slots in
+ * load order.
+ */
+void pollScheduler::assignPhases()
+{
+    size_t n = slots_.size();
+    std::vector<bool> taken(n, false);
+    size_t i, k;
+
+    if (n == 0)
+        return;
+
+    for (i = 0; i < n; i++) {
+        size_t best = n;
+        double bestDist = 2.0;
+
+        if (!slots_[i].fixed)
+            continue;
+        for (k = 0; k < n; k++) {
+            double d = fabs(slots_[i].phase - (double)k / n);
+            d = std::min(d, 1.0 - d);
+            if (!taken[k] && d < bestDist) {
+                best = k;
+                bestDist = d;
+            }
+        }
+        if (best < n)
+            taken[best] = true;
+    }
+
+    k = 0;
+    for (i = 0; i < n; i++) {
+        if (slots_[i].fixed)
+            continue;
+        while (taken[k])
+            k++;
+        taken[k] = true;
+        slots_[i].phase = (double)k / n;
+    }
+
+    std::stable_sort(slots_.begin(), slots_.end(), slotPhaseLess);
+}
+
+/*
+ * At the priority of the setpoints (putI, changecurrent), so the wait is
+ * the one they see: behind the request in progress, not behind the polls.
+ */
+void pollScheduler::queueProbe()
+{
+    if (!pasynUserProbe_ || probePending_)
+        return;
+    probePending_ = true;
+    probeQueued_ = epicsMonotonicGet();
+    if (pasynManager->queueRequest(pasynUserProbe_, asynQueuePriorityHigh, 0.0) != asynSuccess)
+        probePending_ = false;
+}
+
+/*
+ * Runs in the I/O port thread when the probe reaches the head of the queue.
+ */
+void pollScheduler::probeDone()
+{
+    double wait = (epicsMonotonicGet() - probeQueued_) * 1e-6;   /* ms */
+    double waitMax, waitAvg;
+
+    lock();
+    getDoubleParam(P_WaitMax, &waitMax);
+    getDoubleParam(P_WaitAvg, &waitAvg);
+    setDoubleParam(P_WaitLast, wait);
+    if (wait > waitMax)
+        setDoubleParam(P_WaitMax, wait);
+    setDoubleParam(P_WaitAvg, waitAvg ? waitAvg * 0.98 + wait * 0.02 : wait);
+    callParamCallbacks();
+    probePending_ = false;
+    unlock();
+}
+
+void pollScheduler::schedulerTask()
+{
+    epicsUInt64 cycleStart = epicsMonotonicGet();
+    epicsUInt64 now;
+    double period;
+    int overruns;
+    size_t i;
+
+    for (;;) {
+        lock();
+        getDoubleParam(P_Period, &period);
+        unlock();
+
+        if (slots_.empty()) {
+            epicsThreadSleep(period);
+            continue;
+        }
+
+        for (i = 0; i < slots_.size(); i++) {
+            epicsUInt64 due = cycleStart + (epicsUInt64)(slots_[i].phase * period * 1e9);
+            dbCommon *prec = slots_[i].prec;
+            bool busy;
+
+            now = epicsMonotonicGet();
+            if (due > now)
+                epicsThreadSleep((due - now) * 1e-9);
+
+            lock();
+            queueProbe();
+            unlock();
+
+            dbScanLock(prec);
+            busy = prec->pact;
+            if (!busy)
+                dbProcess(prec);
+            dbScanUnlock(prec);
+
+            if (busy) {
+                lock();
+                getIntegerParam(P_Overruns, &overruns);
+                setIntegerParam(P_Overruns, overruns + 1);
+                callParamCallbacks();
+                unlock();
+            }
+        }
+
+        cycleStart += (epicsUInt64)(period * 1e9);
+        now = epicsMonotonicGet();
+        if (now > cycleStart + (epicsUInt64)(period * 1e9)) {
+            /* A whole period behind (period shortened or port stalled) */
+            cycleStart = now;
+            lock();
+            getIntegerParam(P_Overruns, &overruns);
+            setIntegerParam(P_Overruns, overruns + 1);
+            callParamCallbacks();
+            unlock();
+        }
+    }
+}
+
+asynStatus pollScheduler::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+
+    if (function == P_Reset) {
+        setDoubleParam(P_WaitLast, 0.0);
+        setDoubleParam(P_WaitMax, 0.0);
+        setDoubleParam(P_WaitAvg, 0.0);
+        setIntegerParam(P_Overruns, 0);
+        callParamCallbacks();
+        return asynSuccess;
+    }
+    return asynPortDriver::writeInt32(pasynUser, value);
+}
+
+asynStatus pollScheduler::writeFloat64(asynUser *pasynUser, epicsFloat64 value)
+{
+    int function = pasynUser->reason;
+
+    if (function == P_Period) {
+        if (value <= 0) {
+            epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                          "%s: period must be positive", driverName);
+            return asynError;
+        }
+        setDoubleParam(P_Period, value);
+        callParamCallbacks();
+        return asynSuccess;
+    }
+    return asynPortDriver::writeFloat64(pasynUser, value);
+}
+
+void pollScheduler::report(FILE *fp, int details)
+{
+    double period;
+
+    getDoubleParam(P_Period, &period);
+    fprintf(fp, "%s: port %s, period %g s, %u records\n",
+            portName, ioPortName_, period, (unsigned)slots_.size());
+    if (details > 0) {
+        for (size_t i = 0; i < slots_.size(); i++)
+            fprintf(fp, "  %6.3f s %s%s\n", slots_[i].phase * period,
+                    slots_[i].prec->name, slots_[i].fixed ? " (pollPhase)" : "");
+    }
+    asynPortDriver::report(fp, details);
+}
+
+/* Configuration routine. Called directly, or from the iocsh function below */
+
+extern "C" {
+
+int pollSchedulerConfigure(const char *portName, const char *ioPortName, double period)
+{
+    if (!portName || !ioPortName) {
+        errlogPrintf("Usage: pollSchedulerConfigure portName ioPortName period\n");
+        return -1;
+    }
+    new pollScheduler(portName, ioPortName, period);
+    return 0;
+}
+
+/* EPICS iocsh shell commands */
+
+static const iocshArg initArg0 = { "portName",   iocshArgString };
+static const iocshArg initArg1 = { "ioPortName", iocshArgString };
+static const iocshArg initArg2 = { "period",     iocshArgDouble };
+static const iocshArg * const initArgs[] = { &initArg0, &initArg1, &initArg2 };
+static const iocshFuncDef initFuncDef = { "pollSchedulerConfigure", 3, initArgs };
+
+static void initCallFunc(const iocshArgBuf *args)
+{
+    pollSchedulerConfigure(args[0].sval, args[1].sval, args[2].dval);
+}
+
+static void pollSchedulerRegister(void)
+{
+    iocshRegister(&initFuncDef, initCallFunc);
+}
+
+epicsExportRegistrar(pollSchedulerRegister);
+
+}
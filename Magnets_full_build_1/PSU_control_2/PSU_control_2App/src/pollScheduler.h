@@ -0,0 +1,65 @@
+/* pollScheduler.h */
+
+#ifndef POLLSCHEDULER_H
+#define POLLSCHEDULER_H
+
+#include <vector>
+
+#include <epicsTypes.h>
+#include <dbCommon.h>
+
+#include "asynPortDriver.h"
+
+#define SCHED_PERIOD_STRING     "SCHED_PERIOD"
+#define SCHED_NRECORDS_STRING   "SCHED_NRECORDS"
+#define SCHED_WAIT_LAST_STRING  "SCHED_WAIT_LAST"
+#define SCHED_WAIT_MAX_STRING   "SCHED_WAIT_MAX"
+#define SCHED_WAIT_AVG_STRING   "SCHED_WAIT_AVG"
+#define SCHED_OVERRUNS_STRING   "SCHED_OVERRUNS"
+#define SCHED_RESET_STRING      "SCHED_RESET"
+
+/*
+ * Processes the records tagged with info(pollScheduler, "<portName>") one
+ * at a time, each at its own phase of the period, so the periodic reads of
+ * an asyn port never queue up behind each other.
+ */
+class pollScheduler : public asynPortDriver {
+public:
+    pollScheduler(const char *portName, const char *ioPortName, double period);
+
+    virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+    virtual asynStatus writeFloat64(asynUser *pasynUser, epicsFloat64 value);
+    virtual void report(FILE *fp, int details);
+
+    void start();
+    void schedulerTask();
+    void probeDone();
+
+    struct slot {
+        dbCommon *prec;
+        double    phase;    /* fraction of the period, 0..1 */
+        bool      fixed;    /* phase given by info(pollPhase) */
+    };
+
+protected:
+    int P_Period;
+    int P_NRecords;
+    int P_WaitLast;
+    int P_WaitMax;
+    int P_WaitAvg;
+    int P_Overruns;
+    int P_Reset;
+
+private:
+    void collectRecords();
+    void assignPhases();
+    void queueProbe();
+
+    std::vector<slot> slots_;
+    asynUser   *pasynUserProbe_;
+    char       *ioPortName_;
+    bool        probePending_;
+    epicsUInt64 probeQueued_;
+};
+
+#endif /* POLLSCHEDULER_H */
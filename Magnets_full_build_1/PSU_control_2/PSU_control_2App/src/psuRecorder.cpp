@@ -0,0 +1,478 @@
+/* psuRecorder.cpp */
+/*
+ * Post-mortem recorder for the PSU.
+ *
+ * A low priority thread reads MRI, MRV, MRT, MRTS, MRP and MST back to back
+ * on the PSU port into a ring buffer, so the sample rate is whatever the
+ * link sustains between the StreamDevice transactions. When armed, a
+ * manual request, a temperature at or above REC_TEMP_LIMIT or a status
+ * register bit in REC_ILK_MASK triggers the capture; REC_POST more samples
+ * are taken and the REC_PRE + REC_POST window is frozen into the waveform
+ * parameters and, if REC_FILE_DIR is set, written to a binary file.
+ *
+ * File layout (host byte order):
+ *     char     magic[8]        "PSUPM1"
+ *     uint32   nSamples
+ *     uint32   nColumns        7: t, I, V, temp1, temp2, DC-link, status
+ *     uint32   triggerSource   REC_TRIG_xxx
+ *     uint32   triggerSec      EPICS epoch
+ *     uint32   triggerNsec
+ *     float64  data[nSamples][nColumns]   t relative to the trigger, s
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <epicsThread.h>
+#include <epicsTime.h>
+#include <epicsStdio.h>
+#include <errlog.h>
+#include <iocsh.h>
+
+#include "asynDriver.h"
+#include "psuRecorder.h"
+
+#include <epicsExport.h>
+
+static const char *driverName = "psuRecorder";
+
+static const char *channelCommands[] = { "MRI", "MRV", "MRT", "MRTS", "MRP" };
+
+static void recorderTaskC(void *drvPvt)
+{
+    psuRecorder *pPvt = (psuRecorder *)drvPvt;
+    pPvt->recorderTask();
+}
+
+psuRecorder::psuRecorder(const char *portName, const char *ioPortName, int depth)
+    : asynPortDriver(portName, 1,
+                     asynInt32Mask | asynFloat64Mask | asynOctetMask |
+                     asynFloat64ArrayMask | asynDrvUserMask,
+                     asynInt32Mask | asynFloat64Mask | asynOctetMask |
+                     asynFloat64ArrayMask,
+                     0, 1, 0, 0),
+      pasynUserIO_(NULL), pasynOctet_(NULL), octetPvt_(NULL),
+      head_(0), count_(0), triggerIndex_(0), postRemaining_(0),
+      pendingTrigger_(REC_TRIG_NONE)
+{
+    static const char *functionName = "psuRecorder";
+    asynInterface *pasynInterface;
+    asynStatus status;
+
+    if (depth < 16)
+        depth = 16;
+    ring_.resize(depth);
+
+    createParam(REC_ENABLE_STRING,      asynParamInt32,        &P_Enable);
+    createParam(REC_STATE_STRING,       asynParamInt32,        &P_State);
+    createParam(REC_ARM_STRING,         asynParamInt32,        &P_Arm);
+    createParam(REC_TRIGGER_STRING,     asynParamInt32,        &P_Trigger);
+    createParam(REC_TRIG_SOURCE_STRING, asynParamInt32,        &P_TrigSource);
+    createParam(REC_TEMP_LIMIT_STRING,  asynParamFloat64,      &P_TempLimit);
+    createParam(REC_ILK_MASK_STRING,    asynParamInt32,        &P_IlkMask);
+    createParam(REC_DEPTH_STRING,       asynParamInt32,        &P_Depth);
+    createParam(REC_PRE_STRING,         asynParamInt32,        &P_Pre);
+    createParam(REC_POST_STRING,        asynParamInt32,        &P_Post);
+    createParam(REC_RATE_STRING,        asynParamFloat64,      &P_Rate);
+    createParam(REC_NCAPTURED_STRING,   asynParamInt32,        &P_NCaptured);
+    createParam(REC_ERRORS_STRING,      asynParamInt32,        &P_Errors);
+    createParam(REC_FILE_DIR_STRING,    asynParamOctet,        &P_FileDir);
+    createParam(REC_FILE_NAME_STRING,   asynParamOctet,        &P_FileName);
+    createParam(REC_TIME_STRING,        asynParamFloat64Array, &P_Time);
+    createParam(REC_CURRENT_STRING,     asynParamFloat64Array, &P_Current);
+    createParam(REC_VOLTAGE_STRING,     asynParamFloat64Array, &P_Voltage);
+    createParam(REC_TEMP1_STRING,       asynParamFloat64Array, &P_Temp1);
+    createParam(REC_TEMP2_STRING,       asynParamFloat64Array, &P_Temp2);
+    createParam(REC_DCLINK_STRING,      asynParamFloat64Array, &P_DClink);
+    createParam(REC_STATUS_STRING,      asynParamFloat64Array, &P_Status);
+
+    setIntegerParam(P_Enable, 0);
+    setIntegerParam(P_State, REC_STATE_IDLE);
+    setIntegerParam(P_TrigSource, REC_TRIG_NONE);
+    setDoubleParam(P_TempLimit, 60.0);
+    setIntegerParam(P_IlkMask, 0);
+    setIntegerParam(P_Depth, depth);
+    setIntegerParam(P_Pre, depth / 2);
+    setIntegerParam(P_Post, depth / 4);
+    setDoubleParam(P_Rate, 0.0);
+    setIntegerParam(P_NCaptured, 0);
+    setIntegerParam(P_Errors, 0);
+    setStringParam(P_FileDir, "");
+    setStringParam(P_FileName, "");
+
+    pasynUserIO_ = pasynManager->createAsynUser(0, 0);
+    pasynUserIO_->timeout = 1.0;
+    status = pasynManager->connectDevice(pasynUserIO_, ioPortName, 0);
+    if (status == asynSuccess) {
+        pasynInterface = pasynManager->findInterface(pasynUserIO_, asynOctetType, 1);
+        if (pasynInterface) {
+            pasynOctet_ = (asynOctet *)pasynInterface->pinterface;
+            octetPvt_ = pasynInterface->drvPvt;
+        }
+    }
+    if (!pasynOctet_) {
+        errlogPrintf("%s::%s: port %s has no asynOctet interface: %s\n",
+                     driverName, functionName, ioPortName,
+                     pasynUserIO_->errorMessage);
+        return;
+    }
+
+    epicsThreadCreate(portName, epicsThreadPriorityLow,
+                      epicsThreadGetStackSize(epicsThreadStackMedium),
+                      (EPICSTHREADFUNC)recorderTaskC, this);
+}
+
+/*
+ * One command/reply exchange. The port is shared with StreamDevice, so
+ * terminators are handled here rather than through the port EOS settings.
+ */
+asynStatus psuRecorder::transact(const char *command, char *reply, size_t replySize)
+{
+    char out[32];
+    size_t nout, nio, nin = 0;
+    char *cr = NULL;
+    int eom;
+    asynStatus status;
+
+    nout = epicsSnprintf(out, sizeof out, "%s\r", command);
+    status = pasynManager->queueLockPort(pasynUserIO_);
+    if (status != asynSuccess)
+        return status;
+    pasynOctet_->flush(octetPvt_, pasynUserIO_);
+    status = pasynOctet_->write(octetPvt_, pasynUserIO_, out, nout, &nio);
+    while (status == asynSuccess && nin < replySize - 1) {
+        status = pasynOctet_->read(octetPvt_, pasynUserIO_, reply + nin,
+                                   replySize - 1 - nin, &nio, &eom);
+        nin += nio;
+        if ((cr = (char *)memchr(reply, '\r', nin)) != NULL)
+            break;
+    }
+    pasynManager->queueUnlockPort(pasynUserIO_);
+
+    reply[nin] = '\0';
+    if (cr)
+        *cr = '\0';
+    else if (status == asynSuccess)
+        status = asynOverflow;
+    return status;
+}
+
+/*
+ * Replies have the form "#<command>:<value>"; MST returns the status
+ * register in hex.
+ */
+asynStatus psuRecorder::readValue(const char *command, double *value)
+{
+    char reply[64];
+    size_t len = strlen(command);
+    char *end;
+    asynStatus status;
+
+    status = transact(command, reply, sizeof reply);
+    if (status != asynSuccess)
+        return status;
+    if (reply[0] != '#' || strncmp(reply + 1, command, len) != 0 || reply[len + 1] != ':')
+        return asynError;
+    if (strcmp(command, "MST") == 0)
+        *value = (double)strtoul(reply + len + 2, &end, 16);
+    else
+        *value = strtod(reply + len + 2, &end);
+    if (end == reply + len + 2)
+        return asynError;
+    return asynSuccess;
+}
+
+asynStatus psuRecorder::readSample(sample *ps)
+{
+    asynStatus status;
+    int i;
+
+    ps->t = epicsMonotonicGet() * 1e-9;
+    for (i = 0; i < nChannels - 1; i++) {
+        status = readValue(channelCommands[i], &ps->v[i]);
+        if (status != asynSuccess)
+            return status;
+    }
+    return readValue("MST", &ps->v[nChannels - 1]);
+}
+
+int psuRecorder::checkTrigger(const sample &s)
+{
+    double tempLimit;
+    int ilkMask;
+
+    getDoubleParam(P_TempLimit, &tempLimit);
+    getIntegerParam(P_IlkMask, &ilkMask);
+    if (ilkMask && ((unsigned long)s.v[5] & (unsigned long)ilkMask))
+        return REC_TRIG_INTERLOCK;
+    if (s.v[2] >= tempLimit || s.v[3] >= tempLimit)
+        return REC_TRIG_TEMP;
+    return REC_TRIG_NONE;
+}
+
+/*
+ * Copy the window around the trigger out of the ring and publish it.
+ * Called with the driver locked.
+ */
+void psuRecorder::freeze()
+{
+    size_t depth = ring_.size();
+    int pre, post, nCaptured;
+    size_t n, i, start;
+    std::vector<sample> window;
+    std::vector<epicsFloat64> col;
+    double t0 = ring_[triggerIndex_].t;
+    const int params[nChannels] = { P_Current, P_Voltage, P_Temp1, P_Temp2, P_DClink, P_Status };
+    char fileDir[256];
+    int c;
+
+    getIntegerParam(P_Pre, &pre);
+    getIntegerParam(P_Post, &post);
+    n = (size_t)pre + post + 1;
+    if (n > count_)
+        n = count_;
+    start = (head_ + depth - n) % depth;
+
+    window.resize(n);
+    col.resize(n);
+    for (i = 0; i < n; i++)
+        window[i] = ring_[(start + i) % depth];
+
+    for (i = 0; i < n; i++)
+        col[i] = window[i].t - t0;
+    doCallbacksFloat64Array(&col[0], n, P_Time, 0);
+    for (c = 0; c < nChannels; c++) {
+        for (i = 0; i < n; i++)
+            col[i] = window[i].v[c];
+        doCallbacksFloat64Array(&col[0], n, params[c], 0);
+    }
+
+    getIntegerParam(P_NCaptured, &nCaptured);
+    setIntegerParam(P_NCaptured, nCaptured + 1);
+    setIntegerParam(P_State, REC_STATE_FROZEN);
+
+    getStringParam(P_FileDir, sizeof fileDir, fileDir);
+    if (fileDir[0]) {
+        unlock();
+        writeFile(window, t0);
+        lock();
+    }
+}
+
+void psuRecorder::writeFile(const std::vector<sample> &window, double tTrigger)
+{
+    static const char *functionName = "writeFile";
+    char fileDir[256], stamp[32], fileName[320];
+    char magic[8] = "PSUPM1";
+    epicsUInt32 header[5];
+    int trigSource;
+    FILE *fp;
+    size_t i;
+
+    lock();
+    getStringParam(P_FileDir, sizeof fileDir, fileDir);
+    getIntegerParam(P_TrigSource, &trigSource);
+    unlock();
+
+    epicsTimeToStrftime(stamp, sizeof stamp, "%Y%m%d-%H%M%S", &triggerTime_);
+    epicsSnprintf(fileName, sizeof fileName, "%s/psu_pm_%s.bin", fileDir, stamp);
+
+    fp = fopen(fileName, "wb");
+    if (!fp) {
+        errlogPrintf("%s::%s: cannot create %s\n", driverName, functionName, fileName);
+        return;
+    }
+    header[0] = (epicsUInt32)window.size();
+    header[1] = nChannels + 1;
+    header[2] = (epicsUInt32)trigSource;
+    header[3] = triggerTime_.secPastEpoch;
+    header[4] = triggerTime_.nsec;
+    fwrite(magic, sizeof magic, 1, fp);
+    fwrite(header, sizeof header, 1, fp);
+    for (i = 0; i < window.size(); i++) {
+        epicsFloat64 row[nChannels + 1];
+        row[0] = window[i].t - tTrigger;
+        memcpy(&row[1], window[i].v, sizeof window[i].v);
+        fwrite(row, sizeof row, 1, fp);
+    }
+    fclose(fp);
+
+    lock();
+    setStringParam(P_FileName, fileName);
+    callParamCallbacks();
+    unlock();
+}
+
+void psuRecorder::recorderTask()
+{
+    size_t depth = ring_.size();
+    double lastT = 0.0, rate;
+    int enable, state, errors, source, post;
+    sample s;
+
+    for (;;) {
+        lock();
+        getIntegerParam(P_Enable, &enable);
+        unlock();
+        if (!enable) {
+            epicsThreadSleep(0.5);
+            continue;
+        }
+
+        if (readSample(&s) != asynSuccess) {
+            lock();
+            getIntegerParam(P_Errors, &errors);
+            setIntegerParam(P_Errors, errors + 1);
+            callParamCallbacks();
+            unlock();
+            epicsThreadSleep(0.1);
+            continue;
+        }
+
+        lock();
+        if (lastT > 0.0 && s.t > lastT) {
+            getDoubleParam(P_Rate, &rate);
+            setDoubleParam(P_Rate, rate ? rate * 0.95 + 0.05 / (s.t - lastT)
+                                        : 1.0 / (s.t - lastT));
+        }
+        lastT = s.t;
+
+        ring_[head_] = s;
+        head_ = (head_ + 1) % depth;
+        if (count_ < depth)
+            count_++;
+
+        getIntegerParam(P_State, &state);
+        if (state == REC_STATE_ARMED) {
+            source = pendingTrigger_ ? pendingTrigger_ : checkTrigger(s);
+            if (source != REC_TRIG_NONE) {
+                triggerIndex_ = (head_ + depth - 1) % depth;
+                epicsTimeGetCurrent(&triggerTime_);
+                getIntegerParam(P_Post, &post);
+                postRemaining_ = post;
+                setIntegerParam(P_TrigSource, source);
+                setIntegerParam(P_State, REC_STATE_POST);
+                state = REC_STATE_POST;
+            }
+        }
+        if (state == REC_STATE_POST) {
+            if (postRemaining_ <= 0)
+                freeze();
+            else
+                postRemaining_--;
+        }
+        pendingTrigger_ = REC_TRIG_NONE;
+        callParamCallbacks();
+        unlock();
+    }
+}
+
+asynStatus psuRecorder::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+    int depth, pre, post, state;
+
+    getIntegerParam(P_Depth, &depth);
+    getIntegerParam(P_State, &state);
+
+    if (function == P_Arm) {
+        if (value) {
+            pendingTrigger_ = REC_TRIG_NONE;
+            setIntegerParam(P_TrigSource, REC_TRIG_NONE);
+            setIntegerParam(P_State, REC_STATE_ARMED);
+        } else {
+            setIntegerParam(P_State, REC_STATE_IDLE);
+        }
+    } else if (function == P_Trigger) {
+        if (state == REC_STATE_IDLE || state == REC_STATE_ARMED) {
+            setIntegerParam(P_State, REC_STATE_ARMED);
+            pendingTrigger_ = REC_TRIG_MANUAL;
+        }
+    } else if (function == P_Pre || function == P_Post) {
+        /* The post-trigger samples must not overwrite the pre-trigger ones */
+        if (value < 0)
+            value = 0;
+        getIntegerParam(P_Pre, &pre);
+        getIntegerParam(P_Post, &post);
+        if (function == P_Pre && value + post >= depth)
+            value = depth - 1 - post;
+        if (function == P_Post && value + pre >= depth)
+            value = depth - 1 - pre;
+        setIntegerParam(function, value);
+    } else {
+        return asynPortDriver::writeInt32(pasynUser, value);
+    }
+    callParamCallbacks();
+    return asynSuccess;
+}
+
+asynStatus psuRecorder::writeOctet(asynUser *pasynUser, const char *value,
+                                   size_t maxChars, size_t *nActual)
+{
+    int function = pasynUser->reason;
+    char buf[256];
+
+    if (function == P_FileDir) {
+        if (maxChars >= sizeof buf)
+            maxChars = sizeof buf - 1;
+        memcpy(buf, value, maxChars);
+        buf[maxChars] = '\0';
+        /* Trailing slashes from the OPI would double up in the file name */
+        while (maxChars > 1 && buf[maxChars - 1] == '/')
+            buf[--maxChars] = '\0';
+        setStringParam(P_FileDir, buf);
+        callParamCallbacks();
+        *nActual = maxChars;
+        return asynSuccess;
+    }
+    return asynPortDriver::writeOctet(pasynUser, value, maxChars, nActual);
+}
+
+void psuRecorder::report(FILE *fp, int details)
+{
+    double rate;
+    int state;
+
+    getDoubleParam(P_Rate, &rate);
+    getIntegerParam(P_State, &state);
+    fprintf(fp, "%s: depth %u, %u samples, %.1f samples/s, state %d\n",
+            portName, (unsigned)ring_.size(), (unsigned)count_, rate, state);
+    asynPortDriver::report(fp, details);
+}
+
+/* Configuration routine. Called directly, or from the iocsh function below */
+
+extern "C" {
+
+int psuRecorderConfigure(const char *portName, const char *ioPortName, int depth)
+{
+    if (!portName || !ioPortName) {
+        errlogPrintf("Usage: psuRecorderConfigure portName ioPortName depth\n");
+        return -1;
+    }
+    new psuRecorder(portName, ioPortName, depth);
+    return 0;
+}
+
+/* EPICS iocsh shell commands */
+
+static const iocshArg initArg0 = { "portName",   iocshArgString };
+static const iocshArg initArg1 = { "ioPortName", iocshArgString };
+static const iocshArg initArg2 = { "depth",      iocshArgInt };
+static const iocshArg * const initArgs[] = { &initArg0, &initArg1, &initArg2 };
+static const iocshFuncDef initFuncDef = { "psuRecorderConfigure", 3, initArgs };
+
+static void initCallFunc(const iocshArgBuf *args)
+{
+    psuRecorderConfigure(args[0].sval, args[1].sval, args[2].ival);
+}
+
+static void psuRecorderRegister(void)
+{
+    iocshRegister(&initFuncDef, initCallFunc);
+}
+
+epicsExportRegistrar(psuRecorderRegister);
+
+}
@@ -0,0 +1,115 @@
+/* psuRecorder.h */
+
+#ifndef PSURECORDER_H
+#define PSURECORDER_H
+
+#include <vector>
+
+#include <epicsTypes.h>
+#include <epicsTime.h>
+
+#include "asynPortDriver.h"
+#include "asynOctet.h"
+
+#define REC_ENABLE_STRING       "REC_ENABLE"
+#define REC_STATE_STRING        "REC_STATE"
+#define REC_ARM_STRING          "REC_ARM"
+#define REC_TRIGGER_STRING      "REC_TRIGGER"
+#define REC_TRIG_SOURCE_STRING  "REC_TRIG_SOURCE"
+#define REC_TEMP_LIMIT_STRING   "REC_TEMP_LIMIT"
+#define REC_ILK_MASK_STRING     "REC_ILK_MASK"
+#define REC_DEPTH_STRING        "REC_DEPTH"
+#define REC_PRE_STRING          "REC_PRE"
+#define REC_POST_STRING         "REC_POST"
+#define REC_RATE_STRING         "REC_RATE"
+#define REC_NCAPTURED_STRING    "REC_NCAPTURED"
+#define REC_ERRORS_STRING       "REC_ERRORS"
+#define REC_FILE_DIR_STRING     "REC_FILE_DIR"
+#define REC_FILE_NAME_STRING    "REC_FILE_NAME"
+#define REC_TIME_STRING         "REC_TIME"
+#define REC_CURRENT_STRING      "REC_CURRENT"
+#define REC_VOLTAGE_STRING      "REC_VOLTAGE"
+#define REC_TEMP1_STRING        "REC_TEMP1"
+#define REC_TEMP2_STRING        "REC_TEMP2"
+#define REC_DCLINK_STRING       "REC_DCLINK"
+#define REC_STATUS_STRING       "REC_STATUS"
+
+/* Recorder states (REC_STATE) */
+#define REC_STATE_IDLE          0
+#define REC_STATE_ARMED         1
+#define REC_STATE_POST          2
+#define REC_STATE_FROZEN        3
+
+/* Trigger sources (REC_TRIG_SOURCE) */
+#define REC_TRIG_NONE           0
+#define REC_TRIG_MANUAL         1
+#define REC_TRIG_TEMP           2
+#define REC_TRIG_INTERLOCK      3
+
+/*
+ * Post-mortem recorder: polls the PSU readbacks back to back into a ring
+ * buffer and freezes a pre/post-trigger window when triggered.
+ */
+class psuRecorder : public asynPortDriver {
+public:
+    psuRecorder(const char *portName, const char *ioPortName, int depth);
+
+    virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+    virtual asynStatus writeOctet(asynUser *pasynUser, const char *value,
+                                  size_t maxChars, size_t *nActual);
+    virtual void report(FILE *fp, int details);
+
+    void recorderTask();
+
+protected:
+    int P_Enable;
+    int P_State;
+    int P_Arm;
+    int P_Trigger;
+    int P_TrigSource;
+    int P_TempLimit;
+    int P_IlkMask;
+    int P_Depth;
+    int P_Pre;
+    int P_Post;
+    int P_Rate;
+    int P_NCaptured;
+    int P_Errors;
+    int P_FileDir;
+    int P_FileName;
+    int P_Time;
+    int P_Current;
+    int P_Voltage;
+    int P_Temp1;
+    int P_Temp2;
+    int P_DClink;
+    int P_Status;
+
+private:
+    enum { nChannels = 6 };
+    struct sample {
+        double t;                   /* monotonic time, s */
+        double v[nChannels];        /* I, V, temp1, temp2, DC-link, status */
+    };
+
+    asynStatus transact(const char *command, char *reply, size_t replySize);
+    asynStatus readValue(const char *command, double *value);
+    asynStatus readSample(sample *ps);
+    int checkTrigger(const sample &s);
+    void freeze();
+    void writeFile(const std::vector<sample> &window, double tTrigger);
+
+    asynUser   *pasynUserIO_;
+    asynOctet  *pasynOctet_;
+    void       *octetPvt_;
+
+    std::vector<sample> ring_;
+    size_t      head_;              /* next slot to write */
+    size_t      count_;             /* valid samples in ring */
+    size_t      triggerIndex_;
+    int         postRemaining_;
+    int         pendingTrigger_;
+    epicsTimeStamp triggerTime_;
+};
+
+#endif /* PSURECORDER_H */
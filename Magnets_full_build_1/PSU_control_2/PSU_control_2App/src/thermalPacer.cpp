@@ -0,0 +1,450 @@
+/* thermalPacer.cpp */
+/*
+ * Thermal-aware pacing of long PSU current scans.
+ *
+ * TP_TEMP on address 0 is fed from PWRSPL:temp1 (heatsink, MRT) and on
+ * address 1 from PWRSPL:temp2 (shunt, MRTS), TP_CURRENT from PWRSPL:readI.
+ * Each sensor follows tau dT/dt = Tamb + k I^2 - T. The slope is a line
+ * fit over the last TP_WINDOW seconds at constant current and k is the
+ * exponentially weighted least squares solution of
+ * (T + tau dT/dt - Tamb) = k I^2, so it tracks the actual load and cooling
+ * conditions.
+ *
+ * The scan currents are written to TP_SCAN_LIST. A point is safe when no
+ * sensor is predicted to exceed TP_LIMIT during a dwell of TP_DWELL seconds
+ * at that current. Writing TP_NEXT takes the next point in scan order when it
+ * is safe, otherwise the highest safe current (reorder), and publishes it on
+ * TP_NEXT_I, with the choice made in TP_DECISION. TP_OUTLOOK is the choice
+ * a request would get now. When no remaining point is safe it is HOLD and
+ * TP_HOLD_TIME is the predicted cool-down at TP_HOLD_CURRENT before the
+ * gentlest remaining point becomes safe (-1 when it never does).
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include <epicsMath.h>
+#include <epicsTime.h>
+#include <epicsStdio.h>
+#include <errlog.h>
+#include <iocsh.h>
+
+#include "asynDriver.h"
+#include "thermalPacer.h"
+
+#include <epicsExport.h>
+
+static const char *driverName = "thermalPacer";
+
+/* Weight of the previous samples in the k estimate, per sample */
+#define TP_FORGET       0.99
+/* k is only updated above this I^2, A^2 */
+#define TP_MIN_I2       1.0
+/* A current step larger than this restarts the slope windows, A */
+#define TP_CURRENT_STEP 0.05
+/* Weight of the initial k, as I^4 of an equivalent sample, A^4 */
+#define TP_PRIOR_WEIGHT 1e4
+
+static const double defaultTau[TP_NSENSORS] = { 300.0, 120.0 };
+static const double defaultK[TP_NSENSORS]   = { 0.08, 0.08 };
+
+thermalPacer::thermalPacer(const char *portName, int maxPoints)
+    : asynPortDriver(portName, TP_NSENSORS,
+                     asynInt32Mask | asynFloat64Mask | asynFloat64ArrayMask | asynDrvUserMask,
+                     asynInt32Mask | asynFloat64Mask | asynFloat64ArrayMask,
+                     ASYN_MULTIDEVICE, 1, 0, 0),
+      maxPoints_(maxPoints > 0 ? maxPoints : 1000), candidate_(-1)
+{
+    int i;
+
+    createParam(TP_TEMP_STRING,          asynParamFloat64,      &P_Temp);
+    createParam(TP_TAU_STRING,           asynParamFloat64,      &P_Tau);
+    createParam(TP_K_STRING,             asynParamFloat64,      &P_K);
+    createParam(TP_SLOPE_STRING,         asynParamFloat64,      &P_Slope);
+    createParam(TP_T_SS_STRING,          asynParamFloat64,      &P_TSs);
+    createParam(TP_CURRENT_STRING,       asynParamFloat64,      &P_Current);
+    createParam(TP_AMBIENT_STRING,       asynParamFloat64,      &P_Ambient);
+    createParam(TP_LIMIT_STRING,         asynParamFloat64,      &P_Limit);
+    createParam(TP_DWELL_STRING,         asynParamFloat64,      &P_Dwell);
+    createParam(TP_HOLD_CURRENT_STRING,  asynParamFloat64,      &P_HoldCurrent);
+    createParam(TP_WINDOW_STRING,        asynParamFloat64,      &P_Window);
+    createParam(TP_SCAN_LIST_STRING,     asynParamFloat64Array, &P_ScanList);
+    createParam(TP_REMAINING_STRING,     asynParamFloat64Array, &P_Remaining);
+    createParam(TP_NREMAINING_STRING,    asynParamInt32,        &P_NRemaining);
+    createParam(TP_NEXT_STRING,          asynParamInt32,        &P_Next);
+    createParam(TP_NEXT_I_STRING,        asynParamFloat64,      &P_NextI);
+    createParam(TP_CANDIDATE_I_STRING,   asynParamFloat64,      &P_CandidateI);
+    createParam(TP_DECISION_STRING,      asynParamInt32,        &P_Decision);
+    createParam(TP_OUTLOOK_STRING,       asynParamInt32,        &P_Outlook);
+    createParam(TP_HOLD_TIME_STRING,     asynParamFloat64,      &P_HoldTime);
+    createParam(TP_HEADROOM_STRING,      asynParamFloat64,      &P_Headroom);
+    createParam(TP_TIME_TO_LIMIT_STRING, asynParamFloat64,      &P_TimeToLimit);
+    createParam(TP_LIMITING_STRING,      asynParamInt32,        &P_Limiting);
+
+    setDoubleParam(P_Current, 0.0);
+    setDoubleParam(P_Ambient, 25.0);
+    setDoubleParam(P_Limit, 57.0);      /* 3 degC below the HIHI of temp1/temp2 */
+    setDoubleParam(P_Dwell, 10.0);
+    setDoubleParam(P_HoldCurrent, 0.0);
+    setDoubleParam(P_Window, 30.0);
+    setIntegerParam(P_NRemaining, 0);
+    setDoubleParam(P_NextI, 0.0);
+    setDoubleParam(P_CandidateI, 0.0);
+    setIntegerParam(P_Decision, TP_DECISION_DONE);
+    setIntegerParam(P_Outlook, TP_DECISION_DONE);
+    setDoubleParam(P_HoldTime, 0.0);
+    setIntegerParam(P_Limiting, 0);
+    for (i = 0; i < TP_NSENSORS; i++) {
+        setDoubleParam(i, P_Temp, 25.0);
+        setDoubleParam(i, P_Tau, defaultTau[i]);
+        setDoubleParam(i, P_Slope, 0.0);
+        sensors_[i].slope = 0.0;
+        sensors_[i].slopeValid = false;
+        resetK(i, defaultK[i]);
+    }
+    evaluate();
+}
+
+void thermalPacer::resetK(int addr, double k)
+{
+    sensors_[addr].spp = TP_PRIOR_WEIGHT;
+    sensors_[addr].spy = TP_PRIOR_WEIGHT * k;
+    setDoubleParam(addr, P_K, k);
+}
+
+double thermalPacer::steadyTemp(int addr, double current)
+{
+    double ambient, k;
+
+    getDoubleParam(P_Ambient, &ambient);
+    getDoubleParam(addr, P_K, &k);
+    return ambient + k * current * current;
+}
+
+/* Temperature of a sensor after dt seconds at a constant current */
+double thermalPacer::tempAfter(int addr, double current, double dt)
+{
+    double temp, tau, tSs = steadyTemp(addr, current);
+
+    getDoubleParam(addr, P_Temp, &temp);
+    getDoubleParam(addr, P_Tau, &tau);
+    return tSs + (temp - tSs) * exp(-dt / tau);
+}
+
+void thermalPacer::addSample(int addr, double temp)
+{
+    sensor &s = sensors_[addr];
+    double now = epicsMonotonicGet() * 1e-9;
+    double window, tau, ambient, current;
+    size_t i, n, first;
+
+    getDoubleParam(P_Window, &window);
+    getDoubleParam(addr, P_Tau, &tau);
+    getDoubleParam(P_Ambient, &ambient);
+    getDoubleParam(P_Current, &current);
+
+    s.t.push_back(now);
+    s.temp.push_back(temp);
+    for (first = 0; first < s.t.size() && now - s.t[first] > window; first++)
+        ;
+    s.t.erase(s.t.begin(), s.t.begin() + first);
+    s.temp.erase(s.temp.begin(), s.temp.begin() + first);
+
+    /* Least squares slope, once the window is at least a third full */
+    n = s.t.size();
+    s.slopeValid = n >= 3 && s.t[n - 1] - s.t[0] >= window / 3.0;
+    if (s.slopeValid) {
+        double mt = 0.0, mT = 0.0, stt = 0.0, stT = 0.0;
+        for (i = 0; i < n; i++) {
+            mt += s.t[i];
+            mT += s.temp[i];
+        }
+        mt /= n;
+        mT /= n;
+        for (i = 0; i < n; i++) {
+            stt += (s.t[i] - mt) * (s.t[i] - mt);
+            stT += (s.t[i] - mt) * (s.temp[i] - mT);
+        }
+        s.slope = stt > 0.0 ? stT / stt : 0.0;
+    }
+    setDoubleParam(addr, P_Temp, temp);
+    setDoubleParam(addr, P_Slope, s.slope);
+
+    if (s.slopeValid && current * current >= TP_MIN_I2) {
+        double phi = current * current;
+        double y = temp + tau * s.slope - ambient;
+        s.spp = TP_FORGET * s.spp + phi * phi;
+        s.spy = TP_FORGET * s.spy + phi * y;
+        setDoubleParam(addr, P_K, fmax(s.spy / s.spp, 0.0));
+    }
+}
+
+/*
+ * Picks the next point: scan order if safe, else the highest safe current.
+ * Returns the decision; candidate_ is the index into remaining_.
+ */
+int thermalPacer::chooseNext(double *holdTime)
+{
+    double limit, dwell, holdCurrent;
+    double best = -1.0;
+    size_t i, gentlest = 0;
+    int addr;
+
+    *holdTime = 0.0;
+    candidate_ = -1;
+    if (remaining_.empty())
+        return TP_DECISION_DONE;
+
+    getDoubleParam(P_Limit, &limit);
+    getDoubleParam(P_Dwell, &dwell);
+    getDoubleParam(P_HoldCurrent, &holdCurrent);
+
+    for (i = 0; i < remaining_.size(); i++) {
+        double current = remaining_[i];
+        bool safe = true;
+        for (addr = 0; addr < TP_NSENSORS && safe; addr++) {
+            double temp;
+            getDoubleParam(addr, P_Temp, &temp);
+            safe = fmax(temp, tempAfter(addr, current, dwell)) <= limit;
+        }
+        if (safe && i == 0) {
+            candidate_ = 0;
+            return TP_DECISION_OK;
+        }
+        if (safe && fabs(current) > best) {
+            best = fabs(current);
+            candidate_ = (int)i;
+        }
+        if (fabs(current) < fabs(remaining_[gentlest]))
+            gentlest = i;
+    }
+    if (candidate_ >= 0)
+        return TP_DECISION_REORDER;
+
+    /*
+     * Cool-down before the gentlest point can start: it must start at or
+     * below T0 = min(limit, Tss + (limit - Tss) e^(dwell/tau)) on every sensor.
+     */
+    candidate_ = (int)gentlest;
+    for (addr = 0; addr < TP_NSENSORS; addr++) {
+        double temp, tau, tSs, tHold, t0, wait;
+
+        getDoubleParam(addr, P_Temp, &temp);
+        getDoubleParam(addr, P_Tau, &tau);
+        tSs = steadyTemp(addr, remaining_[gentlest]);
+        tHold = steadyTemp(addr, holdCurrent);
+        t0 = fmin(limit, tSs + (limit - tSs) * exp(dwell / tau));
+        if (temp <= t0)
+            continue;
+        if (t0 <= tHold) {
+            *holdTime = -1.0;
+            break;
+        }
+        wait = tau * log((temp - tHold) / (t0 - tHold));
+        *holdTime = fmax(*holdTime, wait);
+    }
+    return TP_DECISION_HOLD;
+}
+
+/*
+ * Headroom and time to limit at the present current, then the decision a
+ * TP_NEXT request would get now (TP_OUTLOOK)
+ */
+void thermalPacer::evaluate()
+{
+    double current, limit, dwell, holdTime;
+    double headroom = HUGE_VAL, timeToLimit = -1.0;
+    int addr, limiting = 0, decision;
+
+    getDoubleParam(P_Current, &current);
+    getDoubleParam(P_Limit, &limit);
+    getDoubleParam(P_Dwell, &dwell);
+
+    for (addr = 0; addr < TP_NSENSORS; addr++) {
+        double temp, tau, tSs, room, ttl;
+
+        getDoubleParam(addr, P_Temp, &temp);
+        getDoubleParam(addr, P_Tau, &tau);
+        tSs = steadyTemp(addr, current);
+        setDoubleParam(addr, P_TSs, tSs);
+
+        room = limit - fmax(temp, tempAfter(addr, current, dwell));
+        if (temp >= limit)
+            ttl = 0.0;
+        else if (tSs <= limit)
+            ttl = -1.0;
+        else
+            ttl = tau * log((tSs - temp) / (tSs - limit));
+
+        if (ttl >= 0.0 && (timeToLimit < 0.0 || ttl < timeToLimit)) {
+            timeToLimit = ttl;
+            limiting = addr;
+        } else if (timeToLimit < 0.0 && room < headroom) {
+            limiting = addr;
+        }
+        headroom = fmin(headroom, room);
+    }
+    setDoubleParam(P_Headroom, headroom);
+    setDoubleParam(P_TimeToLimit, timeToLimit);
+    setIntegerParam(P_Limiting, limiting);
+
+    decision = chooseNext(&holdTime);
+    setIntegerParam(P_Outlook, decision);
+    setDoubleParam(P_HoldTime, holdTime);
+    if (candidate_ >= 0)
+        setDoubleParam(P_CandidateI, remaining_[candidate_]);
+}
+
+void thermalPacer::publishRemaining()
+{
+    setIntegerParam(P_NRemaining, (int)remaining_.size());
+    doCallbacksFloat64Array(remaining_.empty() ? NULL : &remaining_[0],
+                            remaining_.size(), P_Remaining, 0);
+}
+
+asynStatus thermalPacer::writeFloat64(asynUser *pasynUser, epicsFloat64 value)
+{
+    int function = pasynUser->reason;
+    int addr;
+
+    getAddress(pasynUser, &addr);
+    if (!isfinite(value)) {
+        epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                      "%s: value is not finite", driverName);
+        return asynError;
+    }
+    if (function == P_Temp) {
+        addSample(addr, value);
+    } else if (function == P_Current) {
+        double current;
+        int i;
+
+        /* The slope only fits the model while the current is constant */
+        getDoubleParam(P_Current, &current);
+        if (fabs(value - current) > TP_CURRENT_STEP) {
+            for (i = 0; i < TP_NSENSORS; i++) {
+                sensors_[i].t.clear();
+                sensors_[i].temp.clear();
+                sensors_[i].slopeValid = false;
+            }
+        }
+        setDoubleParam(P_Current, value);
+    } else if (function == P_K) {
+        /* Writing k restarts the estimate from that value */
+        resetK(addr, fmax(value, 0.0));
+    } else if ((function == P_Tau || function == P_Window || function == P_Dwell) &&
+               value <= 0.0) {
+        epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                      "%s: value must be positive", driverName);
+        return asynError;
+    } else {
+        setDoubleParam(addr, function, value);
+    }
+    evaluate();
+    callParamCallbacks(0);
+    if (addr != 0)
+        callParamCallbacks(addr);
+    return asynSuccess;
+}
+
+asynStatus thermalPacer::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+    int decision;
+
+    if (function != P_Next)
+        return asynPortDriver::writeInt32(pasynUser, value);
+
+    evaluate();
+    getIntegerParam(P_Outlook, &decision);
+    setIntegerParam(P_Decision, decision);
+    if (decision == TP_DECISION_OK || decision == TP_DECISION_REORDER) {
+        /* Force the callback so an unchanged current still drives the PSU */
+        setDoubleParam(P_NextI, epicsNAN);
+        setDoubleParam(P_NextI, remaining_[candidate_]);
+        remaining_.erase(remaining_.begin() + candidate_);
+        publishRemaining();
+        evaluate();
+    }
+    callParamCallbacks(0);
+    return asynSuccess;
+}
+
+asynStatus thermalPacer::writeFloat64Array(asynUser *pasynUser, epicsFloat64 *value,
+                                           size_t nElements)
+{
+    int function = pasynUser->reason;
+    size_t i;
+
+    if (function != P_ScanList)
+        return asynPortDriver::writeFloat64Array(pasynUser, value, nElements);
+
+    for (i = 0; i < nElements; i++) {
+        if (!isfinite(value[i])) {
+            epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                          "%s: scan current %lu is not finite", driverName,
+                          (unsigned long)i);
+            return asynError;
+        }
+    }
+    if (nElements > maxPoints_)
+        nElements = maxPoints_;
+    remaining_.assign(value, value + nElements);
+    publishRemaining();
+    evaluate();
+    callParamCallbacks(0);
+    return asynSuccess;
+}
+
+void thermalPacer::report(FILE *fp, int details)
+{
+    static const char *decisions[] = { "OK", "Reorder", "Hold", "Done" };
+    double k, tau;
+    int decision, addr;
+
+    getIntegerParam(P_Decision, &decision);
+    fprintf(fp, "%s: %lu points left, decision %s\n", portName,
+            (unsigned long)remaining_.size(), decisions[decision]);
+    for (addr = 0; addr < TP_NSENSORS; addr++) {
+        getDoubleParam(addr, P_K, &k);
+        getDoubleParam(addr, P_Tau, &tau);
+        fprintf(fp, "    sensor %d: k %.4g degC/A^2, tau %g s, slope %s\n", addr, k, tau,
+                sensors_[addr].slopeValid ? "valid" : "filling");
+    }
+    asynPortDriver::report(fp, details);
+}
+
+/* Configuration routine. Called directly, or from the iocsh function below */
+
+extern "C" {
+
+int thermalPacerConfigure(const char *portName, int maxPoints)
+{
+    if (!portName) {
+        errlogPrintf("Usage: thermalPacerConfigure portName maxPoints\n");
+        return -1;
+    }
+    new thermalPacer(portName, maxPoints);
+    return 0;
+}
+
+/* EPICS iocsh shell commands */
+
+static const iocshArg initArg0 = { "portName",  iocshArgString };
+static const iocshArg initArg1 = { "maxPoints", iocshArgInt };
+static const iocshArg * const initArgs[] = { &initArg0, &initArg1 };
+static const iocshFuncDef initFuncDef = { "thermalPacerConfigure", 2, initArgs };
+
+static void initCallFunc(const iocshArgBuf *args)
+{
+    thermalPacerConfigure(args[0].sval, args[1].ival);
+}
+
+static void thermalPacerRegister(void)
+{
+    iocshRegister(&initFuncDef, initCallFunc);
+}
+
+epicsExportRegistrar(thermalPacerRegister);
+
+}
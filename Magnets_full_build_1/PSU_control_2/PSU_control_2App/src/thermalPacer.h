@@ -0,0 +1,110 @@
+/* thermalPacer.h */
+
+#ifndef THERMALPACER_H
+#define THERMALPACER_H
+
+#include <vector>
+
+#include <epicsTypes.h>
+
+#include "asynPortDriver.h"
+
+/* Per sensor parameters, asyn address 0 = heatsink (MRT), 1 = shunt (MRTS) */
+#define TP_TEMP_STRING          "TP_TEMP"
+#define TP_TAU_STRING           "TP_TAU"
+#define TP_K_STRING             "TP_K"
+#define TP_SLOPE_STRING         "TP_SLOPE"
+#define TP_T_SS_STRING          "TP_T_SS"
+
+/* Parameters on address 0 only */
+#define TP_CURRENT_STRING       "TP_CURRENT"
+#define TP_AMBIENT_STRING       "TP_AMBIENT"
+#define TP_LIMIT_STRING         "TP_LIMIT"
+#define TP_DWELL_STRING         "TP_DWELL"
+#define TP_HOLD_CURRENT_STRING  "TP_HOLD_CURRENT"
+#define TP_WINDOW_STRING        "TP_WINDOW"
+#define TP_SCAN_LIST_STRING     "TP_SCAN_LIST"
+#define TP_REMAINING_STRING     "TP_REMAINING"
+#define TP_NREMAINING_STRING    "TP_NREMAINING"
+#define TP_NEXT_STRING          "TP_NEXT"
+#define TP_NEXT_I_STRING        "TP_NEXT_I"
+#define TP_CANDIDATE_I_STRING   "TP_CANDIDATE_I"
+#define TP_DECISION_STRING      "TP_DECISION"
+#define TP_OUTLOOK_STRING       "TP_OUTLOOK"
+#define TP_HOLD_TIME_STRING     "TP_HOLD_TIME"
+#define TP_HEADROOM_STRING      "TP_HEADROOM"
+#define TP_TIME_TO_LIMIT_STRING "TP_TIME_TO_LIMIT"
+#define TP_LIMITING_STRING      "TP_LIMITING"
+
+#define TP_NSENSORS             2
+
+/* TP_DECISION, TP_OUTLOOK */
+#define TP_DECISION_OK          0   /* next point in scan order is safe */
+#define TP_DECISION_REORDER     1   /* a later point is run first */
+#define TP_DECISION_HOLD        2   /* no point is safe, cool down first */
+#define TP_DECISION_DONE        3   /* scan list exhausted */
+
+/*
+ * Thermal pacer: first order model per sensor,
+ *     tau dT/dt = Tamb + k I^2 - T,
+ * with k estimated online, used to pick the next scan current so that no
+ * sensor crosses TP_LIMIT during the dwell at that current.
+ */
+class thermalPacer : public asynPortDriver {
+public:
+    thermalPacer(const char *portName, int maxPoints);
+
+    virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+    virtual asynStatus writeFloat64(asynUser *pasynUser, epicsFloat64 value);
+    virtual asynStatus writeFloat64Array(asynUser *pasynUser, epicsFloat64 *value,
+                                         size_t nElements);
+    virtual void report(FILE *fp, int details);
+
+protected:
+    int P_Temp;
+    int P_Tau;
+    int P_K;
+    int P_Slope;
+    int P_TSs;
+    int P_Current;
+    int P_Ambient;
+    int P_Limit;
+    int P_Dwell;
+    int P_HoldCurrent;
+    int P_Window;
+    int P_ScanList;
+    int P_Remaining;
+    int P_NRemaining;
+    int P_Next;
+    int P_NextI;
+    int P_CandidateI;
+    int P_Decision;
+    int P_Outlook;
+    int P_HoldTime;
+    int P_Headroom;
+    int P_TimeToLimit;
+    int P_Limiting;
+
+private:
+    struct sensor {
+        std::vector<double> t, temp;    /* samples inside TP_WINDOW */
+        double slope;                   /* degC/s, line fit over the window */
+        bool slopeValid;
+        double spp, spy;                /* k = spy / spp, exponentially weighted */
+    };
+
+    void addSample(int addr, double temp);
+    void resetK(int addr, double k);
+    double steadyTemp(int addr, double current);
+    double tempAfter(int addr, double current, double dt);
+    int chooseNext(double *holdTime);
+    void evaluate();
+    void publishRemaining();
+
+    sensor sensors_[TP_NSENSORS];
+    std::vector<epicsFloat64> remaining_;
+    size_t maxPoints_;
+    int candidate_;
+};
+
+#endif /* THERMALPACER_H */
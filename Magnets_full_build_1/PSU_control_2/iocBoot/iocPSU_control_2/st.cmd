@@ -16,9 +16,30 @@ PSU_control_2_registerRecordDeviceDriver pdbbase
 
 ## Load record instances
 dbLoadRecords("../../db/pwrspl.db","user=iocadm")
+dbLoadRecords("../../db/pollScheduler.db","P=PWRSPL:sched:,PORT=PWRSPL_SCHED")
+dbLoadRecords("../../db/psuRecorder.db","P=PWRSPL:pm:,PORT=PWRSPL_PM,NELM=2000")
+dbLoadRecords("../../db/fieldPositioner.db","P=PWRSPL:field:,PORT=PWRSPL_FIELD,PSU=PWRSPL:,NPTS=1024")
+dbLoadRecords("../../db/excitationFit.db","P=PWRSPL:fit:,PORT=PWRSPL_FIT,PSU=PWRSPL:,FIELD=GSMTR:getmagfield,NPTS=1000")
+dbLoadRecords("../../db/thermalPacer.db","P=PWRSPL:pace:,PORT=PWRSPL_PACE,PSU=PWRSPL:,NPTS=1000")
 
 drvAsynIPPortConfigure("PWRSPL", "172.30.84.111:10001", 0, 0, 0)
 
+## Spread the periodic readbacks over the 1 s period instead of one burst
+pollSchedulerConfigure("PWRSPL_SCHED", "PWRSPL", 1.0)
+
+## Post-mortem ring buffer of the readbacks, frozen on alarm/interlock/request
+psuRecorderConfigure("PWRSPL_PM", "PWRSPL", 4000)
+
+## Field setpoint in gauss, solved to current from the excitation table
+## (second argument: table file to load at startup, may be empty)
+fieldPositionerConfigure("PWRSPL_FIELD", "")
+
+## Online B(I) fit from readI and the gaussmeter field (max stored points)
+excitationFitConfigure("PWRSPL_FIT", 1000)
+
+## Pick scan currents from the temperature trends so temp1/temp2 stay below HIHI
+thermalPacerConfigure("PWRSPL_PACE", 1000)
+
 iocInit()
 
 ## Start any sequence programs